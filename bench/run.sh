@@ -0,0 +1,66 @@
+#!/bin/sh
+# Run the benchmarks: best wall time of a few runs, ops/sec from the
+# `// ops:` line of each script and the peak rss reported by --stats.
+#
+# usage: bench/run.sh [-n runs] [-s baseline] [-c baseline] [catis]
+#   -n runs      runs per script, the best one counts (default 3)
+#   -s baseline  save the results there
+#   -c baseline  compare with results saved before
+#   catis        the binary to measure (default build/catis)
+set -e
+
+bench=$(dirname "$0")
+runs=3
+save=
+compare=
+while getopts n:s:c: option; do
+    case $option in
+        n) runs=$OPTARG ;;
+        s) save=$OPTARG ;;
+        c) compare=$OPTARG ;;
+        *) sed -n 's/^# \{0,1\}//; 5,9p' "$0" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+catis=${1:-$bench/../build/catis}
+
+now() {
+    date +%s%N
+}
+
+results=$(mktemp)
+trap 'rm -f "$results" "$results.stats"' EXIT
+
+printf '%-12s %10s %14s %10s' benchmark seconds ops/sec "rss kb"
+[ -n "$compare" ] && printf ' %10s' speedup
+printf '\n'
+
+for script in "$bench"/*.cat; do
+    name=$(basename "$script" .cat)
+    ops=$(sed -n 's|^// ops: *||p' "$script")
+    best=
+    for run in $(seq "$runs"); do
+        start=$(now)
+        "$catis" --stats "$script" < /dev/null > /dev/null 2> "$results.stats"
+        time=$(( $(now) - start ))
+        if [ -z "$best" ] || [ "$time" -lt "$best" ]; then
+            best=$time
+        fi
+    done
+    rss=$(sed -n 's/^peak rss kb *//p' "$results.stats")
+    seconds=$(awk "BEGIN { printf \"%.3f\", $best / 1e9 }")
+    rate=$(awk "BEGIN { printf \"%.0f\", $ops / ($best / 1e9) }")
+    echo "$name $seconds $rate $rss" >> "$results"
+
+    printf '%-12s %10s %14s %10s' "$name" "$seconds" "$rate" "$rss"
+    if [ -n "$compare" ]; then
+        before=$(awk -v name="$name" '$1 == name { print $2 }' "$compare")
+        if [ -n "$before" ]; then
+            printf ' %9.2fx' "$(awk "BEGIN { print $before / $seconds }")"
+        fi
+    fi
+    printf '\n'
+done
+
+[ -n "$save" ] && cp "$results" "$save"
+exit 0
@@ -0,0 +1,93 @@
+/* catis embedding API, see the Embedding section of the readme */
+#ifndef CATIS_H
+#define CATIS_H
+
+#include <stddef.h>
+#include <limits.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* -- types -- */
+#define CATIS_TYPE_BOOL    (1<<0)
+#define CATIS_TYPE_INT     (1<<1)
+#define CATIS_TYPE_LIST    (1<<2)
+#define CATIS_TYPE_STRING  (1<<3)
+#define CATIS_TYPE_SYMBOL  (1<<4)
+#define CATIS_TYPE_TUPLE   (1<<5)
+#define CATIS_TYPE_CAPTURE (1<<6)
+#define CATIS_TYPE_VECTOR  (1<<7)
+#define CATIS_TYPE_DICT    (1<<8)
+#define CATIS_TYPE_RANGE   (1<<9)
+#define CATIS_TYPE_ANY    INT_MAX
+
+// procedures shared read only by the interpreters made from them
+typedef struct catis_shared catis_library;
+// one interpreter: its stack, frames and own procedures
+typedef struct catis_context catis_context;
+typedef struct catis_object catis_object;
+// 0 when done, else 1 after catis_fail
+typedef int (*catis_c_procedure)(catis_context* context);
+
+/* -- libraries -- */
+/*
+ * The built-ins, with whatever is evaluated and registered in the library
+ * before the first interpreter is made from it. From then on it does not
+ * change: interpreters on any thread use it at the same time, and the
+ * names they define only shadow its procedures for their own code.
+ */
+catis_library* catis_library_new(void);
+int catis_library_eval(catis_library* library, const char* program);
+int catis_library_register(
+    catis_library* library,
+    const char* name,
+    catis_c_procedure procedure
+);
+// freed once released and the interpreters made from it are destroyed
+void catis_library_release(catis_library* library);
+
+/* -- interpreters -- */
+/*
+ * An interpreter is used by one thread at a time. Errors are returned as
+ * 1, catis_error tells what went wrong until the next one.
+ */
+catis_context* catis_new(catis_library* library);
+void catis_destroy(catis_context* context);
+int catis_eval(catis_context* context, const char* program);
+int catis_call(catis_context* context, const char* name);
+void catis_register(
+    catis_context* context,
+    const char* name,
+    catis_c_procedure procedure
+);
+const char* catis_error(catis_context* context);
+// for C procedures, returns 1
+int catis_fail(catis_context* context, const char* message);
+
+/* -- values -- */
+/*
+ * Reference counted, each new or popped value is the caller's to release
+ * or to push. Values may go from an interpreter to another, lists of code
+ * are best kept to the one that made them.
+ */
+void catis_push(catis_context* context, catis_object* value);
+catis_object* catis_pop(catis_context* context); // NULL on an empty stack
+size_t catis_depth(catis_context* context);
+catis_object* catis_int(int value);
+catis_object* catis_bool(int value);
+catis_object* catis_string(const char* string, size_t length);
+catis_object* catis_parse(const char* source); // NULL if it does not parse
+int catis_type(catis_object* value);
+int catis_int_value(catis_object* value);
+int catis_bool_value(catis_object* value);
+// strings and symbols, NULL for others; not NUL terminated
+const char* catis_string_value(catis_object* value, size_t* length);
+void catis_retain(catis_object* value);
+void catis_release(catis_object* value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,16 +16,46 @@
 #include <limits.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "catis.h"
 
 /* -- types -- */
-#define CATIS_TYPE_BOOL    (1<<0)
-#define CATIS_TYPE_INT     (1<<1)
-#define CATIS_TYPE_LIST    (1<<2)
-#define CATIS_TYPE_STRING  (1<<3)
-#define CATIS_TYPE_SYMBOL  (1<<4)
-#define CATIS_TYPE_TUPLE   (1<<5)
-#define CATIS_TYPE_CAPTURE (1<<6)
-#define CATIS_TYPE_ANY    INT_MAX
+// the CATIS_TYPE_ bits are in catis.h
+
+/*
+ * Integers and booleans are immediates: they are never allocated, the
+ * value lives in the catis_object pointer it-self, tagged by its low bits
+ * (heap objects are at least 4 bytes aligned). Always go through
+ * object_type(), object_integer() and object_boolean() when a value may
+ * be an immediate.
+ */
+#define CATIS_TAG_MASK 3
+#define CATIS_TAG_INT  1
+#define CATIS_TAG_BOOL 2
+
+/* -- interned symbol names -- */
+typedef struct catis_atom {
+    const char* name;
+    size_t length;
+    unsigned int hash;
+    struct catis_atom* next; // next atom in the same bucket
+} catis_atom;
+
+// to reference before implementing
+struct catis_procedure;
+struct catis_entry;
 
 /* -- object representation -- */
 typedef struct catis_object {
@@ -38,57 +68,486 @@ typedef struct catis_object {
         struct {
             struct catis_object** element;
             size_t length;
+            size_t capacity;
         } collection;
+        // packed ints, #[...]: half a list of them, no tags to check
+        struct {
+            int* element;
+            size_t length;
+            size_t capacity;
+        } vector;
+        // #{key value ...}, capacity is a power of two
+        struct {
+            struct catis_entry* entry;
+            size_t length;
+            size_t capacity;
+        } dict;
+        // start end range, the ints from start to end, never materialized
+        struct {
+            int start;
+            int end;
+        } range;
         struct {
             char* pointer;
             size_t length;
+            size_t capacity; // bytes allocated, including the terminator
             int quoted; // for symbols to know if evaluating or not
+            // symbols of a library's bodies, they resolve in it alone
+            int library;
+            union {
+                catis_atom* atom; // interned name, symbols only
+                // strings owning their buffer: bytes in use by them and
+                // their slices, what lies past it is free to append into
+                size_t used;
+            };
+            union {
+                // call site cache, valid while generation is current
+                struct catis_procedure* cached_procedure;
+                // strings: the owner of the buffer a slice points into,
+                // NULL for a string owning its buffer
+                struct catis_object* parent;
+            };
+            unsigned int cached_generation;
+            // $ loads: last read before a rebind, while generation is current
+            unsigned int last_use_generation;
         } string_or_symbol;
     };
 } catis_object;
 
+typedef struct catis_entry {
+    catis_object* key; // NULL for a free slot
+    catis_object* value;
+    unsigned int hash;
+} catis_entry;
+
 
 /* -- procedure representation -- */
 // to reference before implementing
 struct catis_context;
 
+/* -- bytecode representation -- */
+enum {
+    OP_PUSH_CONST,   // push object
+    OP_LOAD_LOCAL,   // push local operand, object is the $ symbol
+    OP_MOVE_LOCAL,   // same as OP_LOAD_LOCAL, taking it out of the frame
+    OP_STORE_LOCALS, // pop into the locals named by the capture object
+    OP_CALL_C,       // call C procedure
+    OP_CALL_PROC,    // call catis procedure, operand set if a tail call
+    OP_CALL_SYMBOL,  // call whatever object names, it was unbound
+    OP_JUMP,         // go to operand
+    OP_JUMP_UNLESS,  // pop boolean, go to operand if false (if, while)
+    OP_RETURN,
+
+    // define time optimizations, see optimize_call. While no name was
+    // rebound since compiling, else they do what they replaced
+    OP_DUP,              // inlined C procedure, dup swap drop or ~
+    OP_SWAP,
+    OP_DROP,
+    OP_NOT,
+    OP_PUSH_FOLDED,      // int operands, operand packs both, object the result
+    OP_COMPARE_LOCALS,   // $a $b < and the like, operand packs the names
+    OP_INCREMENT_LOCAL,  // $i k + {i}, object is k, negated for -
+    OP_INLINE,           // the body of procedure follows, up to operand
+
+    // calls inference proved safe, see infer_types
+    OP_MATH_INT,         // + - * of two ints, no type checks
+    OP_COMPARE_INT,      // comparison of two ints
+};
+
+typedef struct catis_instruction {
+    int opcode;
+    int line;
+    size_t operand;
+    catis_object* object;
+    struct catis_procedure* procedure;
+} catis_instruction;
+
+typedef struct catis_code {
+    catis_instruction* instruction;
+    size_t length;
+    size_t fence; // a jump may land there, peepholes do not reach before
+    int reference_count;
+    unsigned int generation; // procedure_generation it was compiled at
+    size_t mistyped; // 1 + a call every run fails at, 0 if none
+} catis_code;
+
 typedef struct catis_procedure {
     const char* name;
+    catis_atom* atom;
     catis_object* procedure; // if NULL then is a C procedure
+    catis_code* code; // compiled procedure, see %vm
     int (*c_procedure)(struct catis_context*);
-    struct catis_procedure* next;
+    struct catis_object* source; // catis definition of a native, for unquote
+    struct catis_join* join; // inputs of a join procedure, see library_join
+    struct catis_memo* memo; // results of a memoized one, see library_memo
+    struct catis_procedure* next; // definition order, for %defs
+
+    // define time analysis of the body, redone when a name is rebound
+    unsigned int analysis_generation;
+    struct catis_slots* slots; // frame layout
+    int frameless; // touches no locals, runs in its caller's frame
+    int foreign; // may evaluate lists that are not literals of the body
+    int uses_caller_frame; // up-eval may reach it, no tail calls into it
+
+    // sums over a profile's call tree, filled in for each report
+    struct {
+        uint64_t calls;
+        uint64_t self; // nanoseconds
+        uint64_t total;
+        int open; // activations on the path walked, recursion counts once
+    } profile;
 } catis_procedure;
 
+/* -- frame layout of a procedure, shared by its live frames -- */
+typedef struct catis_slots {
+    int reference_count;
+    size_t local_count;
+    unsigned char slot[256]; // local name -> frame slot + 1, 0 if unused
+} catis_slots;
+
 /* -- stack frames for local variables -- */
 #define CATIS_MAX_LOCALVARS 256
 typedef struct stackframe {
-    catis_object* locals[CATIS_MAX_LOCALVARS];
+    catis_object** locals; // local_count slots, right after the frame
+    catis_slots* slots; // NULL: every name has a slot, its character
+    size_t local_count;
+    // locals the analysis did not see, captured by lists evaluated here
+    catis_object** overflow;
     catis_procedure* procedure;
     int line;
     struct stackframe* previous;
 } stackframe;
 
-/* -- intrepret context -- */
+/* -- control stack, so calls do not recurse in C -- */
+typedef struct catis_activation {
+    catis_procedure* procedure;
+    catis_object* body; // kept alive in case it redefines itself
+    catis_code* code;
+    stackframe* caller; // frame to go back to, NULL if frameless
+    // frameless procedures name themselves in the caller's frame meanwhile
+    stackframe* host;
+    catis_procedure* caller_procedure;
+    int caller_line;
+} catis_activation;
+
+enum {
+    CONTROL_LIST, // evaluating the elements of a list
+    CONTROL_IF,   // if, if-else or while
+    CONTROL_CALL, // catis procedure activation
+    CONTROL_COMPILED, // procedure of catis -c, running in the caller's frame
+};
+
+enum {
+    IF_CONDITION, // evaluating the condition
+    IF_BRANCH,    // evaluating the chosen branch, done after it
+    IF_BODY,      // evaluating a while body, back to the condition after it
+};
+
+typedef struct catis_control {
+    int kind;
+    union {
+        struct {
+            catis_object* list;
+            size_t index;
+        } list;
+        struct {
+            catis_procedure* procedure; // for error messages and while
+            catis_object* condition;
+            catis_object* branch;
+            catis_object* else_branch; // NULL unless if-else
+            int state;
+        } conditional;
+        struct {
+            catis_activation activation;
+            // vm only, where the caller continues
+            catis_code* return_code;
+            catis_instruction* return_pc;
+        } call;
+        struct {
+            stackframe* host;
+            // what the frame ran, and where, before the call
+            catis_procedure* caller_procedure;
+            int caller_line;
+        } compiled;
+    };
+} catis_control;
+
+/* -- state shared by an interpreter and its tasks -- */
+typedef struct catis_shared {
+    catis_procedure* procedure; // definition order, for %defs
+    catis_procedure** procedure_table; // open addressing, keyed by atom
+    size_t procedure_table_size;
+    size_t procedure_count;
+    // evaluating threads hold it for reading, definitions for writing
+    pthread_rwlock_t definitions;
+    pthread_mutex_t analysis; // analysis and compilation of stale procedures
+    struct catis_pool* pool; // started by the first join that fires
+    // embedding: the library names fall back to, see catis_new
+    struct catis_shared* base;
+    int reference_count; // of a library: itself and its interpreters
+    int frozen; // a library interpreters were made from
+} catis_shared;
+
+/* -- output representation -- */
+/*
+ * What a context prints is buffered and written out when full, on flush,
+ * before a prompt or waiting for tasks, and when a task is done. On a
+ * terminal, the lines ended by print and . go out at once.
+ */
+#define CATIS_OUTPUT_BUFFER_SIZE (64 * 1024)
+typedef struct catis_output {
+    char* bytes; // allocated on the first write
+    size_t length;
+    int line_buffered; // stdout is a terminal
+} catis_output;
+
+/* -- intrepret context, one per task -- */
 #define CATIS_ERROR_STRING_LENGTH 256
 typedef struct catis_context {
     size_t stack_length;
+    size_t stack_capacity;
+    size_t stack_reserved; // never shrink the stack below this
+    size_t stack_high_water; // most objects it ever held, see %stats
     catis_object** stack;
-    catis_procedure* procedure;
+    catis_shared* shared;
     stackframe* frame;
+    catis_control* control; // what eval and the vm come back to
+    size_t control_length;
+    size_t control_capacity;
+    int vm; // compile procedures to bytecode, see %vm
+    int fired; // fired a join since the last form of a file, see eval_forms
+    struct catis_profile* profile; // NULL unless between %profile-start/stop
+    struct catis_profile* last_profile; // stopped, for the reports
+    catis_output output;
     char error_string[CATIS_ERROR_STRING_LENGTH]; // to stock error messages
+    size_t error_frame_end; // past the current frame in its trace, 0 if none
+    catis_procedure* c_caller; // what the frame ran before its C procedure
 } catis_context;
 
+/* -- command line options -- */
+typedef struct catis_options {
+    size_t stack_size; // objects to preallocate on the stack
+    const char* profile; // folded stacks of the file's run go there
+    int stats; // print %stats on stderr when done
+    const char* save_image; // the procedures defined go there when done
+    const char* load_image; // procedures to start with
+    int compile; // catis -c: write the file out as C instead of running it
+    const char* serve; // socket to run the files of clients on, see serve
+    const char* connect; // socket of the server to run the file on
+    // the procedures of a file catis -c compiled, built in with it
+    void (*load_compiled)(catis_context*);
+} catis_options;
+
 // to reference before implementing
 void set_error(
     catis_context* context,
     const char* pointer,
     const char* message
 );
+catis_object* new_vector(size_t capacity);
+catis_object* range_to_list(catis_object* range);
 catis_procedure* lookup_procedure(catis_context* context, const char* name);
+catis_procedure* lookup_atom_procedure(
+    catis_context* context,
+    catis_atom* atom
+);
+catis_procedure* resolve_procedure(
+    catis_context* context,
+    catis_object* symbol
+);
+void analyze_procedure(
+    catis_context* context,
+    catis_procedure* procedure,
+    int at_definition
+);
+int call_procedure(catis_context* context, catis_procedure* procedure);
+int check_stack_type(catis_context* context, size_t count, ...);
+int library_math(catis_context* context);
+int library_compare(catis_context* context);
+int library_dup(catis_context* context);
+int library_swap(catis_context* context);
+int library_drop(catis_context* context);
+int library_not(catis_context* context);
+int library_if(catis_context* context);
+int library_eval(catis_context* context);
+int library_up_eval(catis_context* context);
+int library_map(catis_context* context);
+int library_each(catis_context* context);
+int library_parallel(catis_context* context);
+int library_send(catis_context* context);
+int library_memo(catis_context* context);
+int library_logic(catis_context* context);
+int library_length(catis_context* context);
+int library_print(catis_context* context);
+int library_println(catis_context* context);
+int library_flush(catis_context* context);
+int library_list_append(catis_context* context);
+int library_at(catis_context* context);
+int library_slice(catis_context* context);
+int library_concatenate(catis_context* context);
+int library_get(catis_context* context);
+int library_put(catis_context* context);
+int library_range(catis_context* context);
+int library_tail(catis_context* context);
+int library_to_vector(catis_context* context);
+int library_to_list(catis_context* context);
+int library_sort(catis_context* context);
 void load_library(catis_context* context);
 
+/* -- threads -- */
+// set once the first worker thread starts and never cleared: from then on
+// reference counts are atomic and the shared tables are locked
+int multithreaded = 0;
+
+static inline void count_up(int* count) {
+    if (multithreaded) {
+        __atomic_add_fetch(count, 1, __ATOMIC_RELAXED);
+    }
+    else {
+        (*count)++;
+    }
+}
+
+/* returns what is left */
+static inline int count_down(int* count) {
+    if (multithreaded) {
+        return __atomic_sub_fetch(count, 1, __ATOMIC_ACQ_REL);
+    }
+    return --*count;
+}
+
+static inline int count_of(const int* count) {
+    return multithreaded ? __atomic_load_n(count, __ATOMIC_ACQUIRE) : *count;
+}
+
+// this thread holds the definitions lock for reading, see enter_shared
+_Thread_local int reading_definitions = 0;
+
+/* around evaluation: definitions wait for the threads in it */
+void enter_shared(catis_shared* shared) {
+    if (multithreaded && !reading_definitions) {
+        pthread_rwlock_rdlock(&shared->definitions);
+        reading_definitions = 1;
+    }
+}
+
+void leave_shared(catis_shared* shared) {
+    if (reading_definitions) {
+        pthread_rwlock_unlock(&shared->definitions);
+        reading_definitions = 0;
+    }
+}
+
+/* around rebinding a name, nobody else evaluates meanwhile */
+void lock_definitions(catis_shared* shared) {
+    if (!multithreaded) {
+        return;
+    }
+    if (reading_definitions) {
+        pthread_rwlock_unlock(&shared->definitions);
+    }
+    pthread_rwlock_wrlock(&shared->definitions);
+}
+
+void unlock_definitions(catis_shared* shared) {
+    if (!multithreaded) {
+        return;
+    }
+    pthread_rwlock_unlock(&shared->definitions);
+    if (reading_definitions) {
+        pthread_rwlock_rdlock(&shared->definitions);
+    }
+}
+
+/* -- statistics -- */
+/*
+ * Counters for %stats, kept per thread so that workers do not fight over
+ * them, summed when reported. Live objects are counted by type bit, ints
+ * and booleans are immediates and never counted.
+ */
+#define CATIS_TYPE_BITS 10
+
+typedef struct catis_stats {
+    size_t allocations;
+    size_t frees;
+    size_t bytes_allocated;
+    size_t bytes_freed; // not known with plain malloc
+    long live[CATIS_TYPE_BITS];
+    size_t copies; // shallow_copy
+    size_t bytes_copied;
+    size_t unshared_reused; // get_unshared_object
+    size_t unshared_copied;
+    size_t frames;
+    size_t memo_hits; // define-memo
+    size_t memo_misses;
+    int registered;
+    struct catis_stats* next;
+} catis_stats;
+
+_Thread_local catis_stats stats;
+catis_stats* all_stats = NULL;
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* once per thread, before it allocates, so %stats sums it */
+void register_stats(void) {
+    if (stats.registered) {
+        return;
+    }
+    pthread_mutex_lock(&stats_lock);
+    stats.registered = 1;
+    stats.next = all_stats;
+    all_stats = &stats;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+// of the threads that are gone
+catis_stats retired_stats;
+
+void add_stats(catis_stats* sum, catis_stats* thread) {
+    sum->allocations += thread->allocations;
+    sum->frees += thread->frees;
+    sum->bytes_allocated += thread->bytes_allocated;
+    sum->bytes_freed += thread->bytes_freed;
+    for (int i = 0; i < CATIS_TYPE_BITS; i++) {
+        sum->live[i] += thread->live[i];
+    }
+    sum->copies += thread->copies;
+    sum->bytes_copied += thread->bytes_copied;
+    sum->unshared_reused += thread->unshared_reused;
+    sum->unshared_copied += thread->unshared_copied;
+    sum->frames += thread->frames;
+    sum->memo_hits += thread->memo_hits;
+    sum->memo_misses += thread->memo_misses;
+}
+
+/* before a registered thread exits */
+void unregister_stats(void) {
+    if (!stats.registered) {
+        return;
+    }
+    pthread_mutex_lock(&stats_lock);
+    catis_stats** link = &all_stats;
+    while (*link != &stats) {
+        link = &(*link)->next;
+    }
+    *link = stats.next;
+    add_stats(&retired_stats, &stats);
+    stats.registered = 0;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void sum_stats(catis_stats* sum) {
+    memset(sum, 0, sizeof(*sum));
+    pthread_mutex_lock(&stats_lock);
+    add_stats(sum, &retired_stats);
+    for (catis_stats* thread = all_stats; thread; thread = thread->next) {
+        add_stats(sum, thread);
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
 /* -- out of memory utils -- */
-void* catis_allocate(size_t size) {
+void* checked_malloc(size_t size) {
     void* pointer = malloc(size);
     if (!pointer) {
         fprintf(stderr, "Out of memory allocating %zu bytes\n", size);
@@ -97,7 +556,7 @@ void* catis_allocate(size_t size) {
     return pointer;
 }
 
-void* catis_reallocate(void* old_pointer, size_t size) {
+void* checked_realloc(void* old_pointer, size_t size) {
     void* pointer = realloc(old_pointer, size);
     if (!pointer) {
         fprintf(stderr, "Out of memory allocating %zu bytes\n", size);
@@ -106,1413 +565,9706 @@ void* catis_reallocate(void* old_pointer, size_t size) {
     return pointer;
 }
 
-/* -- object -- */
-void release(catis_object* object) {
-    if (object == NULL) return;
-    assert(object->reference_count >= 0); 
-    if (--object->reference_count == 0) {
-        switch (object->type) {
-            case CATIS_TYPE_LIST:
-            case CATIS_TYPE_TUPLE:
-            case CATIS_TYPE_CAPTURE:
-                for (size_t i = 0; i < object->collection.length; i++) {
-                    release(object->collection.element[i]);
-                }
-                free(object->collection.element);
-                break;
-            case CATIS_TYPE_STRING:
-            case CATIS_TYPE_SYMBOL:
-                free(object->string_or_symbol.pointer);
-                break;
-            default:
-                break;
-        }
-        free(object);
+/* -- allocator -- */
+#ifdef CATIS_MALLOC
+// plain malloc, for ASan and valgrind runs
+void* catis_allocate(size_t size) {
+    stats.allocations++;
+    stats.bytes_allocated += size;
+    return checked_malloc(size);
+}
+
+void* catis_reallocate(void* old_pointer, size_t size) {
+    if (old_pointer == NULL) {
+        return catis_allocate(size);
     }
+    stats.bytes_allocated += size;
+    return checked_realloc(old_pointer, size);
 }
 
-void retain(catis_object* object) {
-    object->reference_count++;
+void catis_free(void* pointer) {
+    if (pointer) {
+        stats.frees++;
+    }
+    free(pointer);
 }
 
-catis_object* new_object(int type) {
-    catis_object* object = catis_allocate(sizeof(*object));
-    object->reference_count = 1;
-    object->type = type;
-    object->line = 0;
-    return object;
+void retire_heap(void) {
 }
+#else
+/*
+ * Small blocks come from size class slabs with a free list per class, big
+ * ones from malloc. Each block is preceded by its capacity in bytes. The
+ * heap is per thread, so that release() needs no context and a block may
+ * be freed by another thread than the one that allocated it.
+ */
+#define CATIS_SLAB_SIZE (64 * 1024)
+#define CATIS_SIZE_CLASSES 10
+#define CATIS_LARGE_CLASS CATIS_SIZE_CLASSES
+#define CATIS_MAX_SMALL_SIZE 512
+
+const size_t size_class_bytes[CATIS_SIZE_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512
+};
 
-/* -- lexing and parsing -- */
-int is_symbol(int character) {
-    if (isalpha(character)) {
-        return 1;
+// class for every size rounded up to 16 bytes
+const unsigned char size_class_lookup[CATIS_MAX_SMALL_SIZE / 16 + 1] = {
+    0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7,
+    8, 8, 8, 8, 8, 8, 8, 8, 9, 9, 9, 9, 9, 9, 9, 9
+};
+
+typedef struct catis_free_block {
+    struct catis_free_block* next;
+} catis_free_block;
+
+typedef struct catis_heap {
+    catis_free_block* free_list[CATIS_SIZE_CLASSES];
+} catis_heap;
+
+_Thread_local catis_heap heap;
+// the free blocks of threads that are gone, refilled from before malloc
+catis_heap orphan_heap;
+pthread_mutex_t orphan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t size_class(size_t size) {
+    if (size > CATIS_MAX_SMALL_SIZE) {
+        return CATIS_LARGE_CLASS;
     }
-    switch (character) {
-        case '@':
-        case '$':
-        case '+':
-        case '-':
-        case '*':
-        case '/':
-        case '=':
-        case '?':
-        case '%':
-        case '>':
-        case '<':
-        case '_':
-        case '.':
-        case '^':
-        case '|':
-        case '&':
-        case '~':
-        case '\'':
-            return 1;
-        default:
-            return 0;
+    return size_class_lookup[(size + 15) / 16];
+}
+
+void refill_size_class(size_t class) {
+    pthread_mutex_lock(&orphan_lock);
+    heap.free_list[class] = orphan_heap.free_list[class];
+    orphan_heap.free_list[class] = NULL;
+    pthread_mutex_unlock(&orphan_lock);
+    if (heap.free_list[class]) {
+        return;
+    }
+
+    size_t block_size = sizeof(size_t) + size_class_bytes[class];
+    char* slab = checked_malloc(CATIS_SLAB_SIZE);
+    for (
+        size_t offset = 0;
+        offset + block_size <= CATIS_SLAB_SIZE;
+        offset += block_size
+    ) {
+        catis_free_block* block = (catis_free_block*)(slab + offset);
+        block->next = heap.free_list[class];
+        heap.free_list[class] = block;
     }
 }
 
-const char* consume_space_and_comment(const char* string, int* line) {
-    while (1) {
-        while (isspace(string[0])) {
-            if (string[0] == '\n' && line) {
-                (*line)++;
-            }
-            string++;
+void* catis_allocate(size_t size) {
+    size_t class = size_class(size);
+    size_t* block;
+    if (class == CATIS_LARGE_CLASS) {
+        block = checked_malloc(sizeof(size_t) + size);
+        block[0] = size;
+    }
+    else {
+        if (heap.free_list[class] == NULL) {
+            refill_size_class(class);
         }
-        if (!(string[0] == '/' && string[1] == '/')) {
-            break;
+        block = (size_t*)heap.free_list[class];
+        heap.free_list[class] = heap.free_list[class]->next;
+        block[0] = size_class_bytes[class];
+    }
+    stats.allocations++;
+    stats.bytes_allocated += block[0];
+    return block + 1;
+}
+
+void catis_free(void* pointer) {
+    if (pointer == NULL) {
+        return;
+    }
+    size_t* block = (size_t*)pointer - 1;
+    size_t class = size_class(block[0]);
+    stats.frees++;
+    stats.bytes_freed += block[0];
+    if (class == CATIS_LARGE_CLASS) {
+        free(block);
+        return;
+    }
+    catis_free_block* free_block = (catis_free_block*)block;
+    free_block->next = heap.free_list[class];
+    heap.free_list[class] = free_block;
+}
+
+/* before a thread exits, so that its free blocks are not lost */
+void retire_heap(void) {
+    pthread_mutex_lock(&orphan_lock);
+    for (size_t class = 0; class < CATIS_SIZE_CLASSES; class++) {
+        catis_free_block* last = heap.free_list[class];
+        if (last == NULL) {
+            continue;
         }
-        while (string[0] && string[0] != '\n') {
-            string++;
+        while (last->next) {
+            last = last->next;
         }
+        last->next = orphan_heap.free_list[class];
+        orphan_heap.free_list[class] = heap.free_list[class];
+        heap.free_list[class] = NULL;
     }
-    return string;
+    pthread_mutex_unlock(&orphan_lock);
 }
 
-catis_object* parse_object(
-    catis_context* context,
-    const char* string,
-    const char** next,
-    int* line
-) {
-    catis_object* object = new_object(-1);
+void* catis_reallocate(void* old_pointer, size_t size) {
+    if (old_pointer == NULL) {
+        return catis_allocate(size);
+    }
+    size_t* block = (size_t*)old_pointer - 1;
+    size_t capacity = block[0];
+    if (size <= capacity && size_class(capacity) != CATIS_LARGE_CLASS) {
+        return old_pointer;
+    }
+    if (
+        size_class(capacity) == CATIS_LARGE_CLASS &&
+        size_class(size) == CATIS_LARGE_CLASS
+    ) {
+        stats.bytes_freed += block[0];
+        block = checked_realloc(block, sizeof(size_t) + size);
+        block[0] = size;
+        stats.bytes_allocated += size;
+        return block + 1;
+    }
+    void* pointer = catis_allocate(size);
+    memcpy(pointer, old_pointer, capacity < size ? capacity : size);
+    catis_free(old_pointer);
+    return pointer;
+}
+#endif
+
+/* -- symbol interning -- */
+// atoms are shared by every interpreter and never freed
+#define CATIS_ATOM_TABLE_INITIAL_SIZE 256
+catis_atom** atom_table = NULL;
+size_t atom_table_size = 0;
+size_t atom_count = 0;
+pthread_mutex_t atom_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// bumped whenever a name is rebound, invalidating call site caches, by
+// the interpreters of a library on any thread
+unsigned int procedure_generation = 1;
+// what a frozen library analysed, compiled and cached stays valid
+#define CATIS_SEALED_GENERATION UINT_MAX
+
+static inline unsigned int current_generation(void) {
+    return __atomic_load_n(&procedure_generation, __ATOMIC_RELAXED);
+}
 
-    string = consume_space_and_comment(string, line);
+static inline int is_current(unsigned int generation) {
+    return generation == current_generation() ||
+        generation == CATIS_SEALED_GENERATION;
+}
 
-    if (line) {
-        object->line = *line;
+unsigned int hash_bytes(const char* bytes, size_t length) {
+    unsigned int hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)bytes[i];
+        hash *= 16777619u;
     }
+    return hash;
+}
 
-    // parse integer
-    if ((string[0] == '-' && isdigit(string[1])) || isdigit(string[0])) {
-        char buffer[64];
-        size_t length = 0;
-        while (
-            (*string == '-' || isdigit(*string)) &&
-            length < sizeof(buffer) - 1
-        ) {
-            buffer[length++] = *string++;
-        }
-        buffer[length] = 0;
-        object->type = CATIS_TYPE_INT;
-        object->integer = atoi(buffer);
-        if (next) {
-            *next = string;
+void grow_atom_table(void) {
+    size_t size = atom_table_size ?
+        atom_table_size * 2 :
+        CATIS_ATOM_TABLE_INITIAL_SIZE;
+    catis_atom** table = catis_allocate(sizeof(catis_atom*) * size);
+    memset(table, 0, sizeof(catis_atom*) * size);
+    for (size_t i = 0; i < atom_table_size; i++) {
+        catis_atom* atom = atom_table[i];
+        while (atom) {
+            catis_atom* next = atom->next;
+            atom->next = table[atom->hash & (size - 1)];
+            table[atom->hash & (size - 1)] = atom;
+            atom = next;
         }
     }
+    catis_free(atom_table);
+    atom_table = table;
+    atom_table_size = size;
+}
 
-    // parse list, tuple, capture group
-    else if (
-        string[0] == '[' ||
-        string[0] == '(' ||
-        string[0] == '{'
-    ) {
-        object->type =
-            string[0] == '[' ? CATIS_TYPE_LIST :
-            string[0] == '(' ? CATIS_TYPE_TUPLE :
-            CATIS_TYPE_CAPTURE;
-        object->collection.length = 0;
-        object->collection.element = NULL;
-        string++;
-
-        while (1) {
-            string = consume_space_and_comment(string, line);
+catis_atom* intern_unlocked(const char* name, size_t length) {
+    unsigned int hash = hash_bytes(name, length);
+    if (atom_table_size) {
+        catis_atom* atom = atom_table[hash & (atom_table_size - 1)];
+        while (atom) {
             if (
-                (object->type == CATIS_TYPE_LIST  && string[0] == ']') ||
-                (object->type == CATIS_TYPE_TUPLE && string[0] == ')') ||
-                (object->type == CATIS_TYPE_CAPTURE && string[0] == '}')
+                atom->hash == hash &&
+                atom->length == length &&
+                !memcmp(atom->name, name, length)
             ) {
-                if (next) {
-                    *next = string + 1;
-                }
-                return object;
+                return atom;
             }
+            atom = atom->next;
+        }
+    }
 
-            const char* next_pointer;
-            catis_object* element = parse_object(
-                context,
-                string,
-                &next_pointer,
-                line
-            );
+    if (atom_count >= atom_table_size / 2) {
+        grow_atom_table();
+    }
+    catis_atom* atom = catis_allocate(sizeof(*atom));
+    char* copy = catis_allocate(length + 1);
+    memcpy(copy, name, length);
+    copy[length] = 0;
+    atom->name = copy;
+    atom->length = length;
+    atom->hash = hash;
+    atom->next = atom_table[hash & (atom_table_size - 1)];
+    atom_table[hash & (atom_table_size - 1)] = atom;
+    atom_count++;
+    return atom;
+}
 
-            if (element == NULL) {
-                release(object);
-                return NULL;
-            }
-            else if (
-                (object->type == CATIS_TYPE_TUPLE ||
-                object->type == CATIS_TYPE_CAPTURE) &&
-                (element->type != CATIS_TYPE_SYMBOL ||
-                element->string_or_symbol.length != 1)
-            ) {
-                release(element);
-                release(object);
-                set_error(
-                    context,
-                    string,
-                    "Tuples and captures can only contain single character symbols"
-                );
-                return NULL;
-            }
-
-            object->collection.element = catis_reallocate(
-                object->collection.element,
-                sizeof(catis_object*) * (object->collection.length+1)
-            );
-            object->collection.element[
-                object->collection.length++
-                ] = element;
-
-            string = next_pointer;
-            continue;
-        }
-
-        set_error(context, string, "List never closed");
-        release(object);
-        return NULL;
+catis_atom* intern(const char* name, size_t length) {
+    if (!multithreaded) {
+        return intern_unlocked(name, length);
     }
+    pthread_mutex_lock(&atom_lock);
+    catis_atom* atom = intern_unlocked(name, length);
+    pthread_mutex_unlock(&atom_lock);
+    return atom;
+}
 
-    // parse boolean
-    else if (string[0] == '#') {
-        if (string[1] != 't' && string[1] != 'f') {
-            set_error(
-                context,
-                string,
-                "Booleans are either #t or #f"
-            );
-            release(object);
-            return NULL;
-        }
-        object->type = CATIS_TYPE_BOOL;
-        object->boolean = string[1] == 't' ? 1 : 0;
-        string += 2;
-
-        if (next) {
-            *next = string;
-        }
-    }
+/* -- immediates -- */
+_Static_assert(
+    sizeof(intptr_t) >= 8,
+    "immediate integers need 64 bits pointers"
+);
 
-    // parse symbol
-    else if (is_symbol(string[0])) {
-        object->type = CATIS_TYPE_SYMBOL;
-        if(string[0] == '\'') {
-            object->string_or_symbol.quoted = 1;
-            string++;
-        }
-        else {
-            object->string_or_symbol.quoted = 0;
-        }
-        const char* end = string;
-        while (is_symbol(*end)) {
-            end++;
-        }
-        object->string_or_symbol.length = end - string;
-        char* destination = catis_allocate(
-            object->string_or_symbol.length + 1
-        );
-        object->string_or_symbol.pointer = destination;
-        memcpy(destination, string, object->string_or_symbol.length);
-        destination[object->string_or_symbol.length] = 0;
+static inline int is_immediate(catis_object* object) {
+    return ((uintptr_t)object & CATIS_TAG_MASK) != 0;
+}
 
-        if (next) {
-            *next = end;
-        }
+static inline int object_type(catis_object* object) {
+    switch ((uintptr_t)object & CATIS_TAG_MASK) {
+        case CATIS_TAG_INT:  return CATIS_TYPE_INT;
+        case CATIS_TAG_BOOL: return CATIS_TYPE_BOOL;
+        default:             return object->type;
     }
+}
 
-    // parse string
-    else if (string[0] == '"') {
-        string++;
-        object->type = CATIS_TYPE_STRING;
-        object->string_or_symbol.pointer = catis_allocate(1);
-        object->string_or_symbol.length = 0;
+static inline int object_integer(catis_object* object) {
+    return (int)((intptr_t)object >> 2);
+}
 
-        while (string[0] && string[0] != '"') {
-            int character = string[0];
-            switch (character) {
-                case '\\':
-                    string++;
-                    character = string[0];
-                    switch (character) {
-                        case 'n':
-                            character = '\n';
-                            break;
-                        case 'r':
-                            character = '\r';
-                            break;
-                        case 't':
-                            character = '\t';
-                            break;
-                        default:
-                            break;
-                    }
-                default:
-                    break;
-            }
+static inline int object_boolean(catis_object* object) {
+    return (int)((uintptr_t)object >> 2);
+}
 
-            object->string_or_symbol.pointer = catis_reallocate(
-                object->string_or_symbol.pointer,
-                object->string_or_symbol.length + 2
-            );
-            object->string_or_symbol.pointer[
-                object->string_or_symbol.length++
-                ] = character;
-            string++;
-        }
+static inline int object_line(catis_object* object) {
+    return is_immediate(object) ? 0 : object->line;
+}
 
-        if (string[0] != '"') {
-            set_error(
-                context,
-                string,
-                "Quotation marks never closed in string"
-            );
-            release(object);
-            return NULL;
-        }
+static inline catis_object* new_integer(int integer) {
+    return (catis_object*)(((intptr_t)integer * 4) | CATIS_TAG_INT);
+}
 
-        object->string_or_symbol.pointer[object->string_or_symbol.length] = 0;
-        string++;
+static inline catis_object* new_boolean(int boolean) {
+    return (catis_object*)(((uintptr_t)(boolean != 0) << 2) | CATIS_TAG_BOOL);
+}
 
-        if (next) {
-            *next = string;
-        }
+/* a + - * b of ints, wrapping around on overflow rather than undefined */
+static inline int integer_math(int operation, int a, int b) {
+    switch (operation) {
+        case '+': return (int)((unsigned int)a + (unsigned int)b);
+        case '-': return (int)((unsigned int)a - (unsigned int)b);
+        default:  return (int)((unsigned int)a * (unsigned int)b);
     }
+}
 
-    else {
-        set_error(context, string, "No object type starts like this");
-        release(object);
-        return NULL;
-    }
+/* -- object -- */
+// a reference count that never gets to zero, for objects nobody frees
+#define CATIS_PINNED (INT_MAX / 2)
 
-    return object;
+static inline void free_object(catis_object* object) {
+    if (object->type != -1) {
+        stats.live[__builtin_ctz(object->type)]--;
+    }
+    catis_free(object);
 }
 
-/* -- compare objects -- */
-#define COMPARE_TYPE_MISMATCH INT_MIN
-int compare(catis_object* a, catis_object* b) {
-    // integer
-    if (a->type == CATIS_TYPE_INT && b->type == CATIS_TYPE_INT) {
-        if (a->integer < b->integer) {
-            return -1;
-        }
-        if (a->integer > b->integer) {
-            return 1;
-        }
-        return 0;
-    }
+void release(catis_object* object);
 
-    // boolean
-    else if (a->type == CATIS_TYPE_BOOL && b->type == CATIS_TYPE_BOOL) {
-        if (a->boolean < b->boolean) {
-            return -1;
-        }
-        if (a->boolean > b->boolean) {
-            return 1;
-        }
+/* drop a reference held by a collection that died, is it the last one */
+static inline int drop_dies(catis_object* object) {
+    if (object == NULL || is_immediate(object)) {
         return 0;
     }
+    assert(count_of(&object->reference_count) > 0);
+    return count_down(&object->reference_count) == 0;
+}
 
-    // string or symbol
-    else if (
-        (a->type == CATIS_TYPE_STRING || a->type == CATIS_TYPE_SYMBOL) &&
-        (b->type == CATIS_TYPE_STRING || b->type == CATIS_TYPE_SYMBOL)
-    ) {
-        int comparison = strcmp(
-            a->string_or_symbol.pointer,
-            b->string_or_symbol.pointer
-        );
-        return comparison < 0 ? -1 : (comparison > 0 ? 1 : 0);
-    }
-
-    // list or tuple
-    else if (
-        (a->type == CATIS_TYPE_LIST || a->type == CATIS_TYPE_TUPLE) &&
-        (b->type == CATIS_TYPE_LIST || b->type == CATIS_TYPE_TUPLE)
-    ) {
-        if (a->collection.length < b->collection.length) {
-            return -1;
+/*
+ * The next element dying with one of the pending collections, which are
+ * linked through a field they no longer need: capacity for lists and
+ * length for dictionaries. The other counts down the elements left, so
+ * the collections being freed are the worklist and take no memory of
+ * their own. A collection with nothing left is freed and unlinked.
+ */
+catis_object* next_dying_element(catis_object** pending) {
+    while (*pending) {
+        catis_object* collection = *pending;
+        if (collection->type == CATIS_TYPE_DICT) {
+            while (collection->dict.capacity) {
+                catis_entry* entry =
+                    collection->dict.entry + --collection->dict.capacity;
+                if (entry->key == NULL) {
+                    continue;
+                }
+                // keys are strings at most, that nests no deeper
+                release(entry->key);
+                if (drop_dies(entry->value)) {
+                    return entry->value;
+                }
+            }
+            catis_free(collection->dict.entry);
+            *pending = (catis_object*)(uintptr_t)collection->dict.length;
         }
-        if (a->collection.length > b->collection.length) {
-            return 1;
+        else {
+            while (collection->collection.length) {
+                catis_object* element = collection->collection.element[
+                    --collection->collection.length
+                ];
+                if (drop_dies(element)) {
+                    return element;
+                }
+            }
+            catis_free(collection->collection.element);
+            *pending = (catis_object*)(uintptr_t)collection->collection.capacity;
         }
-        return 0;
-    }
-
-    else if (a->type == CATIS_TYPE_CAPTURE || b->type == CATIS_TYPE_CAPTURE) {
-        return COMPARE_TYPE_MISMATCH;
+        free_object(collection);
     }
-
-    return COMPARE_TYPE_MISMATCH;
-}
-
-/* -- sorting utils -- */
-int quicksort_object_comparison(const void* a, const void* b) {
-    catis_object** object_a = (catis_object**)a;
-    catis_object** object_b = (catis_object**)b;
-    return compare(object_a[0], object_b[0]);
+    return NULL;
 }
 
-/* -- printing utils -- */
-#define PRINT_RAW       0
-#define PRINT_COLOR (1<<0)
-#define PRINT_REPR  (1<<1)
-
-void print_object(catis_object* object, int flags) {
-    const char* escape;
-    int color = flags & PRINT_COLOR;
-    int repr  = flags & PRINT_REPR;
-
-    if (color) {
+/*
+ * Iterative, so that freeing a list nested a million deep does not
+ * overflow the C stack: a collection that dies is put on the worklist
+ * instead of releasing its elements right away.
+ */
+void release(catis_object* object) {
+    if (object == NULL || is_immediate(object)) return;
+    assert(count_of(&object->reference_count) >= 0);
+    if (count_down(&object->reference_count) != 0) {
+        return;
+    }
+    catis_object* pending = NULL;
+    while (object) {
+        catis_object* next = NULL;
         switch (object->type) {
             case CATIS_TYPE_LIST:
-                escape = "\033[30;1m"; // black
-                break;
             case CATIS_TYPE_TUPLE:
             case CATIS_TYPE_CAPTURE:
-                escape = "\033[34;1m"; // blue
+                object->collection.capacity = (uintptr_t)pending;
+                pending = object;
+                object = next_dying_element(&pending);
+                continue;
+            case CATIS_TYPE_DICT:
+                object->dict.length = (uintptr_t)pending;
+                pending = object;
+                object = next_dying_element(&pending);
+                continue;
+            case CATIS_TYPE_STRING:
+                if (object->string_or_symbol.parent) {
+                    // the owner of its buffer may go with it
+                    if (drop_dies(object->string_or_symbol.parent)) {
+                        next = object->string_or_symbol.parent;
+                    }
+                    break;
+                }
+                catis_free(object->string_or_symbol.pointer);
                 break;
             case CATIS_TYPE_SYMBOL:
-                escape = "\033[36;1m"; // cyan
-                break;
-            case CATIS_TYPE_STRING:
-                escape = "\033[32;1m"; // green
+                catis_free(object->string_or_symbol.pointer);
                 break;
-            case CATIS_TYPE_INT:
-                escape = "\033[33;1m"; // yellow
+            case CATIS_TYPE_VECTOR:
+                catis_free(object->vector.element);
                 break;
-            case CATIS_TYPE_BOOL:
-                escape = "\033[33;1m"; // yellow
+            default:
                 break;
         }
-        printf("%s", escape);
+        free_object(object);
+        object = next ? next : next_dying_element(&pending);
     }
+}
 
-    switch (object->type) {
-        case CATIS_TYPE_BOOL:
-            printf("#%c", object->boolean ? 't' : 'f');
-            break;
-        case CATIS_TYPE_INT:
-            printf("%d", object->integer);
-            break;
-        case CATIS_TYPE_SYMBOL:
-            printf("%s", object->string_or_symbol.pointer);
-            break;
-        case CATIS_TYPE_STRING:
-            if (!repr) {
-                fwrite(
-                    object->string_or_symbol.pointer,
-                    object->string_or_symbol.length,
-                    1,
-                    stdout
-                );
-            } else {
-                printf("\"");
-                for (size_t i = 0; i < object->string_or_symbol.length; i++) {
-                    int character = object->string_or_symbol.pointer[i];
-                    switch (character) {
-                        case '\n':
-                            printf("\\n");
-                            break;
-                        case '\r':
-                            printf("\\r");
-                            break;
-                        case '\t':
-                            printf("\\t");
-                            break;
-                        case '"':
-                            printf("\\\"");
-                            break;
-                        default:
-                            printf("%c", character);
-                            break;
-                    }
-                }
-                printf("\"");
-            }
-            break;
-        case CATIS_TYPE_LIST:
-        case CATIS_TYPE_TUPLE:
-        case CATIS_TYPE_CAPTURE:
-            if (repr) {
-                printf("%c", object->type == CATIS_TYPE_LIST ? '[' : object->type == CATIS_TYPE_TUPLE ? '(' : '{');
-            }
-            for (size_t i = 0; i < object->collection.length; i++) {
-                print_object(object->collection.element[i], flags);
-                if (i != object->collection.length - 1) {
-                    printf(" ");
-                }
-            }
-            if (color) {
-                printf("%s", escape);
-            }
-            if (repr) {
-                printf("%c", object->type == CATIS_TYPE_LIST ? ']' : object->type == CATIS_TYPE_TUPLE ? ')' : '}');
-            }
-            break;
-    }
-    if (color) {
-        printf("\033[0m");
+void retain(catis_object* object) {
+    if (is_immediate(object)) return;
+    count_up(&object->reference_count);
+}
+
+/* change the type of an object, -1 while being parsed */
+static inline void set_type(catis_object* object, int type) {
+    if (object->type != -1) {
+        stats.live[__builtin_ctz(object->type)]--;
     }
+    stats.live[__builtin_ctz(type)]++;
+    object->type = type;
 }
 
-/* -- object constructor -- */
-catis_object* new_integer(int integer) {
-    catis_object* object = new_object(CATIS_TYPE_INT);
-    object->integer = integer;
+catis_object* new_object(int type) {
+    catis_object* object = catis_allocate(sizeof(*object));
+    object->reference_count = 1;
+    object->type = -1;
+    if (type != -1) {
+        set_type(object, type);
+    }
+    object->line = 0;
     return object;
 }
 
-catis_object* new_boolean(int boolean) {
-    catis_object* object = new_object(CATIS_TYPE_BOOL);
-    object->boolean = boolean;
+static inline size_t range_length(catis_object* range) {
+    return range->range.start < range->range.end ?
+        (size_t)range->range.end - range->range.start : 0;
+}
+
+catis_object* new_range(int start, int end) {
+    catis_object* object = new_object(CATIS_TYPE_RANGE);
+    object->range.start = start;
+    object->range.end = end;
     return object;
 }
 
-catis_object* new_string(const char* string, size_t length) {
-    catis_object* object = new_object(CATIS_TYPE_STRING);
-    object->string_or_symbol.length = length;
-    object->string_or_symbol.pointer = catis_allocate(length + 1);
-    memcpy(object->string_or_symbol.pointer, string, length);
-    object->string_or_symbol.pointer[length] = 0;
-    return object;
+/* -- amortized growth -- */
+size_t grown_capacity(size_t capacity, size_t needed) {
+    size_t grown = capacity < 4 ? 4 : capacity * 2;
+    return grown < needed ? needed : grown;
 }
 
-catis_object* deep_copy(catis_object* object) {
-    if (object == NULL) {
-        return NULL;
-    }
-
-    catis_object* copy = new_object(object->type);
-    switch (object->type) {
-        case CATIS_TYPE_INT:
-            copy->integer = object->integer;
-            break;
-        case CATIS_TYPE_BOOL:
-            copy->boolean = object->boolean;
-            break;
-        case CATIS_TYPE_LIST:
-        case CATIS_TYPE_TUPLE:
-            copy->collection.length = object->collection.length;
-            copy->collection.element = catis_allocate(
-                sizeof(catis_object*) *object->collection.length
-            );
-            for (size_t i = 0; i < object->collection.length; i++) {
-                copy->collection.element[i] = deep_copy(
-                    object->collection.element[i]
-                );
-            }
-            break;
-        case CATIS_TYPE_STRING:
-        case CATIS_TYPE_SYMBOL:
-            copy->string_or_symbol.length = object->string_or_symbol.length;
-            copy->string_or_symbol.quoted = object->string_or_symbol.quoted;
-            copy->string_or_symbol.pointer = catis_allocate(
-                object->string_or_symbol.length + 1
-            );
-            memcpy(
-                copy->string_or_symbol.pointer,
-                object->string_or_symbol.pointer,
-                object->string_or_symbol.length + 1
-            );
-            break;
+/* make room for length elements in a list, tuple or capture group */
+void reserve_elements(catis_object* object, size_t length) {
+    if (length <= object->collection.capacity) {
+        return;
     }
-
-    return copy;
+    object->collection.capacity =
+        grown_capacity(object->collection.capacity, length);
+    object->collection.element = catis_reallocate(
+        object->collection.element,
+        sizeof(catis_object*) * object->collection.capacity
+    );
 }
 
-catis_object* get_unshared_object(catis_object* object) {
-    if (object->reference_count > 1) {
-        release(object);
-        return deep_copy(object);
-    } else {
-        return object;
+/* make room for length integers in a vector */
+void reserve_integers(catis_object* object, size_t length) {
+    if (length <= object->vector.capacity) {
+        return;
     }
+    object->vector.capacity =
+        grown_capacity(object->vector.capacity, length);
+    object->vector.element = catis_reallocate(
+        object->vector.element,
+        sizeof(int) * object->vector.capacity
+    );
 }
 
-/* -- error utils -- */
-void set_error(
-    catis_context* context,
-    const char* pointer,
-    const char* message
-) {
-    if (!context) {
+/*
+ * make room for length characters, plus terminator, in a string or symbol,
+ * a slice gets a buffer of its own first
+ */
+void reserve_characters(catis_object* object, size_t length) {
+    if (object->type == CATIS_TYPE_STRING && object->string_or_symbol.parent) {
+        size_t capacity = grown_capacity(object->string_or_symbol.length + 1, length + 1);
+        char* pointer = catis_allocate(capacity);
+        memcpy(pointer, object->string_or_symbol.pointer, object->string_or_symbol.length);
+        pointer[object->string_or_symbol.length] = 0;
+        release(object->string_or_symbol.parent);
+        object->string_or_symbol.parent = NULL;
+        object->string_or_symbol.pointer = pointer;
+        object->string_or_symbol.capacity = capacity;
         return;
     }
-
-    if (!pointer) {
-        pointer = context->frame->procedure ?
-            context->frame->procedure->name :
-            "unknow context";
+    if (length + 1 <= object->string_or_symbol.capacity) {
+        return;
     }
-
-    size_t length = snprintf(
-        context->error_string,
-        CATIS_ERROR_STRING_LENGTH,
-        "%s: '%.30s%s'",
-        message,
-        pointer,
-        strlen(pointer) > 30 ? "..." : ""
+    object->string_or_symbol.capacity =
+        grown_capacity(object->string_or_symbol.capacity, length + 1);
+    object->string_or_symbol.pointer = catis_reallocate(
+        object->string_or_symbol.pointer,
+        object->string_or_symbol.capacity
     );
-
-    stackframe* frame = context->frame;
-    while (frame && length < CATIS_ERROR_STRING_LENGTH) {
-        length += snprintf(
-            context->error_string + length,
-            CATIS_ERROR_STRING_LENGTH - length,
-            " in %s:%d ",
-            frame->procedure ?
-            frame->procedure->name :
-            "unknown",
-            frame->line
-        );
-        frame = frame->previous;
-    }
 }
 
-/* -- stack frame utils -- */
-stackframe* new_stackframe(catis_context* context) {
-    stackframe* frame = catis_allocate(sizeof(*frame));
-    memset(frame->locals, 0, sizeof(frame->locals));
-    frame->procedure = NULL;
-    frame->previous = context ? context->frame : NULL;
-    return frame;
+/* -- dictionaries -- */
+/*
+ * Open addressing with linear probing, kept at most three quarters full.
+ * Keys are ints, booleans, strings and symbols; a string and a symbol of
+ * the same name are different keys. Deleting shifts the rest of the probe
+ * run back over the hole, so there are no tombstones.
+ */
+#define CATIS_DICT_INITIAL_CAPACITY 8
+
+int is_key(catis_object* object) {
+    return (object_type(object) & (
+        CATIS_TYPE_INT | CATIS_TYPE_BOOL | CATIS_TYPE_STRING | CATIS_TYPE_SYMBOL
+    )) != 0;
 }
 
-void release_stackframe(stackframe* frame) {
-    for (int i = 0; i < CATIS_MAX_LOCALVARS; i++) {
-        release(frame->locals[i]);
+unsigned int hash_key(catis_object* key) {
+    if (is_immediate(key)) {
+        // Fibonacci hashing of the tagged word spreads consecutive ints
+        return (unsigned int)((uint64_t)(uintptr_t)key * 11400714819323198485u >> 32);
     }
-    free(frame);
+    if (key->type == CATIS_TYPE_SYMBOL) {
+        return key->string_or_symbol.atom->hash;
+    }
+    return hash_bytes(key->string_or_symbol.pointer, key->string_or_symbol.length);
 }
 
-/* -- interpreter constructor -- */
-catis_context* new_interpreter(void) {
-    catis_context* interpreter = catis_allocate(sizeof(*interpreter));
-    interpreter->stack_length = 0;
-    interpreter->stack = NULL;
-    interpreter->procedure = NULL;
-    interpreter->frame = new_stackframe(NULL);
-    load_library(interpreter);
-    return interpreter;
+int keys_equal(catis_object* a, catis_object* b) {
+    if (a == b) {
+        return 1;
+    }
+    if (is_immediate(a) || is_immediate(b) || a->type != b->type) {
+        return 0;
+    }
+    if (a->type == CATIS_TYPE_SYMBOL) {
+        return a->string_or_symbol.atom == b->string_or_symbol.atom;
+    }
+    return a->string_or_symbol.length == b->string_or_symbol.length &&
+        memcmp(
+            a->string_or_symbol.pointer,
+            b->string_or_symbol.pointer,
+            a->string_or_symbol.length
+        ) == 0;
 }
 
-/* -- stack utils -- */
-void stack_push(catis_context* context, catis_object* object) {
-    context->stack = catis_reallocate(
-        context->stack,
-        sizeof(catis_object*) * (context->stack_length + 1)
-    );
-    context->stack[context->stack_length++] = object;
+/*
+ * Hash of any value compared by contents, recursing into lists and tuples,
+ * for the arguments of memoized procedures. 0 for dictionaries, captures
+ * and what holds them, those are never memoized.
+ */
+int hash_value(catis_object* object, unsigned int* hash) {
+    switch (object_type(object)) {
+        case CATIS_TYPE_INT:
+        case CATIS_TYPE_BOOL:
+        case CATIS_TYPE_STRING:
+        case CATIS_TYPE_SYMBOL:
+            *hash = hash_key(object);
+            return 1;
+        case CATIS_TYPE_VECTOR:
+            *hash = hash_bytes(
+                (const char*)object->vector.element,
+                sizeof(int) * object->vector.length
+            );
+            return 1;
+        case CATIS_TYPE_RANGE:
+            *hash = (unsigned int)object->range.start * 2654435761u ^
+                (unsigned int)object->range.end;
+            return 1;
+        case CATIS_TYPE_LIST:
+        case CATIS_TYPE_TUPLE:
+            *hash = object->type;
+            for (size_t i = 0; i < object->collection.length; i++) {
+                unsigned int element;
+                if (!hash_value(object->collection.element[i], &element)) {
+                    return 0;
+                }
+                *hash = (*hash ^ element) * 16777619u;
+            }
+            return 1;
+        default:
+            return 0;
+    }
 }
 
-catis_object* stack_pop(catis_context* context) {
-    if (context->stack_length == 0) {
-        return NULL;
-    } else {
-        return context->stack[--context->stack_length];
+/* same type and contents, what hash_value hashes the same way */
+int values_equal(catis_object* a, catis_object* b) {
+    if (a == b) {
+        return 1;
+    }
+    if (object_type(a) != object_type(b) || is_immediate(a)) {
+        return 0;
+    }
+    switch (a->type) {
+        case CATIS_TYPE_STRING:
+        case CATIS_TYPE_SYMBOL:
+            return keys_equal(a, b);
+        case CATIS_TYPE_VECTOR:
+            return a->vector.length == b->vector.length &&
+                memcmp(
+                    a->vector.element,
+                    b->vector.element,
+                    sizeof(int) * a->vector.length
+                ) == 0;
+        case CATIS_TYPE_RANGE:
+            return a->range.start == b->range.start &&
+                a->range.end == b->range.end;
+        case CATIS_TYPE_LIST:
+        case CATIS_TYPE_TUPLE:
+            if (a->collection.length != b->collection.length) {
+                return 0;
+            }
+            for (size_t i = 0; i < a->collection.length; i++) {
+                if (!values_equal(a->collection.element[i], b->collection.element[i])) {
+                    return 0;
+                }
+            }
+            return 1;
+        default:
+            return 0;
     }
 }
 
-catis_object* stack_peek(catis_context* context, size_t offset) {
-    if (context->stack_length <= offset) {
-        return NULL;
-    } else {
-        return context->stack[
-        context->stack_length - (offset + 1)
-        ];
+/* the slot of key, or the free one ending its probe run */
+size_t dict_slot(catis_object* dict, catis_object* key, unsigned int hash) {
+    size_t mask = dict->dict.capacity - 1;
+    size_t index = hash & mask;
+    catis_entry* entry = dict->dict.entry;
+    while (
+        entry[index].key &&
+        !(entry[index].hash == hash && keys_equal(entry[index].key, key))
+    ) {
+        index = (index + 1) & mask;
     }
+    return index;
 }
 
-void stack_set(catis_context* context, size_t offset, catis_object* object) {
-    assert(context->stack_length > offset);
-    context->stack[context->stack_length - (offset + 1)] = object;
+catis_entry* dict_lookup(catis_object* dict, catis_object* key) {
+    if (dict->dict.length == 0) {
+        return NULL;
+    }
+    catis_entry* entry = dict->dict.entry + dict_slot(dict, key, hash_key(key));
+    return entry->key ? entry : NULL;
 }
 
-#define STACK_SHOW_MAX_ELEMENTS 16
-void stack_show(catis_context* context) {
-    ssize_t i = context->stack_length - STACK_SHOW_MAX_ELEMENTS;
-    if (i < 0) {
-        i = 0;
-    }
-    while (i < (ssize_t)context->stack_length) {
-        catis_object* object = context->stack[i];
-        print_object(object, PRINT_COLOR | PRINT_REPR);
-        printf(" ");
-        i++;
-    }
-    if (context->stack_length > STACK_SHOW_MAX_ELEMENTS) {
-        printf("[... %zu more objects ...]", i);
+/* make room for length entries in a dictionary, rehashing as it grows */
+void reserve_entries(catis_object* dict, size_t length) {
+    if (length * 4 <= dict->dict.capacity * 3) {
+        return;
     }
-    if (context->stack_length) {
-        printf("\n");
+    size_t capacity = dict->dict.capacity ?
+        dict->dict.capacity * 2 : CATIS_DICT_INITIAL_CAPACITY;
+    while (length * 4 > capacity * 3) {
+        capacity *= 2;
     }
-}
-
-/* -- eval -- */
-int eval(catis_context* context, catis_object* list) {
-    assert(list->type == CATIS_TYPE_LIST);
-
-    for (size_t i = 0; i < list->collection.length; i++) {
-        catis_object* object = list->collection.element[i];
-        catis_procedure* procedure;
-        context->frame->line = object->line;
-
-        switch (object->type) {
-            case CATIS_TYPE_TUPLE:
-                catis_object* tuple = deep_copy(object);
-                stack_push(context, tuple);
-                break;
-
-            case CATIS_TYPE_CAPTURE:
-                // capture variables
-                if (context->stack_length < object->collection.length) {
-                    set_error(
-                        context,
-                        object->collection.element[
-                        context->stack_length
-                        ]->string_or_symbol.pointer,
-                        "Out of stack while capturing local"
-                    );
-                    return 1;
-                }
-
-                context->stack_length -= object->collection.length;
-                for (size_t i = 0; i < object->collection.length; i++) {
-                    int index =
-                        object->collection.element[i]
-                        ->string_or_symbol.pointer[0];
-                    release(context->frame->locals[index]);
-                    context->frame->locals[index] =
-                        context->stack[context->stack_length + i];
-                }
-                break;
-            case CATIS_TYPE_SYMBOL:
-                if (object->string_or_symbol.quoted) {
-                    catis_object* symbol = deep_copy(object);
-                    symbol->string_or_symbol.quoted = 0;
-                    stack_push(context, symbol);
-                    break;
-                }
-
-                if (object->string_or_symbol.pointer[0] == '$') {
-                    int index = object->string_or_symbol.pointer[1];
-                    if (context->frame->locals[index] == NULL) {
-                        set_error(
-                            context,
-                            object->string_or_symbol.pointer,
-                            "Unbound local variable"
-                        );
-                        return 1;
-                    }
-                    stack_push(context, context->frame->locals[index]);
-                    retain(context->frame->locals[index]);
-                }
-                else {
-                    procedure = lookup_procedure(
-                        context,
-                        object->string_or_symbol.pointer
-                    );
-                    if (procedure == NULL) {
-                        set_error(
-                            context,
-                            object->string_or_symbol.pointer,
-                            "Symbol not bound to procedure"
-                        );
-                        return 1;
-                    }
-                    if (procedure->c_procedure) {
-                        catis_procedure* previous = context->frame->procedure;
-                        context->frame->procedure = procedure;
-                        int error = procedure->c_procedure(context);
-                        context->frame->procedure = previous;
-                        if (error) {
-                            return error;
-                        }
-                    }
-                    // catis procedure
-                    else {
-                        stackframe* previous = context->frame;
-                        context->frame = new_stackframe(context);
-                        context->frame->procedure = procedure;
-                        int error = eval(context, procedure->procedure);
-                        release_stackframe(context->frame);
-                        context->frame = previous;
-                        if (error) {
-                            return error;
-                        }
-                    }
-                }
-                break;
-            default:
-                stack_push(context, object);
-                retain(object);
-                break;
+    catis_entry* old = dict->dict.entry;
+    size_t old_capacity = dict->dict.capacity;
+    dict->dict.entry = catis_allocate(sizeof(catis_entry) * capacity);
+    memset(dict->dict.entry, 0, sizeof(catis_entry) * capacity);
+    dict->dict.capacity = capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].key) {
+            size_t index = old[i].hash & (capacity - 1);
+            while (dict->dict.entry[index].key) {
+                index = (index + 1) & (capacity - 1);
+            }
+            dict->dict.entry[index] = old[i];
         }
     }
-
-    return 0;
+    catis_free(old);
 }
 
-/* -- procedure utils -- */
-int check_stack_length(catis_context* context, size_t minimum) {
-    if (context->stack_length < minimum) {
-        set_error(context, NULL, "Out of stack");
-        return 1;
-    }
-    return 0;
+catis_object* new_dict(size_t length) {
+    catis_object* object = new_object(CATIS_TYPE_DICT);
+    object->dict.entry = NULL;
+    object->dict.length = 0;
+    object->dict.capacity = 0;
+    reserve_entries(object, length);
+    return object;
 }
 
-int check_stack_type(catis_context* context, size_t count, ...) {
-    if (check_stack_length(context, count)) { return 1; }
-    va_list types;
-    va_start(types, count);
-    for (size_t i = 0; i < count; i++) {
-        int type = va_arg(types, int);
-        if (
-            !(type & context->stack[context->stack_length - (count - i)]->type)
-        ) {
-            set_error(context, NULL, "Type mismatch");
-            return 1;
-        }
+/* takes the references to key and value */
+void dict_put(catis_object* dict, catis_object* key, catis_object* value) {
+    reserve_entries(dict, dict->dict.length + 1);
+    unsigned int hash = hash_key(key);
+    catis_entry* entry = dict->dict.entry + dict_slot(dict, key, hash);
+    if (entry->key) {
+        release(key);
+        release(entry->value);
     }
-    va_end(types);
-    return 0;
+    else {
+        entry->key = key;
+        entry->hash = hash;
+        dict->dict.length++;
+    }
+    entry->value = value;
 }
 
-catis_procedure* lookup_procedure(catis_context* context, const char* name) {
-    catis_procedure* this = context->procedure;
-    while (this) {
-        if (!strcmp(this->name, name)) {
-            return this;
+/* 1 if key was there */
+int dict_delete(catis_object* dict, catis_object* key) {
+    if (dict->dict.length == 0) {
+        return 0;
+    }
+    size_t mask = dict->dict.capacity - 1;
+    catis_entry* entry = dict->dict.entry;
+    size_t hole = dict_slot(dict, key, hash_key(key));
+    if (entry[hole].key == NULL) {
+        return 0;
+    }
+    release(entry[hole].key);
+    release(entry[hole].value);
+    for (
+        size_t index = (hole + 1) & mask;
+        entry[index].key;
+        index = (index + 1) & mask
+    ) {
+        // it moves back unless its home slot is after the hole
+        size_t home = entry[index].hash & mask;
+        if (((index - home) & mask) >= ((index - hole) & mask)) {
+            entry[hole] = entry[index];
+            hole = index;
         }
-        this = this->next;
     }
-    return NULL;
-}
-
-catis_procedure* new_procedure(catis_context* context, const char* name) {
-    catis_procedure* procedure = catis_allocate(sizeof(*procedure));
-    procedure->name = catis_allocate(strlen(name) + 1);
-    memcpy((char*)procedure->name, name, strlen(name) + 1);
-    procedure->next = context->procedure;
-    context->procedure = procedure;
-    return procedure;
+    entry[hole].key = NULL;
+    dict->dict.length--;
+    return 1;
 }
 
-void add_procedure(
-    catis_context* context,
+/* -- lexing and parsing -- */
+int is_symbol(int character) {
+    if (isalpha(character)) {
+        return 1;
+    }
+    switch (character) {
+        case '@':
+        case '$':
+        case '+':
+        case '-':
+        case '*':
+        case '/':
+        case '=':
+        case '?':
+        case '%':
+        case '>':
+        case '<':
+        case '_':
+        case '.':
+        case '^':
+        case '|':
+        case '&':
+        case '~':
+        case '\'':
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+const char* consume_space_and_comment(const char* string, int* line) {
+    while (1) {
+        while (isspace(string[0])) {
+            if (string[0] == '\n' && line) {
+                (*line)++;
+            }
+            string++;
+        }
+        if (!(string[0] == '/' && string[1] == '/')) {
+            break;
+        }
+        while (string[0] && string[0] != '\n') {
+            string++;
+        }
+    }
+    return string;
+}
+
+catis_object* parse_object(
+    catis_context* context,
+    const char* string,
+    const char** next,
+    int* line
+) {
+    string = consume_space_and_comment(string, line);
+
+    // parse integer
+    if ((string[0] == '-' && isdigit(string[1])) || isdigit(string[0])) {
+        char buffer[64];
+        size_t length = 0;
+        while (
+            (*string == '-' || isdigit(*string)) &&
+            length < sizeof(buffer) - 1
+        ) {
+            buffer[length++] = *string++;
+        }
+        buffer[length] = 0;
+        if (next) {
+            *next = string;
+        }
+        return new_integer(atoi(buffer));
+    }
+
+    // parse vector, a list of integers packed as it is read
+    if (string[0] == '#' && string[1] == '[') {
+        catis_object* list = parse_object(context, string + 1, next, line);
+        if (list == NULL) {
+            return NULL;
+        }
+        catis_object* vector = new_vector(list->collection.length);
+        vector->line = list->line;
+        for (size_t i = 0; i < list->collection.length; i++) {
+            catis_object* element = list->collection.element[i];
+            if (object_type(element) != CATIS_TYPE_INT) {
+                set_error(context, string, "Vectors can only contain integers");
+                release(vector);
+                release(list);
+                return NULL;
+            }
+            vector->vector.element[vector->vector.length++] =
+                object_integer(element);
+        }
+        release(list);
+        return vector;
+    }
+
+    // parse dictionary, keys and values in turn
+    if (string[0] == '#' && string[1] == '{') {
+        catis_object* dict = new_dict(0);
+        if (line) {
+            dict->line = *line;
+        }
+        string += 2;
+        while (1) {
+            string = consume_space_and_comment(string, line);
+            if (string[0] == '}') {
+                if (next) {
+                    *next = string + 1;
+                }
+                return dict;
+            }
+            const char* key_string = string;
+            catis_object* key = parse_object(context, string, &string, line);
+            if (key == NULL) {
+                release(dict);
+                return NULL;
+            }
+            if (!is_key(key)) {
+                set_error(
+                    context,
+                    key_string,
+                    "Dictionary keys are ints, booleans, strings or symbols"
+                );
+                release(key);
+                release(dict);
+                return NULL;
+            }
+            string = consume_space_and_comment(string, line);
+            catis_object* value = string[0] == '}' ?
+                NULL : parse_object(context, string, &string, line);
+            if (value == NULL) {
+                if (string[0] == '}') {
+                    set_error(context, key_string, "Dictionary key without a value");
+                }
+                release(key);
+                release(dict);
+                return NULL;
+            }
+            dict_put(dict, key, value);
+        }
+    }
+
+    // parse boolean
+    if (string[0] == '#') {
+        if (string[1] != 't' && string[1] != 'f') {
+            set_error(
+                context,
+                string,
+                "Booleans are either #t or #f, vectors start with #[ and dictionaries with #{"
+            );
+            return NULL;
+        }
+        if (next) {
+            *next = string + 2;
+        }
+        return new_boolean(string[1] == 't');
+    }
+
+    catis_object* object = new_object(-1);
+    if (line) {
+        object->line = *line;
+    }
+
+    // parse list, tuple, capture group
+    if (
+        string[0] == '[' ||
+        string[0] == '(' ||
+        string[0] == '{'
+    ) {
+        set_type(
+            object,
+            string[0] == '[' ? CATIS_TYPE_LIST :
+            string[0] == '(' ? CATIS_TYPE_TUPLE :
+            CATIS_TYPE_CAPTURE
+        );
+        object->collection.length = 0;
+        object->collection.capacity = 0;
+        object->collection.element = NULL;
+        string++;
+
+        while (1) {
+            string = consume_space_and_comment(string, line);
+            if (
+                (object->type == CATIS_TYPE_LIST  && string[0] == ']') ||
+                (object->type == CATIS_TYPE_TUPLE && string[0] == ')') ||
+                (object->type == CATIS_TYPE_CAPTURE && string[0] == '}')
+            ) {
+                if (next) {
+                    *next = string + 1;
+                }
+                return object;
+            }
+
+            const char* next_pointer;
+            catis_object* element = parse_object(
+                context,
+                string,
+                &next_pointer,
+                line
+            );
+
+            if (element == NULL) {
+                release(object);
+                return NULL;
+            }
+            else if (
+                (object->type == CATIS_TYPE_TUPLE ||
+                object->type == CATIS_TYPE_CAPTURE) &&
+                (object_type(element) != CATIS_TYPE_SYMBOL ||
+                element->string_or_symbol.length != 1)
+            ) {
+                release(element);
+                release(object);
+                set_error(
+                    context,
+                    string,
+                    "Tuples and captures can only contain single character symbols"
+                );
+                return NULL;
+            }
+
+            reserve_elements(object, object->collection.length + 1);
+            object->collection.element[
+                object->collection.length++
+                ] = element;
+
+            string = next_pointer;
+            continue;
+        }
+
+        set_error(context, string, "List never closed");
+        release(object);
+        return NULL;
+    }
+
+    // parse symbol
+    else if (is_symbol(string[0])) {
+        set_type(object, CATIS_TYPE_SYMBOL);
+        if(string[0] == '\'') {
+            object->string_or_symbol.quoted = 1;
+            string++;
+        }
+        else {
+            object->string_or_symbol.quoted = 0;
+        }
+        object->string_or_symbol.library = 0;
+        const char* end = string;
+        while (is_symbol(*end)) {
+            end++;
+        }
+        object->string_or_symbol.length = end - string;
+        char* destination = catis_allocate(
+            object->string_or_symbol.length + 1
+        );
+        object->string_or_symbol.pointer = destination;
+        object->string_or_symbol.capacity =
+            object->string_or_symbol.length + 1;
+        memcpy(destination, string, object->string_or_symbol.length);
+        destination[object->string_or_symbol.length] = 0;
+        object->string_or_symbol.atom =
+            intern(destination, object->string_or_symbol.length);
+        object->string_or_symbol.cached_procedure = NULL;
+        object->string_or_symbol.cached_generation = 0;
+        object->string_or_symbol.last_use_generation = 0;
+
+        if (next) {
+            *next = end;
+        }
+    }
+
+    // parse string
+    else if (string[0] == '"') {
+        string++;
+        set_type(object, CATIS_TYPE_STRING);
+        object->string_or_symbol.pointer = NULL;
+        object->string_or_symbol.length = 0;
+        object->string_or_symbol.capacity = 0;
+        object->string_or_symbol.parent = NULL;
+        reserve_characters(object, 0);
+
+        while (string[0] && string[0] != '"') {
+            int character = string[0];
+            switch (character) {
+                case '\\':
+                    string++;
+                    character = string[0];
+                    switch (character) {
+                        case 'n':
+                            character = '\n';
+                            break;
+                        case 'r':
+                            character = '\r';
+                            break;
+                        case 't':
+                            character = '\t';
+                            break;
+                        default:
+                            break;
+                    }
+                default:
+                    break;
+            }
+
+            reserve_characters(object, object->string_or_symbol.length + 1);
+            object->string_or_symbol.pointer[
+                object->string_or_symbol.length++
+                ] = character;
+            string++;
+        }
+
+        if (string[0] != '"') {
+            set_error(
+                context,
+                string,
+                "Quotation marks never closed in string"
+            );
+            release(object);
+            return NULL;
+        }
+
+        object->string_or_symbol.pointer[object->string_or_symbol.length] = 0;
+        object->string_or_symbol.used = object->string_or_symbol.length;
+        string++;
+
+        if (next) {
+            *next = string;
+        }
+    }
+
+    else {
+        set_error(context, string, "No object type starts like this");
+        release(object);
+        return NULL;
+    }
+
+    return object;
+}
+
+/* -- compare objects -- */
+#define COMPARE_TYPE_MISMATCH INT_MIN
+/* slices end where their length does, not at a terminator */
+int compare_characters(catis_object* a, catis_object* b) {
+    size_t a_length = a->string_or_symbol.length;
+    size_t b_length = b->string_or_symbol.length;
+    int comparison = memcmp(
+        a->string_or_symbol.pointer,
+        b->string_or_symbol.pointer,
+        a_length < b_length ? a_length : b_length
+    );
+    if (comparison == 0) {
+        return (a_length > b_length) - (a_length < b_length);
+    }
+    return (comparison > 0) - (comparison < 0);
+}
+
+/* entries by key: by type first, then by value or characters */
+int compare_entry_keys(const void* a, const void* b) {
+    catis_object* first = (*(catis_entry* const*)a)->key;
+    catis_object* second = (*(catis_entry* const*)b)->key;
+    int a_type = object_type(first);
+    int b_type = object_type(second);
+    if (a_type != b_type) {
+        return (a_type > b_type) - (a_type < b_type);
+    }
+    if (a_type == CATIS_TYPE_INT || a_type == CATIS_TYPE_BOOL) {
+        int x = a_type == CATIS_TYPE_INT ?
+            object_integer(first) : object_boolean(first);
+        int y = b_type == CATIS_TYPE_INT ?
+            object_integer(second) : object_boolean(second);
+        return (x > y) - (x < y);
+    }
+    return compare_characters(first, second);
+}
+
+/* the entries of a dictionary sorted by key, to be freed */
+catis_entry** sorted_entries(catis_object* dict) {
+    catis_entry** sorted =
+        catis_allocate(sizeof(catis_entry*) * (dict->dict.length + 1));
+    size_t length = 0;
+    for (size_t i = 0; i < dict->dict.capacity; i++) {
+        if (dict->dict.entry[i].key) {
+            sorted[length++] = dict->dict.entry + i;
+        }
+    }
+    qsort(sorted, length, sizeof(catis_entry*), compare_entry_keys);
+    return sorted;
+}
+
+int compare(catis_object* a, catis_object* b) {
+    int a_type = object_type(a);
+    int b_type = object_type(b);
+
+    // integer
+    if (a_type == CATIS_TYPE_INT && b_type == CATIS_TYPE_INT) {
+        if (object_integer(a) < object_integer(b)) {
+            return -1;
+        }
+        if (object_integer(a) > object_integer(b)) {
+            return 1;
+        }
+        return 0;
+    }
+
+    // boolean
+    else if (a_type == CATIS_TYPE_BOOL && b_type == CATIS_TYPE_BOOL) {
+        if (object_boolean(a) < object_boolean(b)) {
+            return -1;
+        }
+        if (object_boolean(a) > object_boolean(b)) {
+            return 1;
+        }
+        return 0;
+    }
+
+    // string or symbol
+    else if (
+        (a_type == CATIS_TYPE_STRING || a_type == CATIS_TYPE_SYMBOL) &&
+        (b_type == CATIS_TYPE_STRING || b_type == CATIS_TYPE_SYMBOL)
+    ) {
+        return compare_characters(a, b);
+    }
+
+    // list, tuple or range
+    else if (
+        (a_type & (CATIS_TYPE_LIST | CATIS_TYPE_TUPLE | CATIS_TYPE_RANGE)) &&
+        (b_type & (CATIS_TYPE_LIST | CATIS_TYPE_TUPLE | CATIS_TYPE_RANGE))
+    ) {
+        size_t a_length =
+            a_type == CATIS_TYPE_RANGE ? range_length(a) : a->collection.length;
+        size_t b_length =
+            b_type == CATIS_TYPE_RANGE ? range_length(b) : b->collection.length;
+        if (a_length < b_length) {
+            return -1;
+        }
+        if (a_length > b_length) {
+            return 1;
+        }
+        return 0;
+    }
+
+    // vector, by length then element by element
+    else if (a_type == CATIS_TYPE_VECTOR && b_type == CATIS_TYPE_VECTOR) {
+        if (a->vector.length != b->vector.length) {
+            return a->vector.length < b->vector.length ? -1 : 1;
+        }
+        for (size_t i = 0; i < a->vector.length; i++) {
+            if (a->vector.element[i] != b->vector.element[i]) {
+                return a->vector.element[i] < b->vector.element[i] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    // dictionary, by length then entry by entry in key order
+    else if (a_type == CATIS_TYPE_DICT && b_type == CATIS_TYPE_DICT) {
+        if (a->dict.length != b->dict.length) {
+            return a->dict.length < b->dict.length ? -1 : 1;
+        }
+        catis_entry** a_entries = sorted_entries(a);
+        catis_entry** b_entries = sorted_entries(b);
+        int comparison = 0;
+        for (size_t i = 0; i < a->dict.length && comparison == 0; i++) {
+            comparison = compare_entry_keys(a_entries + i, b_entries + i);
+            if (comparison == 0) {
+                comparison = compare(a_entries[i]->value, b_entries[i]->value);
+            }
+        }
+        catis_free(a_entries);
+        catis_free(b_entries);
+        return comparison;
+    }
+
+    else if (a_type == CATIS_TYPE_CAPTURE || b_type == CATIS_TYPE_CAPTURE) {
+        return COMPARE_TYPE_MISMATCH;
+    }
+
+    return COMPARE_TYPE_MISMATCH;
+}
+
+/* -- sorting utils -- */
+int quicksort_object_comparison(const void* a, const void* b) {
+    catis_object** object_a = (catis_object**)a;
+    catis_object** object_b = (catis_object**)b;
+    return compare(object_a[0], object_b[0]);
+}
+
+int quicksort_integer_comparison(const void* a, const void* b) {
+    int integer_a = *(const int*)a;
+    int integer_b = *(const int*)b;
+    return (integer_a > integer_b) - (integer_a < integer_b);
+}
+
+int quicksort_string_comparison(const void* a, const void* b) {
+    catis_object* object_a = *(catis_object**)a;
+    catis_object* object_b = *(catis_object**)b;
+    return compare_characters(object_a, object_b);
+}
+
+// below this, qsort beats four counting passes
+#define CATIS_RADIX_MINIMUM 64
+
+/* ints to unsigned keys of the same order */
+static inline uint32_t radix_key(int integer) {
+    return (uint32_t)integer ^ 0x80000000u;
+}
+
+/*
+ * Stable LSD radix sort, a byte a pass, skipping the bytes every key
+ * shares. Each payload element, when there are some, moves with its key.
+ */
+void radix_sort(uint32_t* keys, catis_object** payload, size_t length) {
+    size_t count[4][256];
+    memset(count, 0, sizeof(count));
+    for (size_t i = 0; i < length; i++) {
+        for (int pass = 0; pass < 4; pass++) {
+            count[pass][(keys[i] >> (8 * pass)) & 255]++;
+        }
+    }
+
+    uint32_t* sorted_keys = keys;
+    catis_object** sorted_payload = payload;
+    uint32_t* other_keys = catis_allocate(sizeof(uint32_t) * length);
+    catis_object** other_payload =
+        payload ? catis_allocate(sizeof(catis_object*) * length) : NULL;
+    for (int pass = 0; pass < 4; pass++) {
+        int shift = 8 * pass;
+        size_t* offset = count[pass];
+        if (offset[(sorted_keys[0] >> shift) & 255] == length) {
+            continue;
+        }
+        size_t total = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            size_t digit_count = offset[digit];
+            offset[digit] = total;
+            total += digit_count;
+        }
+        for (size_t i = 0; i < length; i++) {
+            size_t to = offset[(sorted_keys[i] >> shift) & 255]++;
+            other_keys[to] = sorted_keys[i];
+            if (payload) {
+                other_payload[to] = sorted_payload[i];
+            }
+        }
+        uint32_t* swap_keys = sorted_keys;
+        sorted_keys = other_keys;
+        other_keys = swap_keys;
+        catis_object** swap_payload = sorted_payload;
+        sorted_payload = other_payload;
+        other_payload = swap_payload;
+    }
+
+    // after an odd number of passes the result is in the scratch arrays
+    if (sorted_keys != keys) {
+        memcpy(keys, sorted_keys, sizeof(uint32_t) * length);
+        if (payload) {
+            memcpy(payload, sorted_payload, sizeof(catis_object*) * length);
+        }
+        catis_free(sorted_keys);
+        catis_free(sorted_payload);
+    }
+    else {
+        catis_free(other_keys);
+        catis_free(other_payload);
+    }
+}
+
+/* ints in place, by radix once there are enough */
+void sort_integers(int* integers, size_t length) {
+    if (length < CATIS_RADIX_MINIMUM) {
+        qsort(integers, length, sizeof(int), quicksort_integer_comparison);
+        return;
+    }
+    uint32_t* keys = catis_allocate(sizeof(uint32_t) * length);
+    for (size_t i = 0; i < length; i++) {
+        keys[i] = radix_key(integers[i]);
+    }
+    radix_sort(keys, NULL, length);
+    for (size_t i = 0; i < length; i++) {
+        integers[i] = (int)(keys[i] ^ 0x80000000u);
+    }
+    catis_free(keys);
+}
+
+/* -- buffered output -- */
+void output_flush(catis_output* output) {
+    if (output->length == 0) {
+        return;
+    }
+    flockfile(stdout);
+    fwrite(output->bytes, 1, output->length, stdout);
+    fflush(stdout);
+    funlockfile(stdout);
+    output->length = 0;
+}
+
+void output_bytes(catis_output* output, const char* bytes, size_t length) {
+    if (output->length + length > CATIS_OUTPUT_BUFFER_SIZE) {
+        output_flush(output);
+        if (length > CATIS_OUTPUT_BUFFER_SIZE) {
+            flockfile(stdout);
+            fwrite(bytes, 1, length, stdout);
+            fflush(stdout);
+            funlockfile(stdout);
+            return;
+        }
+    }
+    if (output->bytes == NULL) {
+        output->bytes = catis_allocate(CATIS_OUTPUT_BUFFER_SIZE);
+    }
+    memcpy(output->bytes + output->length, bytes, length);
+    output->length += length;
+}
+
+static inline void output_char(catis_output* output, char character) {
+    if (output->bytes == NULL || output->length == CATIS_OUTPUT_BUFFER_SIZE) {
+        output_bytes(output, &character, 1);
+        return;
+    }
+    output->bytes[output->length++] = character;
+}
+
+static inline void output_string(catis_output* output, const char* string) {
+    output_bytes(output, string, strlen(string));
+}
+
+void output_integer(catis_output* output, int integer) {
+    char digits[16];
+    size_t i = sizeof(digits);
+    unsigned int magnitude =
+        integer < 0 ? 0u - (unsigned int)integer : (unsigned int)integer;
+    do {
+        digits[--i] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    if (integer < 0) {
+        digits[--i] = '-';
+    }
+    output_bytes(output, digits + i, sizeof(digits) - i);
+}
+
+/* a line is done: out at once on a terminal */
+void output_line_end(catis_output* output) {
+    if (output->line_buffered) {
+        output_flush(output);
+    }
+}
+
+/* -- printing utils -- */
+#define PRINT_RAW       0
+#define PRINT_COLOR (1<<0)
+#define PRINT_REPR  (1<<1)
+
+void print_object(catis_output* output, catis_object* object, int flags) {
+    const char* escape = "";
+    int color = flags & PRINT_COLOR;
+    int repr  = flags & PRINT_REPR;
+    int type  = object_type(object);
+
+    if (color) {
+        switch (type) {
+            case CATIS_TYPE_LIST:
+            case CATIS_TYPE_VECTOR:
+            case CATIS_TYPE_DICT:
+            case CATIS_TYPE_RANGE:
+            default:
+                escape = "\033[30;1m"; // black
+                break;
+            case CATIS_TYPE_TUPLE:
+            case CATIS_TYPE_CAPTURE:
+                escape = "\033[34;1m"; // blue
+                break;
+            case CATIS_TYPE_SYMBOL:
+                escape = "\033[36;1m"; // cyan
+                break;
+            case CATIS_TYPE_STRING:
+                escape = "\033[32;1m"; // green
+                break;
+            case CATIS_TYPE_INT:
+                escape = "\033[33;1m"; // yellow
+                break;
+            case CATIS_TYPE_BOOL:
+                escape = "\033[33;1m"; // yellow
+                break;
+        }
+        output_string(output, escape);
+    }
+
+    switch (type) {
+        case CATIS_TYPE_BOOL:
+            output_string(output, object_boolean(object) ? "#t" : "#f");
+            break;
+        case CATIS_TYPE_INT:
+            output_integer(output, object_integer(object));
+            break;
+        case CATIS_TYPE_SYMBOL:
+            output_bytes(
+                output,
+                object->string_or_symbol.pointer,
+                object->string_or_symbol.length
+            );
+            break;
+        case CATIS_TYPE_STRING:
+            if (!repr) {
+                output_bytes(
+                    output,
+                    object->string_or_symbol.pointer,
+                    object->string_or_symbol.length
+                );
+            } else {
+                output_char(output, '"');
+                for (size_t i = 0; i < object->string_or_symbol.length; i++) {
+                    int character = object->string_or_symbol.pointer[i];
+                    switch (character) {
+                        case '\n':
+                            output_string(output, "\\n");
+                            break;
+                        case '\r':
+                            output_string(output, "\\r");
+                            break;
+                        case '\t':
+                            output_string(output, "\\t");
+                            break;
+                        case '"':
+                            output_string(output, "\\\"");
+                            break;
+                        default:
+                            output_char(output, character);
+                            break;
+                    }
+                }
+                output_char(output, '"');
+            }
+            break;
+        case CATIS_TYPE_LIST:
+        case CATIS_TYPE_TUPLE:
+        case CATIS_TYPE_CAPTURE:
+            if (repr) {
+                output_char(output, object->type == CATIS_TYPE_LIST ? '[' : object->type == CATIS_TYPE_TUPLE ? '(' : '{');
+            }
+            for (size_t i = 0; i < object->collection.length; i++) {
+                print_object(output, object->collection.element[i], flags);
+                if (i != object->collection.length - 1) {
+                    output_char(output, ' ');
+                }
+            }
+            if (color) {
+                output_string(output, escape);
+            }
+            if (repr) {
+                output_char(output, object->type == CATIS_TYPE_LIST ? ']' : object->type == CATIS_TYPE_TUPLE ? ')' : '}');
+            }
+            break;
+        case CATIS_TYPE_RANGE:
+            // shown as the list it stands for
+            if (repr) {
+                output_char(output, '[');
+            }
+            for (int i = object->range.start; i < object->range.end; i++) {
+                if (color) {
+                    output_string(output, "\033[33;1m");
+                }
+                output_integer(output, i);
+                if (color) {
+                    output_string(output, "\033[0m");
+                }
+                if (i != object->range.end - 1) {
+                    output_char(output, ' ');
+                }
+            }
+            if (color) {
+                output_string(output, escape);
+            }
+            if (repr) {
+                output_char(output, ']');
+            }
+            break;
+        case CATIS_TYPE_VECTOR:
+            if (repr) {
+                output_string(output, "#[");
+            }
+            for (size_t i = 0; i < object->vector.length; i++) {
+                if (i) {
+                    output_char(output, ' ');
+                }
+                output_integer(output, object->vector.element[i]);
+            }
+            if (repr) {
+                output_char(output, ']');
+            }
+            break;
+        case CATIS_TYPE_DICT:
+            if (repr) {
+                output_string(output, "#{");
+            }
+            for (size_t i = 0, printed = 0; i < object->dict.capacity; i++) {
+                catis_entry* entry = object->dict.entry + i;
+                if (entry->key == NULL) {
+                    continue;
+                }
+                if (printed++) {
+                    output_char(output, ' ');
+                }
+                print_object(output, entry->key, flags);
+                output_char(output, ' ');
+                print_object(output, entry->value, flags);
+            }
+            if (color) {
+                output_string(output, escape);
+            }
+            if (repr) {
+                output_char(output, '}');
+            }
+            break;
+    }
+    if (color) {
+        output_string(output, "\033[0m");
+    }
+}
+
+/* -- object constructor -- */
+catis_object* new_string(const char* string, size_t length) {
+    catis_object* object = new_object(CATIS_TYPE_STRING);
+    object->string_or_symbol.length = length;
+    object->string_or_symbol.capacity = length + 1;
+    object->string_or_symbol.pointer = catis_allocate(length + 1);
+    memcpy(object->string_or_symbol.pointer, string, length);
+    object->string_or_symbol.pointer[length] = 0;
+    object->string_or_symbol.used = length;
+    object->string_or_symbol.parent = NULL;
+    return object;
+}
+
+/*
+ * length characters of string from start, pointing into the same buffer.
+ * The slice holds on to the owner of the buffer, never to another slice.
+ */
+catis_object* new_slice(catis_object* string, size_t start, size_t length) {
+    catis_object* owner = string->string_or_symbol.parent ?
+        string->string_or_symbol.parent : string;
+    catis_object* slice = new_object(CATIS_TYPE_STRING);
+    slice->string_or_symbol.pointer = string->string_or_symbol.pointer + start;
+    slice->string_or_symbol.length = length;
+    slice->string_or_symbol.capacity = 0;
+    slice->string_or_symbol.used = 0;
+    slice->string_or_symbol.parent = owner;
+    retain(owner);
+    return slice;
+}
+
+/*
+ * The one character strings, shared by whatever takes a string apart so
+ * walking one allocates nothing. Pinned like the objects of an image.
+ */
+catis_object characters[256];
+char character_bytes[256][2];
+
+void init_characters(void) {
+    for (int i = 0; i < 256; i++) {
+        catis_object* character = characters + i;
+        character_bytes[i][0] = (char)i;
+        character->reference_count = CATIS_PINNED;
+        character->type = CATIS_TYPE_STRING;
+        character->line = 0;
+        character->string_or_symbol.pointer = character_bytes[i];
+        character->string_or_symbol.length = 1;
+        character->string_or_symbol.capacity = 2;
+        character->string_or_symbol.used = 1;
+        character->string_or_symbol.parent = NULL;
+    }
+}
+
+static inline catis_object* new_character(char character) {
+    catis_object* object = characters + (unsigned char)character;
+    retain(object);
+    return object;
+}
+
+/*
+ * Copy only the top level, children are shared and get unshared in turn
+ * by whoever mutates them. Mutating a row of a grid copies the grid's
+ * pointer array and the row, not every other row.
+ */
+catis_object* new_list(size_t capacity) {
+    catis_object* object = new_object(CATIS_TYPE_LIST);
+    object->collection.length = 0;
+    object->collection.capacity = capacity;
+    object->collection.element =
+        capacity ? catis_allocate(sizeof(catis_object*) * capacity) : NULL;
+    return object;
+}
+
+catis_object* range_to_list(catis_object* range) {
+    catis_object* list = new_list(range_length(range));
+    for (int i = range->range.start; i < range->range.end; i++) {
+        list->collection.element[list->collection.length++] = new_integer(i);
+    }
+    return list;
+}
+
+catis_object* new_vector(size_t capacity) {
+    catis_object* object = new_object(CATIS_TYPE_VECTOR);
+    object->vector.length = 0;
+    object->vector.capacity = capacity;
+    object->vector.element =
+        capacity ? catis_allocate(sizeof(int) * capacity) : NULL;
+    return object;
+}
+
+catis_object* shallow_copy(catis_object* object) {
+    if (object == NULL || is_immediate(object)) {
+        return object;
+    }
+
+    catis_object* copy = new_object(object->type);
+    stats.copies++;
+    stats.bytes_copied += sizeof(*copy);
+    switch (object->type) {
+        case CATIS_TYPE_LIST:
+        case CATIS_TYPE_TUPLE:
+            stats.bytes_copied += sizeof(catis_object*) * object->collection.length;
+            copy->collection.length = object->collection.length;
+            copy->collection.capacity = object->collection.length;
+            copy->collection.element = catis_allocate(
+                sizeof(catis_object*) *object->collection.length
+            );
+            for (size_t i = 0; i < object->collection.length; i++) {
+                copy->collection.element[i] = object->collection.element[i];
+                retain(copy->collection.element[i]);
+            }
+            break;
+        case CATIS_TYPE_STRING:
+        case CATIS_TYPE_SYMBOL:
+            stats.bytes_copied += object->string_or_symbol.length + 1;
+            copy->string_or_symbol.length = object->string_or_symbol.length;
+            copy->string_or_symbol.capacity =
+                object->string_or_symbol.length + 1;
+            copy->string_or_symbol.quoted = object->string_or_symbol.quoted;
+            copy->string_or_symbol.pointer = catis_allocate(
+                object->string_or_symbol.length + 1
+            );
+            memcpy(
+                copy->string_or_symbol.pointer,
+                object->string_or_symbol.pointer,
+                object->string_or_symbol.length
+            );
+            copy->string_or_symbol.pointer[copy->string_or_symbol.length] = 0;
+            if (object->type == CATIS_TYPE_SYMBOL) {
+                copy->string_or_symbol.atom = object->string_or_symbol.atom;
+            }
+            else {
+                copy->string_or_symbol.used = copy->string_or_symbol.length;
+            }
+            copy->string_or_symbol.cached_procedure = NULL;
+            copy->string_or_symbol.cached_generation = 0;
+            copy->string_or_symbol.last_use_generation = 0;
+            copy->string_or_symbol.library = 0;
+            break;
+        case CATIS_TYPE_VECTOR:
+            stats.bytes_copied += sizeof(int) * object->vector.length;
+            copy->vector.length = object->vector.length;
+            copy->vector.capacity = object->vector.length;
+            copy->vector.element = catis_allocate(
+                sizeof(int) * object->vector.length
+            );
+            memcpy(
+                copy->vector.element,
+                object->vector.element,
+                sizeof(int) * object->vector.length
+            );
+            break;
+        case CATIS_TYPE_RANGE:
+            copy->range = object->range;
+            break;
+        case CATIS_TYPE_DICT:
+            stats.bytes_copied += sizeof(catis_entry) * object->dict.capacity;
+            copy->dict.length = object->dict.length;
+            copy->dict.capacity = object->dict.capacity;
+            copy->dict.entry = object->dict.capacity ?
+                catis_allocate(sizeof(catis_entry) * object->dict.capacity) :
+                NULL;
+            for (size_t i = 0; i < object->dict.capacity; i++) {
+                copy->dict.entry[i] = object->dict.entry[i];
+                if (copy->dict.entry[i].key) {
+                    retain(copy->dict.entry[i].key);
+                    retain(copy->dict.entry[i].value);
+                }
+            }
+            break;
+    }
+
+    return copy;
+}
+
+catis_object* get_unshared_object(catis_object* object) {
+    if (count_of(&object->reference_count) > 1) {
+        stats.unshared_copied++;
+        release(object);
+        return shallow_copy(object);
+    } else {
+        stats.unshared_reused++;
+        return object;
+    }
+}
+
+/* -- error utils -- */
+size_t trace_error(
+    catis_context* context,
+    size_t length,
+    catis_procedure* procedure,
+    int line
+) {
+    return length + snprintf(
+        context->error_string + length,
+        CATIS_ERROR_STRING_LENGTH - length,
+        " in %s:%d ",
+        procedure ? procedure->name : "unknown",
+        line
+    );
+}
+
+void set_error(
+    catis_context* context,
+    const char* pointer,
+    const char* message
+) {
+    if (!context) {
+        return;
+    }
+
+    if (!pointer) {
+        pointer = context->frame->procedure ?
+            context->frame->procedure->name :
+            "unknow context";
+    }
+
+    size_t length = snprintf(
+        context->error_string,
+        CATIS_ERROR_STRING_LENGTH,
+        "%s: '%.30s%s'",
+        message,
+        pointer,
+        strlen(pointer) > 30 ? "..." : ""
+    );
+
+    // frameless and compiled procedures run in their caller's frame, their
+    // entries on the control stack keep where the caller was
+    size_t control = context->control_length;
+    stackframe* frame = context->frame;
+    context->error_frame_end = 0;
+    while (frame && length < CATIS_ERROR_STRING_LENGTH) {
+        length = trace_error(context, length, frame->procedure, frame->line);
+        if (frame == context->frame && length < CATIS_ERROR_STRING_LENGTH) {
+            context->error_frame_end = length;
+        }
+        while (control > 0 && length < CATIS_ERROR_STRING_LENGTH) {
+            catis_control* entry = context->control + control - 1;
+            if (entry->kind == CONTROL_COMPILED) {
+                if (entry->compiled.host != frame) {
+                    break;
+                }
+                length = trace_error(
+                    context,
+                    length,
+                    entry->compiled.caller_procedure,
+                    entry->compiled.caller_line
+                );
+                control--;
+                continue;
+            }
+            if (entry->kind != CONTROL_CALL) {
+                control--;
+                continue;
+            }
+            catis_activation* activation = &entry->call.activation;
+            if (activation->caller == NULL && activation->host == frame) {
+                length = trace_error(
+                    context,
+                    length,
+                    activation->caller_procedure,
+                    activation->caller_line
+                );
+                control--;
+                continue;
+            }
+            if (activation->caller && activation->caller == frame->previous) {
+                // the call that made this frame
+                control--;
+            }
+            break;
+        }
+        frame = frame->previous;
+    }
+}
+
+/* -- stack frame utils -- */
+void release_slots(catis_slots* slots) {
+    if (slots && count_down(&slots->reference_count) == 0) {
+        catis_free(slots);
+    }
+}
+
+/*
+ * A frame is allocated with just the slots its procedure uses (they come
+ * from the slab size classes, so frames are pooled), procedure NULL gives
+ * a frame that can hold every name, like the top level one.
+ */
+stackframe* new_stackframe(
+    catis_context* context,
+    catis_procedure* procedure
+) {
+    catis_slots* slots = procedure ? procedure->slots : NULL;
+    size_t local_count = slots ? slots->local_count : CATIS_MAX_LOCALVARS;
+    stackframe* frame = catis_allocate(
+        sizeof(*frame) + sizeof(catis_object*) * local_count
+    );
+    stats.frames++;
+    frame->locals = (catis_object**)(frame + 1);
+    memset(frame->locals, 0, sizeof(catis_object*) * local_count);
+    frame->slots = slots;
+    if (slots) {
+        count_up(&slots->reference_count);
+    }
+    frame->local_count = local_count;
+    frame->overflow = NULL;
+    frame->procedure = procedure;
+    frame->previous = context ? context->frame : NULL;
+    return frame;
+}
+
+/* unbind every local, for a frame reused by a tail call */
+void clear_stackframe(stackframe* frame) {
+    for (size_t i = 0; i < frame->local_count; i++) {
+        release(frame->locals[i]);
+        frame->locals[i] = NULL;
+    }
+    if (frame->overflow) {
+        for (int i = 0; i < CATIS_MAX_LOCALVARS; i++) {
+            release(frame->overflow[i]);
+        }
+        catis_free(frame->overflow);
+        frame->overflow = NULL;
+    }
+}
+void release_stackframe(stackframe* frame) {
+    clear_stackframe(frame);
+    release_slots(frame->slots);
+    catis_free(frame);
+}
+
+/* same locals as frame, for a list evaluated away from it */
+stackframe* copy_stackframe(stackframe* frame, stackframe* previous) {
+    stackframe* copy = catis_allocate(
+        sizeof(*copy) + sizeof(catis_object*) * frame->local_count
+    );
+    stats.frames++;
+    copy->locals = (catis_object**)(copy + 1);
+    for (size_t i = 0; i < frame->local_count; i++) {
+        copy->locals[i] = frame->locals[i];
+        if (copy->locals[i]) {
+            retain(copy->locals[i]);
+        }
+    }
+    copy->slots = frame->slots;
+    if (copy->slots) {
+        count_up(&copy->slots->reference_count);
+    }
+    copy->local_count = frame->local_count;
+    copy->overflow = NULL;
+    if (frame->overflow) {
+        size_t size = sizeof(catis_object*) * CATIS_MAX_LOCALVARS;
+        copy->overflow = catis_allocate(size);
+        for (int i = 0; i < CATIS_MAX_LOCALVARS; i++) {
+            copy->overflow[i] = frame->overflow[i];
+            if (copy->overflow[i]) {
+                retain(copy->overflow[i]);
+            }
+        }
+    }
+    copy->procedure = frame->procedure;
+    copy->line = frame->line;
+    copy->previous = previous;
+    return copy;
+}
+
+/* the local called name, NULL if unbound */
+static inline catis_object* frame_local(stackframe* frame, int name) {
+    if (frame->slots == NULL) {
+        return frame->locals[name];
+    }
+    if (frame->slots->slot[name]) {
+        return frame->locals[frame->slots->slot[name] - 1];
+    }
+    return frame->overflow ? frame->overflow[name] : NULL;
+}
+
+/* a $ load the define time analysis found is followed by a rebind */
+static inline int is_last_use(catis_object* symbol) {
+    return is_current(symbol->string_or_symbol.last_use_generation);
+}
+
+/* where to store the local called name */
+catis_object** frame_local_slot(stackframe* frame, int name) {
+    if (frame->slots == NULL) {
+        return frame->locals + name;
+    }
+    if (frame->slots->slot[name]) {
+        return frame->locals + frame->slots->slot[name] - 1;
+    }
+    if (frame->overflow == NULL) {
+        size_t size = sizeof(catis_object*) * CATIS_MAX_LOCALVARS;
+        frame->overflow = catis_allocate(size);
+        memset(frame->overflow, 0, size);
+    }
+    return frame->overflow + name;
+}
+
+/* -- interpreter constructor -- */
+/* stack, frames and errors of one task, over the shared procedures */
+catis_context* new_context(catis_shared* shared) {
+    catis_context* context = catis_allocate(sizeof(*context));
+    context->stack_length = 0;
+    context->stack_capacity = 0;
+    context->stack_reserved = 0;
+    context->stack_high_water = 0;
+    context->stack = NULL;
+    context->shared = shared;
+    context->frame = new_stackframe(NULL, NULL);
+    context->control = NULL;
+    context->control_length = 0;
+    context->control_capacity = 0;
+    context->vm = 0;
+    context->fired = 0;
+    context->error_frame_end = 0;
+    context->c_caller = NULL;
+    context->profile = NULL;
+    context->last_profile = NULL;
+    context->output.bytes = NULL;
+    context->output.length = 0;
+    context->output.line_buffered = isatty(STDOUT_FILENO);
+    return context;
+}
+
+/* no procedures yet, base is the library to fall back to, if any */
+catis_shared* new_shared(catis_shared* base) {
+    catis_shared* shared = catis_allocate(sizeof(*shared));
+    shared->procedure = NULL;
+    shared->procedure_table = NULL;
+    shared->procedure_table_size = 0;
+    shared->procedure_count = 0;
+    // so a stream of tasks can not starve a definition
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+    pthread_rwlockattr_setkind_np(
+        &attributes,
+        PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP
+    );
+    pthread_rwlock_init(&shared->definitions, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
+    pthread_mutex_init(&shared->analysis, NULL);
+    shared->pool = NULL;
+    shared->base = base;
+    shared->reference_count = 1;
+    shared->frozen = 0;
+    return shared;
+}
+
+catis_context* new_interpreter(void) {
+    register_stats();
+    init_characters();
+    catis_context* interpreter = new_context(new_shared(NULL));
+    load_library(interpreter);
+    return interpreter;
+}
+
+void stop_profile(catis_context* context);
+void free_profile(struct catis_profile* profile);
+
+/* its output flushed, what it holds is released, the shared are left */
+void free_context(catis_context* context) {
+    if (context->profile) {
+        stop_profile(context);
+    }
+    free_profile(context->last_profile);
+    output_flush(&context->output);
+    catis_free(context->output.bytes);
+    for (size_t i = 0; i < context->stack_length; i++) {
+        release(context->stack[i]);
+    }
+    catis_free(context->stack);
+    while (context->frame) {
+        stackframe* previous = context->frame->previous;
+        release_stackframe(context->frame);
+        context->frame = previous;
+    }
+    catis_free(context->control);
+    catis_free(context);
+}
+
+/* -- stack utils -- */
+void resize_stack(catis_context* context, size_t capacity) {
+    context->stack_capacity = capacity;
+    context->stack = catis_reallocate(
+        context->stack,
+        sizeof(catis_object*) * capacity
+    );
+}
+
+/* preallocate room for size objects, kept for the whole run */
+void reserve_stack(catis_context* context, size_t size) {
+    context->stack_reserved = size;
+    if (size > context->stack_capacity) {
+        resize_stack(context, size);
+    }
+}
+
+/* give back memory after a deep computation, called between programs */
+void shrink_stack(catis_context* context) {
+    size_t wanted = grown_capacity(context->stack_length, 0);
+    if (wanted < context->stack_reserved) {
+        wanted = context->stack_reserved;
+    }
+    if (context->stack_capacity > wanted * 4) {
+        resize_stack(context, wanted);
+    }
+}
+
+void stack_push(catis_context* context, catis_object* object) {
+    if (context->stack_length == context->stack_capacity) {
+        resize_stack(
+            context,
+            grown_capacity(context->stack_capacity, context->stack_length + 1)
+        );
+    }
+    context->stack[context->stack_length++] = object;
+    if (context->stack_length > context->stack_high_water) {
+        context->stack_high_water = context->stack_length;
+    }
+}
+
+catis_object* stack_pop(catis_context* context) {
+    if (context->stack_length == 0) {
+        return NULL;
+    } else {
+        return context->stack[--context->stack_length];
+    }
+}
+
+catis_object* stack_peek(catis_context* context, size_t offset) {
+    if (context->stack_length <= offset) {
+        return NULL;
+    } else {
+        return context->stack[
+        context->stack_length - (offset + 1)
+        ];
+    }
+}
+
+void stack_set(catis_context* context, size_t offset, catis_object* object) {
+    assert(context->stack_length > offset);
+    context->stack[context->stack_length - (offset + 1)] = object;
+}
+
+#define STACK_SHOW_MAX_ELEMENTS 16
+void stack_show(catis_context* context) {
+    ssize_t i = context->stack_length - STACK_SHOW_MAX_ELEMENTS;
+    if (i < 0) {
+        i = 0;
+    }
+    catis_output* output = &context->output;
+    while (i < (ssize_t)context->stack_length) {
+        catis_object* object = context->stack[i];
+        print_object(output, object, PRINT_COLOR | PRINT_REPR);
+        output_char(output, ' ');
+        i++;
+    }
+    if (context->stack_length > STACK_SHOW_MAX_ELEMENTS) {
+        output_string(output, "[... ");
+        output_integer(output, i);
+        output_string(output, " more objects ...]");
+    }
+    if (context->stack_length) {
+        output_char(output, '\n');
+    }
+}
+
+/* -- profiler -- */
+/*
+ * Calls are timed as they enter and leave into a call tree, one node per
+ * distinct path, which gives the flame graph and the per procedure sums.
+ * Lines are sampled instead: every millisecond of cpu a signal notes the
+ * procedure and line of the frame being evaluated.
+ */
+#define CATIS_PROFILE_LINES 4096
+#define CATIS_PROFILE_INTERVAL 1000 // microseconds between line samples
+
+typedef struct catis_profile_node {
+    catis_procedure* procedure; // NULL for the root, the top level
+    struct catis_profile_node* parent;
+    struct catis_profile_node* child; // first one
+    struct catis_profile_node* sibling;
+    uint64_t calls;
+    uint64_t self; // nanoseconds not in a callee
+    uint64_t total; // nanoseconds, callees included
+    size_t path_length; // while writing folded stacks
+} catis_profile_node;
+
+typedef struct catis_line_sample {
+    catis_procedure* procedure;
+    int line;
+    unsigned int count;
+} catis_line_sample;
+
+typedef struct catis_profile {
+    catis_profile_node root;
+    catis_profile_node* current;
+    uint64_t last; // when time was last charged to current
+    uint64_t* entered; // entry times of the activations under current
+    size_t depth;
+    size_t capacity;
+    // open addressed by procedure and line, written by the signal handler
+    catis_line_sample sample[CATIS_PROFILE_LINES];
+    unsigned int lost; // samples that found the table full
+} catis_profile;
+
+// the context the line samples of this thread are taken from
+_Thread_local catis_context* volatile sampled_context = NULL;
+
+static inline uint64_t profile_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void profile_sample(int signal) {
+    (void)signal;
+    catis_context* context = sampled_context;
+    if (context == NULL || context->profile == NULL) {
+        return;
+    }
+    catis_profile* profile = context->profile;
+    stackframe* frame = context->frame;
+    catis_procedure* procedure = frame->procedure;
+    int line = frame->line;
+
+    size_t index = (((uintptr_t)procedure >> 4) * 31 + line) % CATIS_PROFILE_LINES;
+    for (size_t probe = 0; probe < CATIS_PROFILE_LINES; probe++) {
+        catis_line_sample* sample = profile->sample + index;
+        if (sample->count == 0) {
+            sample->procedure = procedure;
+            sample->line = line;
+        }
+        if (sample->procedure == procedure && sample->line == line) {
+            sample->count++;
+            return;
+        }
+        index = (index + 1) % CATIS_PROFILE_LINES;
+    }
+    profile->lost++;
+}
+
+void profile_enter(catis_profile* profile, catis_procedure* procedure) {
+    uint64_t now = profile_clock();
+    catis_profile_node* current = profile->current;
+    current->self += now - profile->last;
+
+    catis_profile_node* node = current->child;
+    while (node && node->procedure != procedure) {
+        node = node->sibling;
+    }
+    if (node == NULL) {
+        node = catis_allocate(sizeof(*node));
+        memset(node, 0, sizeof(*node));
+        node->procedure = procedure;
+        node->parent = current;
+        node->sibling = current->child;
+        current->child = node;
+    }
+    node->calls++;
+
+    if (profile->depth == profile->capacity) {
+        profile->capacity = grown_capacity(profile->capacity, profile->depth + 1);
+        profile->entered = catis_reallocate(
+            profile->entered,
+            sizeof(uint64_t) * profile->capacity
+        );
+    }
+    profile->entered[profile->depth++] = now;
+    profile->current = node;
+    profile->last = now;
+}
+
+void profile_leave(catis_profile* profile) {
+    if (profile->depth == 0) {
+        // entered before the profile started
+        return;
+    }
+    uint64_t now = profile_clock();
+    catis_profile_node* current = profile->current;
+    current->self += now - profile->last;
+    current->total += now - profile->entered[--profile->depth];
+    profile->current = current->parent;
+    profile->last = now;
+}
+
+/* around every call, a branch when not profiling */
+static inline void profile_call(catis_context* context, catis_procedure* procedure) {
+    if (context->profile) {
+        profile_enter(context->profile, procedure);
+    }
+}
+
+static inline void profile_return(catis_context* context) {
+    if (context->profile) {
+        profile_leave(context->profile);
+    }
+}
+
+/* the tree in depth first order, without recursing in C */
+catis_profile_node* next_profile_node(
+    catis_profile_node* node,
+    void (*leaving)(catis_profile_node*, void*),
+    void* argument
+) {
+    if (node->child) {
+        return node->child;
+    }
+    while (node->parent) {
+        leaving(node, argument);
+        if (node->sibling) {
+            return node->sibling;
+        }
+        node = node->parent;
+    }
+    return NULL;
+}
+
+void free_profile(catis_profile* profile) {
+    if (profile == NULL) {
+        return;
+    }
+    catis_profile_node* node = profile->root.child;
+    while (node) {
+        // children first, they unlink them-selves from the parent
+        if (node->child) {
+            node = node->child;
+            continue;
+        }
+        catis_profile_node* parent = node->parent;
+        parent->child = node->sibling;
+        catis_free(node);
+        node = parent == &profile->root ? parent->child : parent;
+    }
+    catis_free(profile->entered);
+    catis_free(profile);
+}
+
+void start_profile(catis_context* context) {
+    free_profile(context->profile);
+    free_profile(context->last_profile);
+    context->last_profile = NULL;
+    catis_profile* profile = catis_allocate(sizeof(*profile));
+    memset(profile, 0, sizeof(*profile));
+    profile->current = &profile->root;
+    profile->last = profile_clock();
+    context->profile = profile;
+
+    sampled_context = context;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = profile_sample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    struct itimerval timer = {
+        { 0, CATIS_PROFILE_INTERVAL },
+        { 0, CATIS_PROFILE_INTERVAL }
+    };
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/* the data stays for the reports, until the next start */
+void stop_profile(catis_context* context) {
+    catis_profile* profile = context->profile;
+    if (profile == NULL) {
+        return;
+    }
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sampled_context = NULL;
+
+    // what is still running is charged up to now
+    while (profile->depth) {
+        profile_leave(profile);
+    }
+    profile->root.self += profile_clock() - profile->last;
+    context->profile = NULL;
+    context->last_profile = profile;
+}
+
+void profile_totals_leaving(catis_profile_node* node, void* argument) {
+    (void)argument;
+    node->procedure->profile.open--;
+}
+
+int compare_profile_self(const void* a, const void* b) {
+    const catis_procedure* first = *(catis_procedure* const*)a;
+    const catis_procedure* second = *(catis_procedure* const*)b;
+    return first->profile.self < second->profile.self ? 1 :
+        first->profile.self > second->profile.self ? -1 : 0;
+}
+
+int compare_line_samples(const void* a, const void* b) {
+    const catis_line_sample* first = a;
+    const catis_line_sample* second = b;
+    return first->count < second->count ? 1 :
+        first->count > second->count ? -1 : 0;
+}
+
+void print_profile(catis_context* context, catis_profile* profile, FILE* file) {
+    size_t count = context->shared->procedure_count;
+    catis_procedure** procedures = catis_allocate(sizeof(catis_procedure*) * (count + 1));
+    size_t length = 0;
+    for (catis_procedure* procedure = context->shared->procedure; procedure; procedure = procedure->next) {
+        memset(&procedure->profile, 0, sizeof(procedure->profile));
+    }
+
+    for (
+        catis_profile_node* node = profile->root.child;
+        node;
+        node = next_profile_node(node, profile_totals_leaving, NULL)
+    ) {
+        catis_procedure* procedure = node->procedure;
+        if (procedure->profile.calls == 0) {
+            procedures[length++] = procedure;
+        }
+        procedure->profile.calls += node->calls;
+        procedure->profile.self += node->self;
+        if (procedure->profile.open++ == 0) {
+            procedure->profile.total += node->total;
+        }
+    }
+    qsort(procedures, length, sizeof(catis_procedure*), compare_profile_self);
+
+    fprintf(file, "%10s %12s %12s  %s\n", "calls", "total ms", "self ms", "procedure");
+    fprintf(
+        file,
+        "%10s %12s %12.3f  %s\n",
+        "", "", profile->root.self / 1e6, "(top level)"
+    );
+    for (size_t i = 0; i < length; i++) {
+        fprintf(
+            file,
+            "%10llu %12.3f %12.3f  %s\n",
+            (unsigned long long)procedures[i]->profile.calls,
+            procedures[i]->profile.total / 1e6,
+            procedures[i]->profile.self / 1e6,
+            procedures[i]->name
+        );
+    }
+    catis_free(procedures);
+
+    catis_line_sample* samples = catis_allocate(sizeof(profile->sample));
+    memcpy(samples, profile->sample, sizeof(profile->sample));
+    qsort(samples, CATIS_PROFILE_LINES, sizeof(catis_line_sample), compare_line_samples);
+    fprintf(file, "\n%10s  %s\n", "samples", "line");
+    for (size_t i = 0; i < 20 && samples[i].count; i++) {
+        // sampled mid call, it may not be a procedure: only print known ones
+        catis_procedure* procedure = context->shared->procedure;
+        while (procedure && procedure != samples[i].procedure) {
+            procedure = procedure->next;
+        }
+        fprintf(
+            file,
+            "%10u  %s:%d\n",
+            samples[i].count,
+            procedure ? procedure->name : "(top level)",
+            samples[i].line
+        );
+    }
+    if (profile->lost) {
+        fprintf(file, "%10u  (lost)\n", profile->lost);
+    }
+    catis_free(samples);
+}
+
+void folded_leaving(catis_profile_node* node, void* argument) {
+    char** path = argument;
+    (*path)[node->parent->path_length] = 0;
+}
+
+/* one `root;caller;callee microseconds` line per path, for flamegraph.pl */
+int write_folded_profile(catis_profile* profile, const char* filename) {
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        return 1;
+    }
+    size_t capacity = 256;
+    char* path = catis_allocate(capacity);
+    strcpy(path, "catis");
+    profile->root.path_length = strlen(path);
+    if (profile->root.self / 1000) {
+        fprintf(file, "%s %llu\n", path, (unsigned long long)(profile->root.self / 1000));
+    }
+
+    for (
+        catis_profile_node* node = profile->root.child;
+        node;
+        node = next_profile_node(node, folded_leaving, &path)
+    ) {
+        size_t start = node->parent->path_length;
+        size_t length = strlen(node->procedure->name);
+        if (start + length + 2 > capacity) {
+            capacity = grown_capacity(capacity, start + length + 2);
+            path = catis_reallocate(path, capacity);
+        }
+        path[start] = ';';
+        memcpy(path + start + 1, node->procedure->name, length + 1);
+        node->path_length = start + length + 1;
+        if (node->self / 1000) {
+            fprintf(file, "%s %llu\n", path, (unsigned long long)(node->self / 1000));
+        }
+    }
+    catis_free(path);
+    fclose(file);
+    return 0;
+}
+
+/* -- procedure activations -- */
+catis_code* prepare_code(catis_context* context, catis_procedure* procedure);
+void retain_code(catis_code* code);
+void release_code(catis_code* code);
+
+/* analysis is redone on the first call after a name is rebound */
+void prepare_procedure(catis_context* context, catis_procedure* procedure) {
+    unsigned int generation =
+        __atomic_load_n(&procedure->analysis_generation, __ATOMIC_ACQUIRE);
+    if (is_current(generation)) {
+        return;
+    }
+    if (!multithreaded) {
+        analyze_procedure(context, procedure, 0);
+        return;
+    }
+    // tasks calling it at the same time wait for the first one
+    pthread_mutex_lock(&context->shared->analysis);
+    if (!is_current(procedure->analysis_generation)) {
+        analyze_procedure(context, procedure, 0);
+    }
+    pthread_mutex_unlock(&context->shared->analysis);
+}
+
+void enter_procedure(
+    catis_context* context,
+    catis_procedure* procedure,
+    catis_activation* activation
+) {
+    prepare_procedure(context, procedure);
+    activation->procedure = procedure;
+    activation->body = procedure->procedure;
+    activation->code = context->vm ? prepare_code(context, procedure) : NULL;
+    retain(activation->body);
+    retain_code(activation->code);
+
+    if (procedure->frameless) {
+        // like a C procedure, only named in the frame for error messages
+        activation->caller = NULL;
+        activation->host = context->frame;
+        activation->caller_procedure = context->frame->procedure;
+        activation->caller_line = context->frame->line;
+        context->frame->procedure = procedure;
+    }
+    else {
+        activation->caller = context->frame;
+        context->frame = new_stackframe(context, procedure);
+    }
+    profile_call(context, procedure);
+}
+
+void leave_procedure(catis_context* context, catis_activation* activation) {
+    profile_return(context);
+    if (activation->caller) {
+        // the frame is let go once no longer current, a line sample may
+        // come at any time
+        stackframe* frame = context->frame;
+        context->frame = activation->caller;
+        release_stackframe(frame);
+    }
+    else {
+        context->frame->procedure = activation->caller_procedure;
+        context->frame->line = activation->caller_line;
+    }
+    release_code(activation->code);
+    release(activation->body);
+}
+
+/*
+ * The activation has nothing left to do but call procedure: reuse its
+ * place instead of nesting. The frame is kept when the layout is the
+ * same, as for self recursion, so loops written as recursion allocate
+ * nothing per iteration.
+ */
+void tail_procedure(
+    catis_context* context,
+    catis_activation* activation,
+    catis_procedure* procedure
+) {
+    if (
+        activation->caller == NULL ||
+        procedure->frameless ||
+        context->frame->slots != procedure->slots
+    ) {
+        leave_procedure(context, activation);
+        enter_procedure(context, procedure, activation);
+        return;
+    }
+
+    catis_object* body = activation->body;
+    catis_code* code = activation->code;
+    activation->procedure = procedure;
+    activation->body = procedure->procedure;
+    activation->code = context->vm ? prepare_code(context, procedure) : NULL;
+    retain(activation->body);
+    retain_code(activation->code);
+    release_code(code);
+    release(body);
+
+    clear_stackframe(context->frame);
+    context->frame->procedure = procedure;
+    profile_return(context);
+    profile_call(context, procedure);
+}
+
+/* -- control stack -- */
+catis_control* push_control(catis_context* context, int kind) {
+    if (context->control_length == context->control_capacity) {
+        context->control_capacity = grown_capacity(
+            context->control_capacity,
+            context->control_length + 1
+        );
+        context->control = catis_reallocate(
+            context->control,
+            sizeof(catis_control) * context->control_capacity
+        );
+    }
+    catis_control* control = context->control + context->control_length++;
+    control->kind = kind;
+    return control;
+}
+
+void push_list_control(catis_context* context, catis_object* list) {
+    catis_control* control = push_control(context, CONTROL_LIST);
+    control->list.list = list;
+    control->list.index = 0;
+}
+
+static inline catis_control* top_control(catis_context* context) {
+    return context->control + context->control_length - 1;
+}
+
+void pop_control(catis_context* context) {
+    catis_control* control = top_control(context);
+    switch (control->kind) {
+        case CONTROL_IF:
+            release(control->conditional.condition);
+            release(control->conditional.branch);
+            release(control->conditional.else_branch);
+            break;
+        case CONTROL_CALL:
+            leave_procedure(context, &control->call.activation);
+            break;
+    }
+    context->control_length--;
+}
+
+/* on errors, drop everything pushed since base */
+void unwind_control(catis_context* context, size_t base) {
+    while (context->control_length > base) {
+        pop_control(context);
+    }
+}
+
+/*
+ * Pop the lists and branches that are done, true when what remains on top
+ * is a catis procedure activation: a call now is its tail call.
+ */
+int finish_controls(catis_context* context, size_t base) {
+    while (context->control_length > base) {
+        catis_control* control = top_control(context);
+        if (
+            control->kind == CONTROL_LIST &&
+            control->list.index == control->list.list->collection.length
+        ) {
+            pop_control(context);
+        }
+        else if (
+            control->kind == CONTROL_IF &&
+            control->conditional.state == IF_BRANCH
+        ) {
+            pop_control(context);
+        }
+        else {
+            return control->kind == CONTROL_CALL;
+        }
+    }
+    return 0;
+}
+
+/* start evaluating the body of a catis procedure, in place of the caller */
+void enter_catis_procedure(
+    catis_context* context,
+    catis_procedure* procedure,
+    size_t base
+) {
+    prepare_procedure(context, procedure);
+    catis_activation* activation;
+    if (finish_controls(context, base) && !procedure->uses_caller_frame) {
+        activation = &top_control(context)->call.activation;
+        tail_procedure(context, activation, procedure);
+    }
+    else {
+        activation = &push_control(context, CONTROL_CALL)->call.activation;
+        enter_procedure(context, procedure, activation);
+    }
+    push_list_control(context, activation->body);
+}
+
+/* if, if-else and while: pop the branches and evaluate the condition */
+int enter_conditional(catis_context* context, catis_procedure* procedure) {
+    int is_else = procedure->name[2] == '-';
+    catis_procedure* previous = context->frame->procedure;
+    context->frame->procedure = procedure;
+    int error = is_else ?
+        check_stack_type(
+            context,
+            3,
+            CATIS_TYPE_LIST,
+            CATIS_TYPE_LIST,
+            CATIS_TYPE_LIST
+        ) :
+        check_stack_type(context, 2, CATIS_TYPE_LIST, CATIS_TYPE_LIST);
+    context->frame->procedure = previous;
+    if (error) {
+        return 1;
+    }
+
+    catis_control* control = push_control(context, CONTROL_IF);
+    control->conditional.procedure = procedure;
+    control->conditional.else_branch = is_else ? stack_pop(context) : NULL;
+    control->conditional.branch = stack_pop(context);
+    control->conditional.condition = stack_pop(context);
+    control->conditional.state = IF_CONDITION;
+    push_list_control(context, control->conditional.condition);
+    return 0;
+}
+
+/* the condition or a branch of the conditional on top is done */
+int resume_conditional(catis_context* context) {
+    catis_control* control = top_control(context);
+    catis_procedure* procedure = control->conditional.procedure;
+
+    switch (control->conditional.state) {
+        case IF_BRANCH:
+            pop_control(context);
+            return 0;
+        case IF_BODY:
+            control->conditional.state = IF_CONDITION;
+            push_list_control(context, control->conditional.condition);
+            return 0;
+    }
+
+    catis_object* conditional_result = stack_peek(context, 0);
+    if (
+        conditional_result == NULL ||
+        object_type(conditional_result) != CATIS_TYPE_BOOL
+    ) {
+        // let check_stack_type say what is wrong
+        catis_procedure* previous = context->frame->procedure;
+        context->frame->procedure = procedure;
+        check_stack_type(context, 1, CATIS_TYPE_BOOL);
+        context->frame->procedure = previous;
+        return 1;
+    }
+    stack_pop(context);
+    int result = object_boolean(conditional_result);
+    release(conditional_result);
+
+    if (result) {
+        int is_while = procedure->name[0] == 'w';
+        control->conditional.state = is_while ? IF_BODY : IF_BRANCH;
+        push_list_control(context, control->conditional.branch);
+    }
+    else if (control->conditional.else_branch) {
+        control->conditional.state = IF_BRANCH;
+        push_list_control(context, control->conditional.else_branch);
+    }
+    else {
+        pop_control(context);
+    }
+    return 0;
+}
+
+/* -- eval -- */
+int eval(catis_context* context, catis_object* list) {
+    assert(list->type == CATIS_TYPE_LIST);
+    size_t base = context->control_length;
+    push_list_control(context, list);
+
+    while (context->control_length > base) {
+        catis_control* control = top_control(context);
+        if (control->kind == CONTROL_IF) {
+            if (resume_conditional(context)) {
+                goto return_error;
+            }
+            continue;
+        }
+        if (control->kind == CONTROL_CALL) {
+            pop_control(context);
+            continue;
+        }
+
+        // the list on top, until an element pushes on the control stack
+        catis_object* current = control->list.list;
+        size_t index = control->list.index;
+        size_t depth = context->control_length;
+        while (index < current->collection.length) {
+            catis_object* object = current->collection.element[index++];
+            catis_procedure* procedure;
+
+            if (is_immediate(object)) {
+                stack_push(context, object);
+                continue;
+            }
+            context->frame->line = object->line;
+
+            switch (object->type) {
+                case CATIS_TYPE_TUPLE:
+                    catis_object* tuple = shallow_copy(object);
+                    stack_push(context, tuple);
+                    break;
+
+                case CATIS_TYPE_CAPTURE:
+                    // capture variables
+                    if (context->stack_length < object->collection.length) {
+                        set_error(
+                            context,
+                            object->collection.element[
+                            context->stack_length
+                            ]->string_or_symbol.pointer,
+                            "Out of stack while capturing local"
+                        );
+                        goto return_error;
+                    }
+
+                    context->stack_length -= object->collection.length;
+                    for (size_t i = 0; i < object->collection.length; i++) {
+                        catis_object** local = frame_local_slot(
+                            context->frame,
+                            (unsigned char)object->collection.element[i]
+                            ->string_or_symbol.pointer[0]
+                        );
+                        release(*local);
+                        *local = context->stack[context->stack_length + i];
+                    }
+                    break;
+                case CATIS_TYPE_SYMBOL:
+                    if (object->string_or_symbol.quoted) {
+                        catis_object* symbol = shallow_copy(object);
+                        symbol->string_or_symbol.quoted = 0;
+                        stack_push(context, symbol);
+                        break;
+                    }
+
+                    if (object->string_or_symbol.pointer[0] == '$') {
+                        int name =
+                            (unsigned char)object->string_or_symbol.pointer[1];
+                        catis_object* local = frame_local(context->frame, name);
+                        if (local == NULL) {
+                            set_error(
+                                context,
+                                object->string_or_symbol.pointer,
+                                "Unbound local variable"
+                            );
+                            goto return_error;
+                        }
+                        stack_push(context, local);
+                        if (is_last_use(object)) {
+                            *frame_local_slot(context->frame, name) = NULL;
+                        }
+                        else {
+                            retain(local);
+                        }
+                    }
+                    else {
+                        procedure = resolve_procedure(context, object);
+                        if (procedure == NULL) {
+                            set_error(
+                                context,
+                                object->string_or_symbol.pointer,
+                                "Symbol not bound to procedure"
+                            );
+                            goto return_error;
+                        }
+                        int inline_call = procedure->c_procedure ?
+                            procedure->c_procedure == library_if :
+                            !context->vm;
+                        if (!inline_call) {
+                            if (call_procedure(context, procedure)) {
+                                goto return_error;
+                            }
+                            break;
+                        }
+
+                        // on the control stack, continue from there after
+                        context->control[depth - 1].list.index = index;
+                        if (procedure->c_procedure) {
+                            if (enter_conditional(context, procedure)) {
+                                goto return_error;
+                            }
+                        }
+                        else {
+                            enter_catis_procedure(context, procedure, base);
+                        }
+                        goto next_control;
+                    }
+                    break;
+                default:
+                    stack_push(context, object);
+                    retain(object);
+                    break;
+            }
+        }
+        // done with the list
+        context->control_length--;
+    next_control:;
+    }
+    return 0;
+
+return_error:
+    unwind_control(context, base);
+    return 1;
+}
+
+/* -- calling procedures -- */
+int vm_run(catis_context* context, catis_code* code);
+int call_procedure(catis_context* context, catis_procedure* procedure) {
+    if (procedure->c_procedure) {
+        catis_procedure* previous = context->frame->procedure;
+        context->c_caller = previous;
+        context->frame->procedure = procedure;
+        profile_call(context, procedure);
+        int error = procedure->c_procedure(context);
+        profile_return(context);
+        context->frame->procedure = previous;
+        return error;
+    }
+
+    // on the control stack, where error traces find frameless callers
+    catis_activation* activation =
+        &push_control(context, CONTROL_CALL)->call.activation;
+    enter_procedure(context, procedure, activation);
+    int error = activation->code ?
+        vm_run(context, activation->code) :
+        eval(context, activation->body);
+    pop_control(context);
+    return error;
+}
+
+/* -- bytecode compiler -- */
+void emit(
+    catis_code* code,
+    int opcode,
+    int line,
+    size_t operand,
+    catis_object* object,
+    catis_procedure* procedure
+) {
+    code->instruction = catis_reallocate(
+        code->instruction,
+        sizeof(catis_instruction) * (code->length + 1)
+    );
+    catis_instruction* instruction = code->instruction + code->length++;
+    instruction->opcode = opcode;
+    instruction->line = line;
+    instruction->operand = operand;
+    instruction->object = object;
+    instruction->procedure = procedure;
+    if (object) {
+        retain(object);
+    }
+}
+
+int is_literal_list(catis_object* list, size_t index) {
+    return
+        index < list->collection.length &&
+        object_type(list->collection.element[index]) == CATIS_TYPE_LIST;
+}
+
+/* if symbol names if, if-else or while return its branch count, else 0 */
+int control_branches(catis_context* context, catis_object* symbol) {
+    if (
+        object_type(symbol) != CATIS_TYPE_SYMBOL ||
+        symbol->string_or_symbol.quoted
+    ) {
+        return 0;
+    }
+    catis_procedure* procedure = resolve_procedure(context, symbol);
+    if (procedure == NULL || procedure->c_procedure != library_if) {
+        return 0;
+    }
+    return procedure->name[2] == '-' ? 3 : 2;
+}
+
+/* what the comparison procedure, == != < > <= or >=, says of two ints */
+static inline int compare_integers(const char* name, int a, int b) {
+    switch (name[0]) {
+        case '=': return a == b;
+        case '!': return a != b;
+        case '<': return name[1] == '=' ? a <= b : a < b;
+        default:  return name[1] == '=' ? a >= b : a > b;
+    }
+}
+
+/* the instruction back from the end, NULL if a jump may land after it */
+catis_instruction* emitted(catis_code* code, size_t back) {
+    if (code->length - code->fence < back) {
+        return NULL;
+    }
+    return code->instruction + code->length - back;
+}
+
+static inline int is_integer_push(catis_instruction* instruction) {
+    return
+        instruction->opcode == OP_PUSH_CONST &&
+        object_type(instruction->object) == CATIS_TYPE_INT;
+}
+
+/*
+ * Emit a call to a C procedure, or something cheaper doing the same: dup,
+ * swap, drop and ~ inline, + - * / and comparisons of two int constants
+ * folded and comparisons of two locals fused. They check that no name was
+ * rebound since, else they call procedure as before, so a redefinition of
+ * one of them is seen right away, before the code is compiled again.
+ */
+void optimize_call(catis_code* code, int line, catis_procedure* procedure) {
+    int (*c_procedure)(catis_context*) = procedure->c_procedure;
+    const char* name = procedure->name;
+    catis_instruction* a = emitted(code, 2);
+    catis_instruction* b = emitted(code, 1);
+
+    int integers = c_procedure == library_math || c_procedure == library_compare;
+    if (integers && a && is_integer_push(a) && is_integer_push(b)) {
+        int x = object_integer(a->object);
+        int y = object_integer(b->object);
+        catis_object* result = NULL;
+        if (c_procedure == library_compare) {
+            result = new_boolean(compare_integers(name, x, y));
+        }
+        else if (name[0] != '/') {
+            result = new_integer(integer_math(name[0], x, y));
+        }
+        else if (y != 0 && y != -1) {
+            result = new_integer(x / y);
+        }
+        if (result) {
+            // immediates, nothing to release
+            code->length -= 2;
+            emit(
+                code,
+                OP_PUSH_FOLDED,
+                line,
+                (size_t)(uint32_t)x << 32 | (uint32_t)y,
+                result,
+                procedure
+            );
+            return;
+        }
+    }
+
+    if (
+        c_procedure == library_compare && a &&
+        a->opcode == OP_LOAD_LOCAL &&
+        b->opcode == OP_LOAD_LOCAL
+    ) {
+        catis_object* first = a->object;
+        catis_object* second = b->object;
+        size_t names = a->operand | b->operand << 8;
+        code->length -= 2;
+        emit(code, OP_COMPARE_LOCALS, line, names, first, procedure);
+        release(first);
+        release(second);
+        return;
+    }
+
+    int opcode =
+        c_procedure == library_dup  ? OP_DUP :
+        c_procedure == library_swap ? OP_SWAP :
+        c_procedure == library_drop ? OP_DROP :
+        c_procedure == library_not  ? OP_NOT :
+        OP_CALL_C;
+    emit(code, opcode, line, 0, NULL, procedure);
+}
+
+/* $i k + {i} or $i k - {i}, the load moving i out, as one instruction */
+int fuse_increment(catis_code* code, catis_object* capture) {
+    catis_instruction* load = emitted(code, 3);
+    if (load == NULL || capture->collection.length != 1) {
+        return 0;
+    }
+    catis_instruction* constant = load + 1;
+    catis_instruction* call = load + 2;
+    size_t name = (unsigned char)capture->collection.element[0]
+        ->string_or_symbol.pointer[0];
+    if (
+        load->opcode != OP_MOVE_LOCAL ||
+        load->operand != name ||
+        !is_integer_push(constant) ||
+        call->opcode != OP_CALL_C ||
+        call->procedure->c_procedure != library_math ||
+        (call->procedure->name[0] != '+' && call->procedure->name[0] != '-')
+    ) {
+        return 0;
+    }
+    int delta = object_integer(constant->object);
+    if (call->procedure->name[0] == '-') {
+        delta = integer_math('-', 0, delta);
+    }
+    load->opcode = OP_INCREMENT_LOCAL;
+    load->operand = name | (size_t)(uint32_t)delta << 32;
+    load->line = call->line;
+    load->procedure = call->procedure;
+    code->length -= 2;
+    return 1;
+}
+
+/* tiny catis procedures, like head, are compiled into their callers */
+#define CATIS_INLINE_LENGTH 4
+int is_inlinable(catis_procedure* procedure) {
+    // frameless: no locals, and no calls to catis procedures, so no cycles
+    if (
+        !is_current(procedure->analysis_generation) ||
+        procedure->join ||
+        !procedure->frameless ||
+        procedure->uses_caller_frame ||
+        procedure->procedure->collection.length > CATIS_INLINE_LENGTH
+    ) {
+        return 0;
+    }
+    for (size_t i = 0; i < procedure->procedure->collection.length; i++) {
+        int type = object_type(procedure->procedure->collection.element[i]);
+        if (type == CATIS_TYPE_LIST || type == CATIS_TYPE_CAPTURE) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void compile_list(catis_context* context, catis_code* code, catis_object* list);
+
+/* the body of procedure, guarded by an OP_INLINE to skip it if rebound */
+void compile_inline(
+    catis_context* context,
+    catis_code* code,
+    int line,
+    catis_procedure* procedure
+) {
+    size_t guard = code->length;
+    emit(code, OP_INLINE, line, 0, NULL, procedure);
+    code->fence = code->length;
+    compile_list(context, code, procedure->procedure);
+    code->instruction[guard].operand = code->length;
+    code->fence = code->length;
+}
+
+/* compile [condition] [branch] ([else]) if/if-else/while at list[index] */
+void compile_control(
+    catis_context* context,
+    catis_code* code,
+    catis_object* list,
+    size_t index,
+    catis_procedure* procedure
+) {
+    catis_object** element = list->collection.element + index;
+    int line = element[0]->line;
+    int is_while = procedure->name[0] == 'w';
+    int is_else  = procedure->name[2] == '-';
+
+    size_t top = code->length;
+    code->fence = code->length;
+    compile_list(context, code, element[0]);
+    size_t test = code->length;
+    emit(code, OP_JUMP_UNLESS, line, 0, NULL, procedure);
+    compile_list(context, code, element[1]);
+    if (is_while) {
+        emit(code, OP_JUMP, line, top, NULL, NULL);
+    }
+    else if (is_else) {
+        size_t skip = code->length;
+        emit(code, OP_JUMP, line, 0, NULL, NULL);
+        code->instruction[test].operand = code->length;
+        code->fence = code->length;
+        compile_list(context, code, element[2]);
+        code->instruction[skip].operand = code->length;
+        code->fence = code->length;
+        return;
+    }
+    code->instruction[test].operand = code->length;
+    code->fence = code->length;
+}
+
+void compile_list(catis_context* context, catis_code* code, catis_object* list) {
+    for (size_t i = 0; i < list->collection.length; i++) {
+        catis_object* object = list->collection.element[i];
+
+        if (is_immediate(object)) {
+            emit(code, OP_PUSH_CONST, 0, 0, object, NULL);
+            continue;
+        }
+
+        switch (object->type) {
+            case CATIS_TYPE_CAPTURE:
+                if (!fuse_increment(code, object)) {
+                    emit(code, OP_STORE_LOCALS, object->line, 0, object, NULL);
+                }
+                break;
+
+            case CATIS_TYPE_SYMBOL:
+                if (object->string_or_symbol.quoted) {
+                    catis_object* symbol = shallow_copy(object);
+                    symbol->string_or_symbol.quoted = 0;
+                    emit(code, OP_PUSH_CONST, object->line, 0, symbol, NULL);
+                    release(symbol);
+                    break;
+                }
+
+                if (object->string_or_symbol.pointer[0] == '$') {
+                    emit(
+                        code,
+                        is_last_use(object) ? OP_MOVE_LOCAL : OP_LOAD_LOCAL,
+                        object->line,
+                        (unsigned char)object->string_or_symbol.pointer[1],
+                        object,
+                        NULL
+                    );
+                    break;
+                }
+
+                catis_procedure* procedure = resolve_procedure(context, object);
+                if (procedure == NULL) {
+                    emit(code, OP_CALL_SYMBOL, object->line, 0, object, NULL);
+                }
+                else if (procedure->c_procedure) {
+                    optimize_call(code, object->line, procedure);
+                }
+                else if (is_inlinable(procedure)) {
+                    compile_inline(context, code, object->line, procedure);
+                }
+                else {
+                    emit(code, OP_CALL_PROC, object->line, 0, NULL, procedure);
+                }
+                break;
+
+            case CATIS_TYPE_LIST: {
+                // literal branches directly followed by if, if-else or while
+                int branches = 1;
+                while (is_literal_list(list, i + branches)) {
+                    branches++;
+                }
+                int needed = 0;
+                if (i + branches < list->collection.length) {
+                    needed = control_branches(
+                        context,
+                        list->collection.element[i + branches]
+                    );
+                }
+                if (needed && needed <= branches) {
+                    // earlier lists in the run are plain constants
+                    for (int j = 0; j < branches - needed; j++) {
+                        catis_object* constant = list->collection.element[i + j];
+                        emit(
+                            code,
+                            OP_PUSH_CONST,
+                            constant->line,
+                            0,
+                            constant,
+                            NULL
+                        );
+                    }
+                    i += branches - needed;
+                    compile_control(
+                        context,
+                        code,
+                        list,
+                        i,
+                        resolve_procedure(
+                            context,
+                            list->collection.element[i + needed]
+                        )
+                    );
+                    i += needed;
+                    break;
+                }
+                emit(code, OP_PUSH_CONST, object->line, 0, object, NULL);
+                break;
+            }
+
+            default:
+                emit(code, OP_PUSH_CONST, object->line, 0, object, NULL);
+                break;
+        }
+    }
+}
+
+/* -- define time type inference -- */
+/*
+ * Walk the bytecode with the type masks of what each instruction finds on
+ * the stack and in the locals, CATIS_TYPE_ANY when unknown, until they stop
+ * changing at the jump targets. Math and comparisons seen to get two ints
+ * become OP_MATH_INT and OP_COMPARE_INT. A call sure to fail its type
+ * check that every way through the code reaches is kept in mistyped, for
+ * define to report; one on a branch only fails if it runs. Only the top
+ * of the stack pushed by the code itself is followed, and a call that may
+ * run catis code forgets it, along with the locals if it can reach them.
+ */
+#define CATIS_INFER_DEPTH 8
+#define CATIS_INFER_LOCALS 16
+typedef struct catis_types {
+    int reachable;
+    int depth;
+    int stack[CATIS_INFER_DEPTH]; // the top at depth - 1
+    const unsigned char* slot; // local name -> index + 1, 0 if not followed
+    int locals;
+    int local[CATIS_INFER_LOCALS];
+} catis_types;
+
+void push_type(catis_types* types, int type) {
+    if (types->depth == CATIS_INFER_DEPTH) {
+        // the deepest is forgotten, as if the code never pushed it
+        memmove(
+            types->stack,
+            types->stack + 1,
+            sizeof(int) * (CATIS_INFER_DEPTH - 1)
+        );
+        types->depth--;
+    }
+    types->stack[types->depth++] = type;
+}
+
+int pop_type(catis_types* types) {
+    return types->depth ? types->stack[--types->depth] : CATIS_TYPE_ANY;
+}
+
+int peek_type(catis_types* types, int back) {
+    return back < types->depth ?
+        types->stack[types->depth - 1 - back] :
+        CATIS_TYPE_ANY;
+}
+
+int load_type(catis_types* types, int name) {
+    int slot = types->slot[name];
+    return slot ? types->local[slot - 1] : CATIS_TYPE_ANY;
+}
+
+void store_type(catis_types* types, int name, int type) {
+    int slot = types->slot[name];
+    if (slot) {
+        types->local[slot - 1] = type;
+    }
+}
+
+void forget_locals(catis_types* types) {
+    for (int i = 0; i < types->locals; i++) {
+        types->local[i] = CATIS_TYPE_ANY;
+    }
+}
+
+/* what both may hold into into, returns whether it changed */
+int merge_types(catis_types* into, catis_types* from) {
+    if (!from->reachable) {
+        return 0;
+    }
+    if (!into->reachable) {
+        *into = *from;
+        return 1;
+    }
+    int changed = 0;
+    int depth = into->depth < from->depth ? into->depth : from->depth;
+    int stack[CATIS_INFER_DEPTH];
+    for (int i = 0; i < depth; i++) {
+        // lined up from the top
+        int mine = into->stack[into->depth - depth + i];
+        int theirs = from->stack[from->depth - depth + i];
+        stack[i] = mine | theirs;
+        changed |= stack[i] != mine;
+    }
+    changed |= depth != into->depth;
+    memcpy(into->stack, stack, sizeof(int) * depth);
+    into->depth = depth;
+    for (int i = 0; i < into->locals; i++) {
+        int type = into->local[i] | from->local[i];
+        changed |= type != into->local[i];
+        into->local[i] = type;
+    }
+    return changed;
+}
+
+/* C procedures that run no catis code, they leave the locals alone */
+int runs_no_catis(catis_procedure* procedure) {
+    int (*c_procedure)(catis_context*) = procedure->c_procedure;
+    return c_procedure == library_print ||
+        c_procedure == library_println ||
+        c_procedure == library_flush ||
+        c_procedure == library_list_append ||
+        c_procedure == library_at ||
+        c_procedure == library_slice ||
+        c_procedure == library_concatenate ||
+        c_procedure == library_get ||
+        c_procedure == library_put ||
+        c_procedure == library_range ||
+        c_procedure == library_tail ||
+        c_procedure == library_to_vector ||
+        c_procedure == library_to_list ||
+        c_procedure == library_sort;
+}
+
+/* the effect of a call to a C procedure, 1 if it is sure to fail */
+int infer_call_c(catis_types* types, catis_instruction* instruction, int specialize) {
+    catis_procedure* procedure = instruction->procedure;
+    int (*c_procedure)(catis_context*) = procedure->c_procedure;
+    if (c_procedure == library_math) {
+        int b = pop_type(types);
+        int a = pop_type(types);
+        int numbers = CATIS_TYPE_INT | CATIS_TYPE_VECTOR;
+        if (!(a & numbers) || !(b & numbers)) {
+            push_type(types, CATIS_TYPE_ANY);
+            return 1;
+        }
+        if (a == CATIS_TYPE_INT && b == CATIS_TYPE_INT) {
+            if (specialize && procedure->name[0] != '/') {
+                instruction->opcode = OP_MATH_INT;
+                instruction->operand = procedure->name[0];
+            }
+            push_type(types, CATIS_TYPE_INT);
+        }
+        else {
+            push_type(types, numbers);
+        }
+    }
+    else if (c_procedure == library_compare) {
+        int b = pop_type(types);
+        int a = pop_type(types);
+        if (specialize && a == CATIS_TYPE_INT && b == CATIS_TYPE_INT) {
+            instruction->opcode = OP_COMPARE_INT;
+        }
+        push_type(types, CATIS_TYPE_BOOL);
+    }
+    else if (c_procedure == library_logic) {
+        int b = pop_type(types);
+        int a = pop_type(types);
+        push_type(types, CATIS_TYPE_BOOL);
+        return !(a & CATIS_TYPE_BOOL) || !(b & CATIS_TYPE_BOOL);
+    }
+    else if (c_procedure == library_length) {
+        pop_type(types);
+        push_type(types, CATIS_TYPE_INT);
+    }
+    else if (runs_no_catis(procedure)) {
+        types->depth = 0;
+    }
+    else {
+        // sort-by, map, eval... may evaluate lists in this frame
+        types->depth = 0;
+        forget_locals(types);
+    }
+    return 0;
+}
+
+/* the effect of instruction on types, 1 if it is sure to fail */
+int infer_instruction(
+    catis_types* types,
+    catis_instruction* instruction,
+    int specialize
+) {
+    int type;
+    switch (instruction->opcode) {
+        case OP_PUSH_CONST:
+        case OP_PUSH_FOLDED:
+            push_type(types, object_type(instruction->object));
+            break;
+        case OP_LOAD_LOCAL:
+            push_type(types, load_type(types, instruction->operand));
+            break;
+        case OP_MOVE_LOCAL:
+            push_type(types, load_type(types, instruction->operand));
+            store_type(types, instruction->operand, CATIS_TYPE_ANY);
+            break;
+        case OP_STORE_LOCALS: {
+            catis_object* capture = instruction->object;
+            int count = capture->collection.length;
+            for (int i = 0; i < count; i++) {
+                unsigned char name = capture->collection.element[i]
+                    ->string_or_symbol.pointer[0];
+                store_type(types, name, peek_type(types, count - 1 - i));
+            }
+            for (int i = 0; i < count; i++) {
+                pop_type(types);
+            }
+            break;
+        }
+        case OP_COMPARE_LOCALS:
+            push_type(types, CATIS_TYPE_BOOL);
+            break;
+        case OP_INCREMENT_LOCAL: {
+            int name = instruction->operand & 255;
+            if (load_type(types, name) != CATIS_TYPE_INT) {
+                store_type(types, name, CATIS_TYPE_INT | CATIS_TYPE_VECTOR);
+            }
+            break;
+        }
+        case OP_DUP:
+            push_type(types, peek_type(types, 0));
+            break;
+        case OP_SWAP:
+            if (types->depth >= 2) {
+                type = types->stack[types->depth - 1];
+                types->stack[types->depth - 1] = types->stack[types->depth - 2];
+                types->stack[types->depth - 2] = type;
+            }
+            else if (types->depth == 1) {
+                // the one under it was not pushed here, it comes up unknown
+                push_type(types, CATIS_TYPE_ANY);
+            }
+            break;
+        case OP_DROP:
+            pop_type(types);
+            break;
+        case OP_NOT:
+            type = pop_type(types);
+            push_type(types, CATIS_TYPE_BOOL);
+            return !(type & CATIS_TYPE_BOOL);
+        case OP_CALL_C:
+            return infer_call_c(types, instruction, specialize);
+        case OP_MATH_INT:
+            pop_type(types);
+            pop_type(types);
+            push_type(types, CATIS_TYPE_INT);
+            break;
+        case OP_COMPARE_INT:
+            pop_type(types);
+            pop_type(types);
+            push_type(types, CATIS_TYPE_BOOL);
+            break;
+        case OP_CALL_PROC: {
+            // a frame of its own, unless up-eval brings it back to this one
+            catis_procedure* callee = instruction->procedure;
+            types->depth = 0;
+            if (
+                !is_current(callee->analysis_generation) ||
+                callee->uses_caller_frame
+            ) {
+                forget_locals(types);
+            }
+            break;
+        }
+        case OP_CALL_SYMBOL:
+            types->depth = 0;
+            forget_locals(types);
+            break;
+        case OP_JUMP_UNLESS:
+            type = pop_type(types);
+            return !(type & CATIS_TYPE_BOOL);
+        case OP_RETURN:
+            types->reachable = 0;
+            break;
+        default:
+            // OP_INLINE, its body follows
+            break;
+    }
+    return 0;
+}
+
+/* one walk through code, returns whether a jump target changed */
+int infer_pass(
+    catis_code* code,
+    size_t* target,
+    catis_types* at,
+    catis_types* types,
+    unsigned char* failing // set for the calls sure to fail, when specializing
+) {
+    int specialize = failing != NULL;
+    int changed = 0;
+    types->reachable = 1;
+    types->depth = 0;
+    forget_locals(types);
+    for (size_t i = 0; i < code->length; i++) {
+        catis_instruction* instruction = code->instruction + i;
+        if (target[i]) {
+            changed |= merge_types(at + target[i] - 1, types);
+            *types = at[target[i] - 1];
+        }
+        if (!types->reachable) {
+            continue;
+        }
+        if (infer_instruction(types, instruction, specialize) && specialize) {
+            failing[i] = 1;
+        }
+        int opcode = instruction->opcode;
+        if (opcode == OP_JUMP || opcode == OP_JUMP_UNLESS) {
+            changed |= merge_types(at + target[instruction->operand] - 1, types);
+            types->reachable = opcode == OP_JUMP_UNLESS;
+        }
+    }
+    return changed;
+}
+
+/*
+ * The call sure to fail that every way from the start reaches, as 1 + its
+ * index, else 0. A loop may run forever, so a failure after it does not
+ * count.
+ */
+size_t sure_failure(catis_code* code, unsigned char* failing) {
+    // 2: every way on from there fails, worked out back from the returns
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (size_t i = code->length; i-- > 0;) {
+            catis_instruction* instruction = code->instruction + i;
+            if (failing[i] & 2) {
+                continue;
+            }
+            int fails = failing[i] & 1;
+            if (!fails) {
+                switch (instruction->opcode) {
+                    case OP_RETURN:
+                        break;
+                    case OP_JUMP:
+                        fails = failing[instruction->operand] & 2;
+                        break;
+                    case OP_JUMP_UNLESS:
+                        fails = (failing[i + 1] & 2) &&
+                            (failing[instruction->operand] & 2);
+                        break;
+                    default:
+                        fails = failing[i + 1] & 2;
+                        break;
+                }
+            }
+            if (fails) {
+                failing[i] |= 2;
+                changed = 1;
+            }
+        }
+    }
+    if (!(failing[0] & 2)) {
+        return 0;
+    }
+    size_t i = 0;
+    while (!(failing[i] & 1)) {
+        catis_instruction* instruction = code->instruction + i;
+        i = instruction->opcode == OP_JUMP ? instruction->operand : i + 1;
+    }
+    return i + 1;
+}
+
+/* follow the first CATIS_INFER_LOCALS names of a local instruction */
+void follow_local(catis_types* types, unsigned char* slot, int name) {
+    if (slot[name] == 0 && types->locals < CATIS_INFER_LOCALS) {
+        slot[name] = ++types->locals;
+    }
+}
+
+void infer_types(catis_code* code) {
+    // the jump targets, numbered from 1, and the locals
+    size_t* target = catis_allocate(sizeof(size_t) * (code->length + 1));
+    memset(target, 0, sizeof(size_t) * (code->length + 1));
+    unsigned char slot[CATIS_MAX_LOCALVARS];
+    memset(slot, 0, sizeof(slot));
+    catis_types types;
+    types.slot = slot;
+    types.locals = 0;
+    size_t count = 0;
+    for (size_t i = 0; i < code->length; i++) {
+        catis_instruction* instruction = code->instruction + i;
+        switch (instruction->opcode) {
+            case OP_JUMP:
+            case OP_JUMP_UNLESS:
+                if (target[instruction->operand] == 0) {
+                    target[instruction->operand] = ++count;
+                }
+                break;
+            case OP_LOAD_LOCAL:
+            case OP_MOVE_LOCAL:
+            case OP_INCREMENT_LOCAL:
+                follow_local(&types, slot, instruction->operand & 255);
+                break;
+            case OP_STORE_LOCALS:
+                for (size_t j = 0; j < instruction->object->collection.length; j++) {
+                    follow_local(
+                        &types,
+                        slot,
+                        (unsigned char)instruction->object->collection.element[j]
+                            ->string_or_symbol.pointer[0]
+                    );
+                }
+                break;
+        }
+    }
+    catis_types* at = catis_allocate(sizeof(catis_types) * (count + 1));
+    for (size_t i = 0; i < count; i++) {
+        at[i] = types;
+        at[i].reachable = 0;
+    }
+    while (infer_pass(code, target, at, &types, NULL)) {}
+    unsigned char* failing = catis_allocate(code->length + 1);
+    memset(failing, 0, code->length + 1);
+    infer_pass(code, target, at, &types, failing);
+    code->mistyped = sure_failure(code, failing);
+    catis_free(failing);
+    catis_free(at);
+    catis_free(target);
+}
+
+catis_code* compile(catis_context* context, catis_object* list) {
+    catis_code* code = catis_allocate(sizeof(*code));
+    code->instruction = NULL;
+    code->length = 0;
+    code->fence = 0;
+    code->reference_count = 1;
+    code->generation = current_generation();
+    code->mistyped = 0;
+    compile_list(context, code, list);
+    emit(code, OP_RETURN, list->line, 0, NULL, NULL);
+
+    // calls followed by the return, maybe through jumps, are tail calls
+    for (size_t i = 0; i < code->length; i++) {
+        catis_instruction* instruction = code->instruction + i;
+        if (
+            instruction->opcode != OP_CALL_PROC &&
+            instruction->opcode != OP_CALL_SYMBOL
+        ) {
+            continue;
+        }
+        catis_instruction* next = instruction + 1;
+        while (next->opcode == OP_JUMP) {
+            next = code->instruction + next->operand;
+        }
+        instruction->operand = next->opcode == OP_RETURN;
+    }
+    infer_types(code);
+    return code;
+}
+
+void retain_code(catis_code* code) {
+    if (code) {
+        count_up(&code->reference_count);
+    }
+}
+
+void release_code(catis_code* code) {
+    if (code == NULL || count_down(&code->reference_count) > 0) {
+        return;
+    }
+    for (size_t i = 0; i < code->length; i++) {
+        release(code->instruction[i].object);
+    }
+    catis_free(code->instruction);
+    catis_free(code);
+}
+
+/* the compiled body of procedure, recompiled if a name was rebound since */
+catis_code* prepare_code_unlocked(
+    catis_context* context,
+    catis_procedure* procedure
+) {
+    if (procedure->code && !is_current(procedure->code->generation)) {
+        release_code(procedure->code);
+        procedure->code = NULL;
+    }
+    if (procedure->code == NULL) {
+        catis_code* code = compile(context, procedure->procedure);
+        if (procedure->analysis_generation == CATIS_SEALED_GENERATION) {
+            code->generation = CATIS_SEALED_GENERATION;
+        }
+        __atomic_store_n(&procedure->code, code, __ATOMIC_RELEASE);
+    }
+    return procedure->code;
+}
+
+catis_code* prepare_code(catis_context* context, catis_procedure* procedure) {
+    catis_code* code = __atomic_load_n(&procedure->code, __ATOMIC_ACQUIRE);
+    if (code && is_current(code->generation)) {
+        return code;
+    }
+    if (!multithreaded) {
+        return prepare_code_unlocked(context, procedure);
+    }
+    pthread_mutex_lock(&context->shared->analysis);
+    code = prepare_code_unlocked(context, procedure);
+    pthread_mutex_unlock(&context->shared->analysis);
+    return code;
+}
+
+/*
+ * An error in the body of an inlined procedure: the line of the call goes
+ * after the frame's in the trace, as if it had been called.
+ */
+void trace_inline(
+    catis_context* context,
+    catis_code* code,
+    catis_instruction* pc
+) {
+    size_t at = context->error_frame_end;
+    context->error_frame_end = 0;
+    if (at == 0) {
+        return;
+    }
+    size_t index = pc - code->instruction;
+    for (size_t i = index; i-- > 0;) {
+        catis_instruction* guard = code->instruction + i;
+        if (guard->opcode != OP_INLINE || guard->operand <= index) {
+            continue;
+        }
+        char entry[64];
+        catis_procedure* caller = context->frame->procedure;
+        int length = snprintf(
+            entry,
+            sizeof(entry),
+            " in %s:%d ",
+            caller ? caller->name : "unknown",
+            guard->line
+        );
+        size_t total = strlen(context->error_string);
+        if (
+            length <= 0 ||
+            (size_t)length >= sizeof(entry) ||
+            total + length >= CATIS_ERROR_STRING_LENGTH
+        ) {
+            return;
+        }
+        memmove(
+            context->error_string + at + length,
+            context->error_string + at,
+            total - at + 1
+        );
+        memcpy(context->error_string + at, entry, length);
+        return;
+    }
+}
+
+/* -- virtual machine -- */
+int vm_run(catis_context* context, catis_code* code) {
+    static void* dispatch[] = {
+        [OP_PUSH_CONST]   = &&push_const,
+        [OP_LOAD_LOCAL]   = &&load_local,
+        [OP_MOVE_LOCAL]   = &&move_local,
+        [OP_STORE_LOCALS] = &&store_locals,
+        [OP_CALL_C]       = &&call_c,
+        [OP_CALL_PROC]    = &&call_proc,
+        [OP_CALL_SYMBOL]  = &&call_symbol,
+        [OP_JUMP]         = &&jump,
+        [OP_JUMP_UNLESS]  = &&jump_unless,
+        [OP_RETURN]       = &&return_ok,
+        [OP_DUP]            = &&dup,
+        [OP_SWAP]           = &&swap,
+        [OP_DROP]           = &&drop,
+        [OP_NOT]            = &&not,
+        [OP_PUSH_FOLDED]    = &&push_folded,
+        [OP_COMPARE_LOCALS] = &&compare_locals,
+        [OP_INCREMENT_LOCAL] = &&increment_local,
+        [OP_INLINE]         = &&inline_body,
+        [OP_MATH_INT]       = &&math_int,
+        [OP_COMPARE_INT]    = &&compare_int,
+    };
+    size_t base = context->control_length;
+    catis_instruction* pc = code->instruction;
+    catis_procedure* procedure;
+    #define DISPATCH() goto *dispatch[pc->opcode]
+
+    DISPATCH();
+
+push_const:
+    stack_push(context, pc->object);
+    retain(pc->object);
+    pc++;
+    DISPATCH();
+
+load_local: {
+    catis_object* local = frame_local(context->frame, pc->operand);
+    if (local == NULL) {
+        context->frame->line = pc->line;
+        set_error(
+            context,
+            pc->object->string_or_symbol.pointer,
+            "Unbound local variable"
+        );
+        goto return_error;
+    }
+    stack_push(context, local);
+    retain(local);
+    pc++;
+    DISPATCH();
+}
+
+move_local: {
+    catis_object** local = frame_local_slot(context->frame, pc->operand);
+    if (*local == NULL) {
+        context->frame->line = pc->line;
+        set_error(
+            context,
+            pc->object->string_or_symbol.pointer,
+            "Unbound local variable"
+        );
+        goto return_error;
+    }
+    // the capture following it rebinds the name, no need for a reference
+    stack_push(context, *local);
+    *local = NULL;
+    pc++;
+    DISPATCH();
+}
+
+store_locals: {
+    catis_object* capture = pc->object;
+    if (context->stack_length < capture->collection.length) {
+        context->frame->line = pc->line;
+        set_error(
+            context,
+            capture->collection.element[
+            context->stack_length
+            ]->string_or_symbol.pointer,
+            "Out of stack while capturing local"
+        );
+        goto return_error;
+    }
+    context->stack_length -= capture->collection.length;
+    for (size_t i = 0; i < capture->collection.length; i++) {
+        catis_object** local = frame_local_slot(
+            context->frame,
+            (unsigned char)capture->collection.element[i]
+            ->string_or_symbol.pointer[0]
+        );
+        release(*local);
+        *local = context->stack[context->stack_length + i];
+    }
+    pc++;
+    DISPATCH();
+}
+
+call_c: {
+    procedure = pc->procedure;
+    context->frame->line = pc->line;
+    if (procedure->c_procedure == NULL) {
+        // redefined in catis since compiled
+        goto call;
+    }
+    catis_procedure* previous = context->frame->procedure;
+    context->c_caller = previous;
+    context->frame->procedure = procedure;
+    profile_call(context, procedure);
+    int error = procedure->c_procedure(context);
+    profile_return(context);
+    context->frame->procedure = previous;
+    if (error) {
+        goto return_error;
+    }
+    pc++;
+    DISPATCH();
+}
+
+call_proc:
+    procedure = pc->procedure;
+    context->frame->line = pc->line;
+    goto call;
+
+call_symbol:
+    context->frame->line = pc->line;
+    procedure = resolve_procedure(context, pc->object);
+    if (procedure == NULL) {
+        set_error(
+            context,
+            pc->object->string_or_symbol.pointer,
+            "Symbol not bound to procedure"
+        );
+        goto return_error;
+    }
+    goto call;
+
+call: {
+    if (procedure->c_procedure) {
+        if (call_procedure(context, procedure)) {
+            goto return_error;
+        }
+        pc++;
+        DISPATCH();
+    }
+
+    // activations of this run are on the control stack, the first is not
+    prepare_procedure(context, procedure);
+    catis_activation* activation;
+    if (
+        (pc->opcode == OP_CALL_PROC || pc->opcode == OP_CALL_SYMBOL) &&
+        pc->operand &&
+        context->control_length > base &&
+        !procedure->uses_caller_frame
+    ) {
+        activation = &top_control(context)->call.activation;
+        tail_procedure(context, activation, procedure);
+    }
+    else {
+        catis_control* control = push_control(context, CONTROL_CALL);
+        control->call.return_code = code;
+        control->call.return_pc = pc + 1;
+        activation = &control->call.activation;
+        enter_procedure(context, procedure, activation);
+    }
+    code = activation->code;
+    pc = code->instruction;
+    DISPATCH();
+}
+
+jump:
+    pc = code->instruction + pc->operand;
+    DISPATCH();
+
+jump_unless: {
+    catis_object* condition = stack_pop(context);
+    if (condition == NULL || object_type(condition) != CATIS_TYPE_BOOL) {
+        catis_procedure* previous = context->frame->procedure;
+        context->frame->line = pc->line;
+        context->frame->procedure = pc->procedure;
+        if (condition) {
+            stack_push(context, condition);
+        }
+        set_error(
+            context,
+            NULL,
+            condition ? "Type mismatch" : "Out of stack"
+        );
+        context->frame->procedure = previous;
+        goto return_error;
+    }
+    int result = object_boolean(condition);
+    pc = result ? pc + 1 : code->instruction + pc->operand;
+    DISPATCH();
+}
+
+    // the optimized instructions, see optimize_call, going back to the
+    // call they replaced when a name was rebound or on an error
+dup:
+    if (!is_current(code->generation) || context->stack_length < 1) {
+        goto call_c;
+    }
+    stack_push(context, context->stack[context->stack_length - 1]);
+    retain(context->stack[context->stack_length - 1]);
+    pc++;
+    DISPATCH();
+
+swap: {
+    if (!is_current(code->generation) || context->stack_length < 2) {
+        goto call_c;
+    }
+    catis_object** top = context->stack + context->stack_length - 1;
+    catis_object* object = top[0];
+    top[0] = top[-1];
+    top[-1] = object;
+    pc++;
+    DISPATCH();
+}
+
+drop:
+    if (!is_current(code->generation) || context->stack_length < 1) {
+        goto call_c;
+    }
+    release(stack_pop(context));
+    pc++;
+    DISPATCH();
+
+not: {
+    catis_object** top = context->stack + context->stack_length - 1;
+    if (
+        !is_current(code->generation) ||
+        context->stack_length < 1 ||
+        object_type(*top) != CATIS_TYPE_BOOL
+    ) {
+        goto call_c;
+    }
+    *top = new_boolean(!object_boolean(*top));
+    pc++;
+    DISPATCH();
+}
+
+push_folded:
+    if (is_current(code->generation)) {
+        stack_push(context, pc->object);
+        pc++;
+        DISPATCH();
+    }
+    stack_push(context, new_integer((int)(pc->operand >> 32)));
+    stack_push(context, new_integer((int)(uint32_t)pc->operand));
+    goto call_c;
+
+compare_locals: {
+    catis_object* a = frame_local(context->frame, pc->operand & 255);
+    catis_object* b = frame_local(context->frame, pc->operand >> 8 & 255);
+    if (
+        is_current(code->generation) &&
+        ((uintptr_t)a & (uintptr_t)b & CATIS_TAG_MASK) == CATIS_TAG_INT
+    ) {
+        stack_push(context, new_boolean(compare_integers(
+            pc->procedure->name,
+            object_integer(a),
+            object_integer(b)
+        )));
+        pc++;
+        DISPATCH();
+    }
+    // as the two loads then the call
+    char load[3] = { '$', pc->operand >> 8 & 255, 0 };
+    if (a == NULL || b == NULL) {
+        context->frame->line = pc->line;
+        set_error(
+            context,
+            a == NULL ? pc->object->string_or_symbol.pointer : load,
+            "Unbound local variable"
+        );
+        goto return_error;
+    }
+    stack_push(context, a);
+    retain(a);
+    stack_push(context, b);
+    retain(b);
+    goto call_c;
+}
+
+increment_local: {
+    catis_object** local = frame_local_slot(context->frame, pc->operand & 255);
+    int delta = (int)(pc->operand >> 32);
+    if (
+        is_current(code->generation) &&
+        object_type(*local) == CATIS_TYPE_INT
+    ) {
+        *local = new_integer(integer_math('+', object_integer(*local), delta));
+        pc++;
+        DISPATCH();
+    }
+    // as the load, constant, call and capture
+    context->frame->line = pc->line;
+    if (*local == NULL) {
+        set_error(
+            context,
+            pc->object->string_or_symbol.pointer,
+            "Unbound local variable"
+        );
+        goto return_error;
+    }
+    stack_push(context, *local);
+    *local = NULL;
+    stack_push(
+        context,
+        new_integer(pc->procedure->name[0] == '-' ? integer_math('-', 0, delta) : delta)
+    );
+    if (call_procedure(context, pc->procedure)) {
+        goto return_error;
+    }
+    if (context->stack_length < 1) {
+        char name[2] = { pc->operand & 255, 0 };
+        set_error(context, name, "Out of stack while capturing local");
+        goto return_error;
+    }
+    local = frame_local_slot(context->frame, pc->operand & 255);
+    release(*local);
+    *local = stack_pop(context);
+    pc++;
+    DISPATCH();
+}
+
+inline_body:
+    if (is_current(code->generation)) {
+        pc++;
+        DISPATCH();
+    }
+    // rebound since compiled, call what the name is now instead
+    context->frame->line = pc->line;
+    if (call_procedure(context, pc->procedure)) {
+        goto return_error;
+    }
+    pc = code->instruction + pc->operand;
+    DISPATCH();
+
+    // two ints are on top, inference saw them pushed
+math_int: {
+    if (!is_current(code->generation)) {
+        goto call_c;
+    }
+    assert(context->stack_length >= 2);
+    catis_object** top = context->stack + context->stack_length - 1;
+    int a = object_integer(top[-1]);
+    int b = object_integer(top[0]);
+    top[-1] = new_integer(integer_math(pc->operand, a, b));
+    context->stack_length--;
+    pc++;
+    DISPATCH();
+}
+
+compare_int: {
+    if (!is_current(code->generation)) {
+        goto call_c;
+    }
+    assert(context->stack_length >= 2);
+    catis_object** top = context->stack + context->stack_length - 1;
+    top[-1] = new_boolean(compare_integers(
+        pc->procedure->name,
+        object_integer(top[-1]),
+        object_integer(top[0])
+    ));
+    context->stack_length--;
+    pc++;
+    DISPATCH();
+}
+
+return_ok:
+    if (context->control_length > base) {
+        catis_control* control = top_control(context);
+        code = control->call.return_code;
+        pc = control->call.return_pc;
+        pop_control(context);
+        DISPATCH();
+    }
+    return 0;
+
+return_error:
+    trace_inline(context, code, pc);
+    unwind_control(context, base);
+    return 1;
+    #undef DISPATCH
+}
+
+/* evaluate a top level program, compiling it first in %vm mode */
+int eval_program(catis_context* context, catis_object* program) {
+    enter_shared(context->shared);
+    if (!context->vm) {
+        return eval(context, program);
+    }
+    catis_code* code = compile(context, program);
+    int error = vm_run(context, code);
+    release_code(code);
+    return error;
+}
+
+/* then wait for the joins it fired */
+void wait_for_tasks(catis_shared* shared);
+int eval_toplevel(catis_context* context, catis_object* program) {
+    int error = eval_program(context, program);
+    // joins fired meanwhile print before the next prompt
+    output_flush(&context->output);
+    leave_shared(context->shared);
+    wait_for_tasks(context->shared);
+    return error;
+}
+
+/* the last error, for a file form or a join body that failed */
+void output_error(catis_context* context) {
+    output_string(&context->output, "Runtime error: ");
+    output_string(&context->output, context->error_string);
+    output_char(&context->output, '\n');
+}
+
+/* -- procedure utils -- */
+int check_stack_length(catis_context* context, size_t minimum) {
+    if (context->stack_length < minimum) {
+        set_error(context, NULL, "Out of stack");
+        return 1;
+    }
+    return 0;
+}
+
+int check_stack_type(catis_context* context, size_t count, ...) {
+    if (check_stack_length(context, count)) { return 1; }
+    va_list types;
+    va_start(types, count);
+    for (size_t i = 0; i < count; i++) {
+        int type = va_arg(types, int);
+        catis_object** slot = context->stack + context->stack_length - (count - i);
+        if (type & object_type(*slot)) {
+            continue;
+        }
+        if (object_type(*slot) == CATIS_TYPE_RANGE && (type & CATIS_TYPE_LIST)) {
+            // a lazy range where only lists are understood
+            catis_object* range = *slot;
+            *slot = range_to_list(range);
+            release(range);
+        }
+        else {
+            set_error(context, NULL, "Type mismatch");
+            return 1;
+        }
+    }
+    va_end(types);
+    return 0;
+}
+
+catis_procedure* lookup_shared_procedure(catis_shared* shared, catis_atom* atom) {
+    if (shared->procedure_table_size == 0) {
+        return NULL;
+    }
+    size_t mask = shared->procedure_table_size - 1;
+    size_t index = atom->hash & mask;
+    while (shared->procedure_table[index]) {
+        if (shared->procedure_table[index]->atom == atom) {
+            return shared->procedure_table[index];
+        }
+        index = (index + 1) & mask;
+    }
+    return NULL;
+}
+
+/* the interpreter's own procedures shadow the ones of its library */
+catis_procedure* lookup_atom_procedure(
+    catis_context* context,
+    catis_atom* atom
+) {
+    catis_procedure* procedure = lookup_shared_procedure(context->shared, atom);
+    if (procedure == NULL && context->shared->base) {
+        procedure = lookup_shared_procedure(context->shared->base, atom);
+    }
+    return procedure;
+}
+
+catis_procedure* lookup_procedure(catis_context* context, const char* name) {
+    return lookup_atom_procedure(context, intern(name, strlen(name)));
+}
+
+/* resolve the procedure a symbol names, caching it in the symbol object */
+catis_procedure* resolve_procedure(
+    catis_context* context,
+    catis_object* symbol
+) {
+    // a name keeps its procedure once bound, threads filling the cache at
+    // the same time store the same thing
+    catis_procedure* procedure = __atomic_load_n(
+        &symbol->string_or_symbol.cached_procedure,
+        __ATOMIC_RELAXED
+    );
+    if (
+        procedure &&
+        is_current(__atomic_load_n(
+            &symbol->string_or_symbol.cached_generation,
+            __ATOMIC_RELAXED
+        ))
+    ) {
+        return procedure;
+    }
+    // the library's own names are not shadowed, it keeps working as frozen
+    unsigned int generation = current_generation();
+    if (symbol->string_or_symbol.library) {
+        procedure = lookup_shared_procedure(
+            context->shared->base ? context->shared->base : context->shared,
+            symbol->string_or_symbol.atom
+        );
+        generation = CATIS_SEALED_GENERATION;
+    }
+    else {
+        procedure = lookup_atom_procedure(context, symbol->string_or_symbol.atom);
+    }
+    if (procedure) {
+        __atomic_store_n(
+            &symbol->string_or_symbol.cached_procedure,
+            procedure,
+            __ATOMIC_RELAXED
+        );
+        __atomic_store_n(
+            &symbol->string_or_symbol.cached_generation,
+            generation,
+            __ATOMIC_RELAXED
+        );
+    }
+    return procedure;
+}
+
+void insert_procedure(catis_context* context, catis_procedure* procedure) {
+    size_t mask = context->shared->procedure_table_size - 1;
+    size_t index = procedure->atom->hash & mask;
+    while (context->shared->procedure_table[index]) {
+        index = (index + 1) & mask;
+    }
+    context->shared->procedure_table[index] = procedure;
+}
+
+#define CATIS_PROCEDURE_TABLE_INITIAL_SIZE 64
+void grow_procedure_table(catis_context* context) {
+    catis_procedure** old_table = context->shared->procedure_table;
+    size_t old_size = context->shared->procedure_table_size;
+    context->shared->procedure_table_size = old_size ?
+        old_size * 2 :
+        CATIS_PROCEDURE_TABLE_INITIAL_SIZE;
+    context->shared->procedure_table = catis_allocate(
+        sizeof(catis_procedure*) * context->shared->procedure_table_size
+    );
+    memset(
+        context->shared->procedure_table,
+        0,
+        sizeof(catis_procedure*) * context->shared->procedure_table_size
+    );
+    for (size_t i = 0; i < old_size; i++) {
+        if (old_table[i]) {
+            insert_procedure(context, old_table[i]);
+        }
+    }
+    catis_free(old_table);
+}
+
+catis_procedure* new_procedure(catis_context* context, const char* name) {
+    catis_procedure* procedure = catis_allocate(sizeof(*procedure));
+    procedure->atom = intern(name, strlen(name));
+    procedure->name = procedure->atom->name;
+    procedure->procedure = NULL;
+    procedure->code = NULL;
+    procedure->source = NULL;
+    procedure->join = NULL;
+    procedure->memo = NULL;
+    procedure->analysis_generation = 0;
+    procedure->slots = NULL;
+    procedure->frameless = 0;
+    procedure->foreign = 1;
+    procedure->uses_caller_frame = 1;
+    procedure->next = context->shared->procedure;
+    context->shared->procedure = procedure;
+
+    if (context->shared->procedure_count >= context->shared->procedure_table_size / 2) {
+        grow_procedure_table(context);
+    }
+    insert_procedure(context, procedure);
+    context->shared->procedure_count++;
+    return procedure;
+}
+
+void release_join(struct catis_join* join);
+void release_memo(struct catis_memo* memo);
+
+/* with the definitions locked */
+catis_procedure* bind_procedure(
+    catis_context* context,
+    const char* name,
+    int(*c_procedure)(catis_context *),
+    catis_object* list
+) {
+    assert((c_procedure != NULL) + (list != NULL) == 1);
+    // a name of the library is shadowed, not rebound
+    catis_procedure* procedure =
+        lookup_shared_procedure(context->shared, intern(name, strlen(name)));
+    if (procedure) {
+        __atomic_add_fetch(&procedure_generation, 1, __ATOMIC_RELAXED);
+        if (procedure->procedure != NULL) {
+            release(procedure->procedure);
+            procedure->procedure = NULL;
+        }
+        release_code(procedure->code);
+        procedure->code = NULL;
+        release(procedure->source);
+        procedure->source = NULL;
+        release_join(procedure->join);
+        procedure->join = NULL;
+        release_memo(procedure->memo);
+        procedure->memo = NULL;
+    } else {
+        procedure = new_procedure(context, name);
+    }
+    procedure->procedure = list;
+    procedure->c_procedure = c_procedure;
+    return procedure;
+}
+
+/* once nothing runs its procedures any more, its pool stopped */
+void free_shared(catis_shared* shared) {
+    // symbols still cache its procedures
+    __atomic_add_fetch(&procedure_generation, 1, __ATOMIC_RELAXED);
+    catis_procedure* procedure = shared->procedure;
+    while (procedure) {
+        catis_procedure* next = procedure->next;
+        release(procedure->procedure);
+        release_code(procedure->code);
+        release(procedure->source);
+        release_join(procedure->join);
+        release_memo(procedure->memo);
+        release_slots(procedure->slots);
+        catis_free(procedure);
+        procedure = next;
+    }
+    catis_free(shared->procedure_table);
+    pthread_rwlock_destroy(&shared->definitions);
+    pthread_mutex_destroy(&shared->analysis);
+    catis_free(shared);
+}
+
+void add_procedure(
+    catis_context* context,
     const char* name,
     int(*c_procedure)(catis_context *),
     catis_object* list
 ) {
-    assert((c_procedure != NULL) + (list != NULL) == 1);
-    catis_procedure* procedure = lookup_procedure(context, name);
-    if (procedure) {
-        if (procedure->procedure != NULL) {
-            release(procedure->procedure);
-            procedure->procedure = NULL;
+    lock_definitions(context->shared);
+    catis_procedure* procedure = bind_procedure(context, name, c_procedure, list);
+    if (list) {
+        analyze_procedure(context, procedure, 1);
+    }
+    unlock_definitions(context->shared);
+}
+
+int add_string_procedure(
+    catis_context* context,
+    const char* name,
+    const char* program
+) {
+    catis_object* list = parse_object(NULL, program, NULL, NULL);
+    if (program == NULL || list == NULL) {
+        printf("%s -- %s\n", name, program);
+        return 1;
+    }
+    add_procedure(context, name, NULL, list);
+    return 0;
+}
+
+/* a C procedure, with its equivalent catis definition for unquote */
+int add_native_procedure(
+    catis_context* context,
+    const char* name,
+    int(*c_procedure)(catis_context *),
+    const char* program
+) {
+    catis_object* list = parse_object(NULL, program, NULL, NULL);
+    if (list == NULL) {
+        printf("%s -- %s\n", name, program);
+        return 1;
+    }
+    add_procedure(context, name, c_procedure, NULL);
+    lookup_shared_procedure(context->shared, intern(name, strlen(name)))
+        ->source = list;
+    return 0;
+}
+
+/* -- define time analysis -- */
+typedef struct body_analysis {
+    unsigned char used[CATIS_MAX_LOCALVARS]; // captured or loaded names
+    int foreign; // may evaluate lists that are not literals of the body
+    int unbound; // names not bound yet, retry on the first call
+    int caller; // may up-eval, into the caller's frame
+} body_analysis;
+
+/* C procedures evaluating lists they are given, in the caller's frame */
+int evaluates_lists(catis_procedure* procedure) {
+    return procedure->c_procedure == library_eval ||
+        procedure->c_procedure == library_up_eval ||
+        procedure->c_procedure == library_if ||
+        procedure->c_procedure == library_map ||
+        procedure->c_procedure == library_each ||
+        procedure->c_procedure == library_parallel;
+}
+
+/* could evaluating object read the local called name */
+int may_read_local(catis_context* context, catis_object* object, int name) {
+    if (is_immediate(object)) {
+        return 0;
+    }
+    if (object->type != CATIS_TYPE_SYMBOL || object->string_or_symbol.quoted) {
+        // lists are only read when evaluated, by a procedure stopping us
+        return 0;
+    }
+    if (object->string_or_symbol.pointer[0] == '$') {
+        return (unsigned char)object->string_or_symbol.pointer[1] == name;
+    }
+
+    catis_procedure* procedure = resolve_procedure(context, object);
+    if (procedure == NULL) {
+        return 1;
+    }
+    if (procedure->c_procedure) {
+        return evaluates_lists(procedure);
+    }
+    // catis procedures evaluating only their own literals, like swap
+    return !is_current(procedure->analysis_generation) || procedure->foreign;
+}
+
+/* does the capture object bind the local called name */
+int captures_local(catis_object* object, int name) {
+    if (is_immediate(object) || object->type != CATIS_TYPE_CAPTURE) {
+        return 0;
+    }
+    for (size_t i = 0; i < object->collection.length; i++) {
+        if (
+            (unsigned char)object->collection.element[i]
+            ->string_or_symbol.pointer[0] == name
+        ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * A $ load is the last use of its local when a capture later in the same
+ * list rebinds it and nothing in between can read it. The value is moved
+ * out of the frame then, so `$r x <- {r}` finds r unshared and appends in
+ * place instead of copying.
+ */
+void mark_last_uses(catis_context* context, catis_object* list) {
+    for (size_t i = 0; i < list->collection.length; i++) {
+        catis_object* load = list->collection.element[i];
+        if (
+            is_immediate(load) ||
+            load->type != CATIS_TYPE_SYMBOL ||
+            load->string_or_symbol.quoted ||
+            load->string_or_symbol.pointer[0] != '$' ||
+            load->string_or_symbol.library // sealed with its library
+        ) {
+            continue;
+        }
+
+        int name = (unsigned char)load->string_or_symbol.pointer[1];
+        for (size_t j = i + 1; j < list->collection.length; j++) {
+            catis_object* object = list->collection.element[j];
+            if (captures_local(object, name)) {
+                load->string_or_symbol.last_use_generation =
+                    current_generation();
+                break;
+            }
+            if (may_read_local(context, object, name)) {
+                break;
+            }
+        }
+    }
+}
+
+void analyze_list(
+    catis_context* context,
+    catis_object* list,
+    body_analysis* analysis
+) {
+    mark_last_uses(context, list);
+    for (size_t i = 0; i < list->collection.length; i++) {
+        catis_object* object = list->collection.element[i];
+        if (is_immediate(object)) {
+            continue;
+        }
+
+        switch (object->type) {
+            case CATIS_TYPE_CAPTURE:
+                for (size_t j = 0; j < object->collection.length; j++) {
+                    analysis->used[(unsigned char)object->collection.element[j]
+                        ->string_or_symbol.pointer[0]] = 1;
+                }
+                break;
+            case CATIS_TYPE_LIST:
+                analyze_list(context, object, analysis);
+                break;
+            case CATIS_TYPE_SYMBOL:
+                if (object->string_or_symbol.quoted) {
+                    break;
+                }
+                if (object->string_or_symbol.pointer[0] == '$') {
+                    analysis->used[
+                        (unsigned char)object->string_or_symbol.pointer[1]
+                    ] = 1;
+                    break;
+                }
+                catis_procedure* procedure = resolve_procedure(context, object);
+                if (procedure == NULL) {
+                    analysis->unbound = 1;
+                    analysis->foreign = 1;
+                    analysis->caller = 1;
+                }
+                else if (procedure->c_procedure == library_if) {
+                    // fine as long as the branches are literals, seen here
+                    size_t needed = control_branches(context, object);
+                    for (size_t j = 1; j <= needed; j++) {
+                        if (j > i || !is_literal_list(list, i - j)) {
+                            analysis->foreign = 1;
+                            analysis->caller = 1;
+                        }
+                    }
+                }
+                else if (procedure->c_procedure == NULL) {
+                    analysis->foreign = 1;
+                }
+                else if (
+                    procedure->c_procedure == library_map ||
+                    procedure->c_procedure == library_each ||
+                    procedure->c_procedure == library_parallel
+                ) {
+                    // the function is in the frame, up-eval in it is seen
+                    analysis->foreign = 1;
+                    if (i == 0 || !is_literal_list(list, i - 1)) {
+                        analysis->caller = 1;
+                    }
+                }
+                else if (evaluates_lists(procedure)) {
+                    // eval and up-eval
+                    analysis->foreign = 1;
+                    analysis->caller = 1;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/*
+ * Work out the frame layout of a catis procedure: one slot per local name
+ * its body captures or loads, including in nested lists since those are
+ * usually evaluated in the same frame. Procedures with no locals that can
+ * not end up evaluating a list from elsewhere need no frame at all.
+ */
+void analyze_procedure(
+    catis_context* context,
+    catis_procedure* procedure,
+    int at_definition
+) {
+    body_analysis analysis;
+    memset(&analysis, 0, sizeof(analysis));
+    analyze_list(context, procedure->procedure, &analysis);
+
+    catis_slots* slots = catis_allocate(sizeof(*slots));
+    slots->reference_count = 1;
+    slots->local_count = 0;
+    memset(slots->slot, 0, sizeof(slots->slot));
+    for (int name = 0; name < CATIS_MAX_LOCALVARS; name++) {
+        // a name past the 255th slot goes to the frame overflow
+        if (analysis.used[name] && slots->local_count < 255) {
+            slots->slot[name] = ++slots->local_count;
+        }
+    }
+    release_slots(procedure->slots);
+    procedure->slots = slots;
+    procedure->frameless = slots->local_count == 0 && !analysis.foreign;
+    procedure->foreign = analysis.foreign;
+    procedure->uses_caller_frame = analysis.caller;
+
+    // names unbound at definition may be defined later, look again on call
+    // published last, prepare_procedure reads the rest after seeing it
+    __atomic_store_n(
+        &procedure->analysis_generation,
+        analysis.unbound && at_definition ? 0 : current_generation(),
+        __ATOMIC_RELEASE
+    );
+}
+
+/* -- work stealing pool -- */
+typedef struct catis_task {
+    // runs it on a worker's context, and frees it
+    void (*run)(catis_context* context, struct catis_task* task);
+    int vm;
+    catis_procedure* join; // names the task's frame
+    catis_object* body;
+    struct catis_batch* batch; // for chunks of a parallel list procedure
+    size_t count;
+    catis_object* value[]; // the inputs, in the join's order
+} catis_task;
+
+typedef struct catis_worker {
+    pthread_t thread;
+    struct catis_pool* pool;
+    catis_context* context; // reused by every task it runs
+    // deque of tasks: the owner pushes and pops at the bottom, idle
+    // workers steal the oldest from the top
+    pthread_mutex_t lock;
+    catis_task** task;
+    size_t top;
+    size_t bottom;
+    size_t capacity;
+} catis_worker;
+
+typedef struct catis_pool {
+    catis_shared* shared;
+    catis_worker* worker;
+    size_t worker_count;
+    size_t next; // round robin for tasks from outside the pool
+    size_t queued; // tasks in deques
+    size_t pending; // tasks in deques or running
+    int stopping; // the workers exit once out of tasks, see stop_pool
+    pthread_mutex_t lock; // to sleep on the conditions
+    pthread_cond_t work; // tasks were queued
+    pthread_cond_t idle; // nothing pending any more
+} catis_pool;
+
+_Thread_local catis_worker* current_worker = NULL;
+
+void push_task(catis_worker* worker, catis_task* task) {
+    pthread_mutex_lock(&worker->lock);
+    if (worker->top == worker->bottom) {
+        worker->top = worker->bottom = 0;
+    }
+    if (worker->bottom == worker->capacity) {
+        worker->capacity = grown_capacity(worker->capacity, worker->bottom + 1);
+        worker->task = catis_reallocate(
+            worker->task,
+            sizeof(catis_task*) * worker->capacity
+        );
+    }
+    worker->task[worker->bottom++] = task;
+    pthread_mutex_unlock(&worker->lock);
+}
+
+/* the newest task of its own, else the oldest of another worker */
+catis_task* take_task(catis_worker* worker) {
+    catis_pool* pool = worker->pool;
+    catis_task* task = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->bottom > worker->top) {
+        task = worker->task[--worker->bottom];
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    size_t self = worker - pool->worker;
+    for (size_t i = 1; task == NULL && i < pool->worker_count; i++) {
+        catis_worker* victim =
+            pool->worker + (self + i) % pool->worker_count;
+        pthread_mutex_lock(&victim->lock);
+        if (victim->bottom > victim->top) {
+            task = victim->task[victim->top++];
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    if (task) {
+        __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    }
+    return task;
+}
+
+void* worker_main(void* argument) {
+    catis_worker* worker = argument;
+    catis_pool* pool = worker->pool;
+    current_worker = worker;
+    register_stats();
+    // line samples are for the thread profiling
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    while (1) {
+        catis_task* task = take_task(worker);
+        if (task == NULL) {
+            pthread_mutex_lock(&pool->lock);
+            while (
+                __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0 &&
+                !pool->stopping
+            ) {
+                pthread_cond_wait(&pool->work, &pool->lock);
+            }
+            int stopping = pool->stopping;
+            pthread_mutex_unlock(&pool->lock);
+            if (stopping) {
+                break;
+            }
+            continue;
+        }
+
+        task->run(worker->context, task);
+        if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_broadcast(&pool->idle);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+    unregister_stats();
+    retire_heap();
+    return NULL;
+}
+
+/* one worker per core, from the first task on everything is threaded */
+catis_pool* start_pool(catis_shared* shared) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    catis_pool* pool = catis_allocate(sizeof(*pool));
+    pool->shared = shared;
+    pool->worker_count = cores > 0 ? cores : 1;
+    pool->worker = catis_allocate(sizeof(catis_worker) * pool->worker_count);
+    pool->next = 0;
+    pool->queued = 0;
+    pool->pending = 0;
+    pool->stopping = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    if (!multithreaded) {
+        // a library's interpreters may be running already
+        multithreaded = 1;
+    }
+    // the thread starting it is evaluating already
+    enter_shared(shared);
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        catis_worker* worker = pool->worker + i;
+        worker->pool = pool;
+        worker->context = new_context(shared);
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->task = NULL;
+        worker->top = worker->bottom = worker->capacity = 0;
+    }
+    shared->pool = pool;
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        pthread_create(&pool->worker[i].thread, NULL, worker_main, pool->worker + i);
+    }
+    return pool;
+}
+
+void submit_task(catis_context* context, catis_task* task) {
+    catis_pool* pool = context->shared->pool;
+    if (pool == NULL) {
+        pool = start_pool(context->shared);
+    }
+    catis_worker* worker = current_worker;
+    if (worker == NULL || worker->pool != pool) {
+        size_t next = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        worker = pool->worker + next % pool->worker_count;
+    }
+
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    push_task(worker, task);
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* until every task, and the tasks they fired, are done */
+void wait_for_tasks(catis_shared* shared) {
+    catis_pool* pool = shared->pool;
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST)) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void free_context(catis_context* context);
+
+/* once its tasks are done, the workers exit and the pool is freed */
+void stop_pool(catis_shared* shared) {
+    catis_pool* pool = shared->pool;
+    if (pool == NULL) {
+        return;
+    }
+    wait_for_tasks(shared);
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        catis_worker* worker = pool->worker + i;
+        pthread_join(worker->thread, NULL);
+        free_context(worker->context);
+        catis_free(worker->task);
+        pthread_mutex_destroy(&worker->lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->idle);
+    catis_free(pool->worker);
+    catis_free(pool);
+    shared->pool = NULL;
+}
+
+/* -- joins -- */
+typedef struct catis_message {
+    catis_object* value;
+    struct catis_message* next;
+} catis_message;
+
+typedef struct catis_mailbox {
+    catis_atom* name;
+    catis_message* incoming; // lock free stack the senders push on
+    // oldest first, only touched by the sender matching messages
+    catis_message* first;
+    catis_message* last;
+} catis_mailbox;
+
+typedef struct catis_join {
+    catis_object* body;
+    int matching; // a sender is matching messages, the others only push
+    size_t count;
+    catis_mailbox mailbox[]; // one per input, in the order they are named
+} catis_join;
+
+void release_join(catis_join* join) {
+    if (join == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < join->count; i++) {
+        catis_message* message = join->mailbox[i].incoming;
+        while (message) {
+            catis_message* next = message->next;
+            release(message->value);
+            catis_free(message);
+            message = next;
+        }
+        message = join->mailbox[i].first;
+        while (message) {
+            catis_message* next = message->next;
+            release(message->value);
+            catis_free(message);
+            message = next;
+        }
+    }
+    release(join->body);
+    catis_free(join);
+}
+
+/* a fired join body, in a fresh frame on the worker's stack */
+void run_join_task(catis_context* context, catis_task* task) {
+    enter_shared(context->shared);
+    context->vm = task->vm;
+    stackframe* root = context->frame;
+    // the body is where its errors are traced from, there is no caller
+    context->frame = new_stackframe(NULL, task->join);
+    context->frame->line = 0;
+    for (size_t i = 0; i < task->count; i++) {
+        stack_push(context, task->value[i]);
+    }
+
+    if (eval(context, task->body)) {
+        output_error(context);
+    }
+    output_flush(&context->output);
+
+    release_stackframe(context->frame);
+    context->frame = root;
+    while (context->stack_length) {
+        release(stack_pop(context));
+    }
+    shrink_stack(context);
+    release(task->body);
+    catis_free(task);
+    leave_shared(context->shared);
+}
+
+/*
+ * Fire the join for every complete set of messages. Only one sender at a
+ * time matches, the others leave their message to it; after letting go
+ * it looks again for messages pushed meanwhile, so none is forgotten.
+ */
+void match_join(catis_context* context, catis_procedure* procedure) {
+    catis_join* join = procedure->join;
+    while (1) {
+        int idle = 0;
+        if (!__atomic_compare_exchange_n(
+            &join->matching, &idle, 1, 0,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED
+        )) {
+            return;
+        }
+
+        for (size_t i = 0; i < join->count; i++) {
+            catis_mailbox* mailbox = join->mailbox + i;
+            catis_message* message = __atomic_exchange_n(
+                &mailbox->incoming, NULL, __ATOMIC_ACQUIRE
+            );
+            // newest first on the stack, reversed to keep the order
+            catis_message* reversed = NULL;
+            while (message) {
+                catis_message* next = message->next;
+                message->next = reversed;
+                reversed = message;
+                message = next;
+            }
+            while (reversed) {
+                catis_message* next = reversed->next;
+                reversed->next = NULL;
+                if (mailbox->last) {
+                    mailbox->last->next = reversed;
+                }
+                else {
+                    mailbox->first = reversed;
+                }
+                mailbox->last = reversed;
+                reversed = next;
+            }
+        }
+
+        while (1) {
+            size_t complete = 0;
+            while (complete < join->count && join->mailbox[complete].first) {
+                complete++;
+            }
+            if (complete < join->count) {
+                break;
+            }
+
+            catis_task* task = catis_allocate(
+                sizeof(*task) + sizeof(catis_object*) * join->count
+            );
+            task->run = run_join_task;
+            task->join = procedure;
+            task->body = join->body;
+            retain(task->body);
+            task->vm = context->vm;
+            task->count = join->count;
+            for (size_t i = 0; i < join->count; i++) {
+                catis_mailbox* mailbox = join->mailbox + i;
+                catis_message* message = mailbox->first;
+                mailbox->first = message->next;
+                if (mailbox->first == NULL) {
+                    mailbox->last = NULL;
+                }
+                task->value[i] = message->value;
+                catis_free(message);
+            }
+            // what was printed before it fired comes first
+            output_flush(&context->output);
+            context->fired = 1;
+            submit_task(context, task);
+        }
+
+        __atomic_store_n(&join->matching, 0, __ATOMIC_SEQ_CST);
+        int more = 0;
+        for (size_t i = 0; i < join->count; i++) {
+            if (__atomic_load_n(&join->mailbox[i].incoming, __ATOMIC_SEQ_CST)) {
+                more = 1;
+            }
+        }
+        if (!more) {
+            return;
+        }
+    }
+}
+
+/* -- memoized procedures -- */
+/*
+ * The results of a pure procedure for the arguments its leading capture
+ * takes, the most recently used CATIS_MEMO_SIZE of them. Entries are
+ * chained in buckets by the hash of their arguments and linked from the
+ * newest to the oldest, the oldest making room once it is full.
+ */
+#define CATIS_MEMO_SIZE 4096 // a power of two
+
+typedef struct catis_memo_entry {
+    unsigned int hash;
+    int next; // in the bucket, -1 ends it
+    int newer; // recency list, -1 ends it
+    int older;
+    size_t result_count;
+    catis_object** value; // the arguments, then the results
+} catis_memo_entry;
+
+typedef struct catis_memo {
+    int reference_count; // the binding, and the calls running the body
+    pthread_mutex_t lock; // taken once threads run
+    size_t arity;
+    catis_procedure body; // unnamed, what runs on a miss
+    int length;
+    int capacity;
+    int newest;
+    int oldest;
+    int bucket[CATIS_MEMO_SIZE];
+    catis_memo_entry* entry; // grown up to CATIS_MEMO_SIZE
+} catis_memo;
+
+void release_memo_entry(catis_memo* memo, catis_memo_entry* entry) {
+    for (size_t i = 0; i < memo->arity + entry->result_count; i++) {
+        release(entry->value[i]);
+    }
+    catis_free(entry->value);
+}
+
+void release_memo(catis_memo* memo) {
+    if (memo == NULL || count_down(&memo->reference_count) != 0) {
+        return;
+    }
+    for (int i = 0; i < memo->length; i++) {
+        release_memo_entry(memo, memo->entry + i);
+    }
+    catis_free(memo->entry);
+    release(memo->body.procedure);
+    release_code(memo->body.code);
+    release_slots(memo->body.slots);
+    pthread_mutex_destroy(&memo->lock);
+    catis_free(memo);
+}
+
+catis_memo* new_memo(catis_procedure* procedure, catis_object* body, size_t arity) {
+    catis_memo* memo = catis_allocate(sizeof(*memo));
+    memo->reference_count = 1;
+    pthread_mutex_init(&memo->lock, NULL);
+    memo->arity = arity;
+    memset(&memo->body, 0, sizeof(memo->body));
+    memo->body.name = procedure->name;
+    memo->body.atom = procedure->atom;
+    memo->body.procedure = body;
+    memo->body.foreign = 1;
+    memo->body.uses_caller_frame = 1;
+    memo->length = 0;
+    memo->capacity = 0;
+    memo->newest = -1;
+    memo->oldest = -1;
+    memset(memo->bucket, -1, sizeof(memo->bucket));
+    memo->entry = NULL;
+    return memo;
+}
+
+void unlink_memo_entry(catis_memo* memo, int index) {
+    catis_memo_entry* entry = memo->entry + index;
+    if (entry->newer == -1) {
+        memo->newest = entry->older;
+    }
+    else {
+        memo->entry[entry->newer].older = entry->older;
+    }
+    if (entry->older == -1) {
+        memo->oldest = entry->newer;
+    }
+    else {
+        memo->entry[entry->older].newer = entry->newer;
+    }
+}
+
+void link_memo_entry(catis_memo* memo, int index) {
+    catis_memo_entry* entry = memo->entry + index;
+    entry->newer = -1;
+    entry->older = memo->newest;
+    if (memo->newest == -1) {
+        memo->oldest = index;
+    }
+    else {
+        memo->entry[memo->newest].newer = index;
+    }
+    memo->newest = index;
+}
+
+/* the entry for the arguments, made the newest, or -1; with the lock held */
+int find_memo_entry(catis_memo* memo, unsigned int hash, catis_object** argument) {
+    int index = memo->bucket[hash & (CATIS_MEMO_SIZE - 1)];
+    while (index != -1) {
+        catis_memo_entry* entry = memo->entry + index;
+        if (entry->hash == hash) {
+            size_t i = 0;
+            while (i < memo->arity && values_equal(entry->value[i], argument[i])) {
+                i++;
+            }
+            if (i == memo->arity) {
+                if (memo->newest != index) {
+                    unlink_memo_entry(memo, index);
+                    link_memo_entry(memo, index);
+                }
+                return index;
+            }
+        }
+        index = entry->next;
+    }
+    return -1;
+}
+
+/* takes the value array, evicting the oldest entry when full; with the lock held */
+void add_memo_entry(
+    catis_memo* memo,
+    unsigned int hash,
+    catis_object** value,
+    size_t result_count
+) {
+    int index;
+    if (memo->length < CATIS_MEMO_SIZE) {
+        if (memo->length == memo->capacity) {
+            memo->capacity = grown_capacity(memo->capacity, memo->length + 1);
+            if (memo->capacity > CATIS_MEMO_SIZE) {
+                memo->capacity = CATIS_MEMO_SIZE;
+            }
+            memo->entry = catis_reallocate(
+                memo->entry,
+                sizeof(catis_memo_entry) * memo->capacity
+            );
+        }
+        index = memo->length++;
+    }
+    else {
+        index = memo->oldest;
+        catis_memo_entry* oldest = memo->entry + index;
+        int* link = memo->bucket + (oldest->hash & (CATIS_MEMO_SIZE - 1));
+        while (*link != index) {
+            link = &memo->entry[*link].next;
+        }
+        *link = oldest->next;
+        unlink_memo_entry(memo, index);
+        release_memo_entry(memo, oldest);
+    }
+    catis_memo_entry* entry = memo->entry + index;
+    entry->hash = hash;
+    entry->result_count = result_count;
+    entry->value = value;
+    int* bucket = memo->bucket + (hash & (CATIS_MEMO_SIZE - 1));
+    entry->next = *bucket;
+    *bucket = index;
+    link_memo_entry(memo, index);
+}
+
+/* -- packed integer vectors -- */
+/*
+ * Element wise kernels go a few ints at a time through GCC vector
+ * extensions: SSE2 or NEON registers where there are some, plain code
+ * elsewhere. The last partial block is padded with ones so that a / never
+ * traps on lanes past the end.
+ */
+typedef int catis_lanes __attribute__((vector_size(16)));
+// + - * go through these, wrapping around as integer_math does
+typedef unsigned int catis_unsigned_lanes __attribute__((vector_size(16)));
+#define CATIS_LANES (sizeof(catis_lanes) / sizeof(int))
+
+enum {
+    LANES_ADD,
+    LANES_SUBTRACT,
+    LANES_MULTIPLY,
+    LANES_DIVIDE,
+    LANES_EQUAL,
+    LANES_NOT_EQUAL,
+    LANES_LESS,
+    LANES_GREATER,
+    LANES_LESS_EQUAL,
+    LANES_GREATER_EQUAL
+};
+
+static inline catis_lanes splat_lanes(int value) {
+    return (catis_lanes){0} + value;
+}
+
+static inline catis_lanes load_lanes(const int* element, size_t count) {
+    catis_lanes lanes = splat_lanes(1);
+    memcpy(&lanes, element, sizeof(int) * count);
+    return lanes;
+}
+
+// lane by lane through unsigned, an overflow wraps around
+#define WRAPPING(x, operator, y) \
+    ((catis_lanes)((catis_unsigned_lanes)(x) operator (catis_unsigned_lanes)(y)))
+
+// one block of x and y, a NULL side is its splat
+#define LANEWISE(expression)                                           \
+    for (size_t i = 0; i < length; i += CATIS_LANES) {                 \
+        size_t count = length - i < CATIS_LANES ? length - i : CATIS_LANES; \
+        catis_lanes x = a ? load_lanes(a + i, count) : a_splat;        \
+        catis_lanes y = b ? load_lanes(b + i, count) : b_splat;        \
+        catis_lanes z = (expression);                                  \
+        memcpy(result + i, &z, sizeof(int) * count);                   \
+    }                                                                  \
+    break
+
+/* result = a operation b, a or b NULL to use its scalar, result may be a or b */
+void lanewise(
+    int operation,
+    int* result,
+    const int* a,
+    int a_scalar,
+    const int* b,
+    int b_scalar,
+    size_t length
+) {
+    catis_lanes a_splat = splat_lanes(a_scalar);
+    catis_lanes b_splat = splat_lanes(b_scalar);
+    // comparisons are -1 in the true lanes, negated to catis 1 and 0
+    switch (operation) {
+        case LANES_ADD:           LANEWISE(WRAPPING(x, +, y));
+        case LANES_SUBTRACT:      LANEWISE(WRAPPING(x, -, y));
+        case LANES_MULTIPLY:      LANEWISE(WRAPPING(x, *, y));
+        case LANES_DIVIDE:        LANEWISE(x / y);
+        case LANES_EQUAL:         LANEWISE(-(x == y));
+        case LANES_NOT_EQUAL:     LANEWISE(-(x != y));
+        case LANES_LESS:          LANEWISE(-(x < y));
+        case LANES_GREATER:       LANEWISE(-(x > y));
+        case LANES_LESS_EQUAL:    LANEWISE(-(x <= y));
+        case LANES_GREATER_EQUAL: LANEWISE(-(x >= y));
+    }
+}
+#undef LANEWISE
+
+/* why a / b, of ints or vectors, would trap in some lane, NULL if not */
+const char* division_error(catis_object* a, catis_object* b) {
+    int a_vector = object_type(a) == CATIS_TYPE_VECTOR;
+    int b_vector = object_type(b) == CATIS_TYPE_VECTOR;
+    size_t length =
+        a_vector ? a->vector.length :
+        b_vector ? b->vector.length :
+        1;
+    for (size_t i = 0; i < length; i++) {
+        int x = a_vector ? a->vector.element[i] : object_integer(a);
+        int y = b_vector ? b->vector.element[i] : object_integer(b);
+        if (y == 0) {
+            return "Division by zero";
+        }
+        if (x == INT_MIN && y == -1) {
+            return "Division overflow";
+        }
+    }
+    return NULL;
+}
+
+/* (a b -- c) for an int or vector a and b, at least one a vector */
+int vector_lanewise(catis_context* context, int operation) {
+    catis_object* b = stack_pop(context);
+    catis_object* a = stack_pop(context);
+    int a_vector = object_type(a) == CATIS_TYPE_VECTOR;
+    int b_vector = object_type(b) == CATIS_TYPE_VECTOR;
+    if (a_vector && b_vector && a->vector.length != b->vector.length) {
+        stack_push(context, a);
+        stack_push(context, b);
+        set_error(context, NULL, "Vectors of different lengths");
+        return 1;
+    }
+
+    if (operation == LANES_DIVIDE) {
+        const char* error = division_error(a, b);
+        if (error) {
+            stack_push(context, a);
+            stack_push(context, b);
+            set_error(context, NULL, error);
+            return 1;
+        }
+    }
+
+    // written over an operand nobody else sees
+    catis_object* result;
+    if (a_vector && count_of(&a->reference_count) == 1) {
+        result = a;
+        retain(result);
+    }
+    else if (b_vector && count_of(&b->reference_count) == 1) {
+        result = b;
+        retain(result);
+    }
+    else {
+        result = new_vector(a_vector ? a->vector.length : b->vector.length);
+        result->vector.length = result->vector.capacity;
+    }
+    lanewise(
+        operation,
+        result->vector.element,
+        a_vector ? a->vector.element : NULL,
+        a_vector ? 0 : object_integer(a),
+        b_vector ? b->vector.element : NULL,
+        b_vector ? 0 : object_integer(b),
+        result->vector.length
+    );
+    release(a);
+    release(b);
+    stack_push(context, result);
+    return 0;
+}
+
+int library_vector_compare(catis_context* context) {
+    // (a b -- vector) 1 where the comparison holds, 0 elsewhere
+    if (check_stack_type(
+        context,
+        2,
+        CATIS_TYPE_INT | CATIS_TYPE_VECTOR,
+        CATIS_TYPE_INT | CATIS_TYPE_VECTOR
+    )) {
+        return 1;
+    }
+    if (
+        object_type(stack_peek(context, 0)) != CATIS_TYPE_VECTOR &&
+        object_type(stack_peek(context, 1)) != CATIS_TYPE_VECTOR
+    ) {
+        set_error(context, NULL, "Vector comparisons need a vector");
+        return 1;
+    }
+
+    const char* name = context->frame->procedure->name + 1;
+    int operation;
+    if (name[1] == '=') {
+        switch (name[0]) {
+            case '=': operation = LANES_EQUAL; break;
+            case '!': operation = LANES_NOT_EQUAL; break;
+            case '<': operation = LANES_LESS_EQUAL; break;
+            default:  operation = LANES_GREATER_EQUAL; break;
+        }
+    }
+    else {
+        operation = name[0] == '<' ? LANES_LESS : LANES_GREATER;
+    }
+    return vector_lanewise(context, operation);
+}
+
+int library_vector_reduce(catis_context* context) {
+    // vsum, vmin and vmax (vector -- int), #f for the min or max of nothing
+    if (check_stack_type(context, 1, CATIS_TYPE_VECTOR)) { return 1; }
+    catis_object* vector = stack_pop(context);
+    const char* name = context->frame->procedure->name;
+    int kind = name[2];
+    size_t length = vector->vector.length;
+    const int* element = vector->vector.element;
+
+    if (kind != 'u' && length == 0) {
+        release(vector);
+        stack_push(context, new_boolean(0));
+        return 0;
+    }
+    catis_lanes total = splat_lanes(kind == 'u' ? 0 : element[0]);
+    size_t i = 0;
+    for (; i + CATIS_LANES <= length; i += CATIS_LANES) {
+        catis_lanes lanes = load_lanes(element + i, CATIS_LANES);
+        catis_lanes keep = kind == 'i' ? total < lanes : total > lanes;
+        total = kind == 'u' ? WRAPPING(total, +, lanes) : (total & keep) | (lanes & ~keep);
+    }
+    int result = total[0];
+    for (size_t lane = 1; lane < CATIS_LANES; lane++) {
+        result =
+            kind == 'u' ? integer_math('+', result, total[lane]) :
+            kind == 'i' ? (total[lane] < result ? total[lane] : result) :
+            (total[lane] > result ? total[lane] : result);
+    }
+    for (; i < length; i++) {
+        result =
+            kind == 'u' ? integer_math('+', result, element[i]) :
+            kind == 'i' ? (element[i] < result ? element[i] : result) :
+            (element[i] > result ? element[i] : result);
+    }
+    release(vector);
+    stack_push(context, new_integer(result));
+    return 0;
+}
+
+int library_vector_shift(catis_context* context) {
+    // (vector n -- vector') elements move n places up, 0 comes in
+    if (check_stack_type(context, 2, CATIS_TYPE_VECTOR, CATIS_TYPE_INT)) { return 1; }
+    int shift = object_integer(stack_pop(context));
+    catis_object* vector = get_unshared_object(stack_pop(context));
+    size_t length = vector->vector.length;
+    int* element = vector->vector.element;
+    size_t distance = shift < 0 ? -(size_t)shift : (size_t)shift;
+    if (distance >= length) {
+        memset(element, 0, sizeof(int) * length);
+    }
+    else if (shift > 0) {
+        memmove(element + distance, element, sizeof(int) * (length - distance));
+        memset(element, 0, sizeof(int) * distance);
+    }
+    else if (shift < 0) {
+        memmove(element, element + distance, sizeof(int) * (length - distance));
+        memset(element + length - distance, 0, sizeof(int) * distance);
+    }
+    stack_push(context, vector);
+    return 0;
+}
+
+int library_vector_pick(catis_context* context) {
+    // (table indices -- vector) the element of table at every index
+    if (check_stack_type(context, 2, CATIS_TYPE_VECTOR, CATIS_TYPE_VECTOR)) { return 1; }
+    catis_object* table = stack_peek(context, 1);
+    catis_object* indices = stack_peek(context, 0);
+    size_t length = table->vector.length;
+    for (size_t i = 0; i < indices->vector.length; i++) {
+        if ((unsigned)indices->vector.element[i] >= length) {
+            set_error(context, NULL, "Index out of the table in vpick");
+            return 1;
+        }
+    }
+    stack_pop(context);
+    stack_pop(context);
+    indices = get_unshared_object(indices);
+    for (size_t i = 0; i < indices->vector.length; i++) {
+        indices->vector.element[i] = table->vector.element[indices->vector.element[i]];
+    }
+    release(table);
+    stack_push(context, indices);
+    return 0;
+}
+
+int library_to_vector(catis_context* context) {
+    // (list -- vector) of integers only
+    if (check_stack_type(
+        context,
+        1,
+        CATIS_TYPE_LIST | CATIS_TYPE_TUPLE | CATIS_TYPE_VECTOR | CATIS_TYPE_RANGE
+    )) {
+        return 1;
+    }
+    catis_object* list = stack_peek(context, 0);
+    if (list->type == CATIS_TYPE_VECTOR) {
+        return 0;
+    }
+    if (list->type == CATIS_TYPE_RANGE) {
+        catis_object* vector = new_vector(range_length(list));
+        for (int i = list->range.start; i < list->range.end; i++) {
+            vector->vector.element[vector->vector.length++] = i;
+        }
+        release(stack_pop(context));
+        stack_push(context, vector);
+        return 0;
+    }
+    for (size_t i = 0; i < list->collection.length; i++) {
+        if (object_type(list->collection.element[i]) != CATIS_TYPE_INT) {
+            set_error(context, NULL, "Vectors can only contain integers");
+            return 1;
+        }
+    }
+    stack_pop(context);
+    catis_object* vector = new_vector(list->collection.length);
+    for (size_t i = 0; i < list->collection.length; i++) {
+        vector->vector.element[vector->vector.length++] =
+            object_integer(list->collection.element[i]);
+    }
+    release(list);
+    stack_push(context, vector);
+    return 0;
+}
+
+int library_to_list(catis_context* context) {
+    // (vector -- list)
+    if (check_stack_type(context, 1, CATIS_TYPE_VECTOR)) { return 1; }
+    catis_object* vector = stack_pop(context);
+    catis_object* list = new_list(vector->vector.length);
+    for (size_t i = 0; i < vector->vector.length; i++) {
+        list->collection.element[list->collection.length++] =
+            new_integer(vector->vector.element[i]);
+    }
+    release(vector);
+    stack_push(context, list);
+    return 0;
+}
+
+/* -- the library -- */
+size_t sequence_length(catis_object* object) {
+    switch (object->type) {
+        case CATIS_TYPE_STRING: return object->string_or_symbol.length;
+        case CATIS_TYPE_VECTOR: return object->vector.length;
+        case CATIS_TYPE_RANGE:  return range_length(object);
+        default:                return object->collection.length;
+    }
+}
+
+/*
+ * new reference to an element, one character strings for strings and
+ * ints for vectors and ranges
+ */
+catis_object* sequence_element(catis_object* object, size_t index) {
+    switch (object->type) {
+        case CATIS_TYPE_STRING:
+            return new_character(object->string_or_symbol.pointer[index]);
+        case CATIS_TYPE_VECTOR:
+            return new_integer(object->vector.element[index]);
+        case CATIS_TYPE_RANGE:
+            return new_integer(object->range.start + (int)index);
+        default:
+            retain(object->collection.element[index]);
+            return object->collection.element[index];
+    }
+}
+
+int library_math(catis_context* context) {
+    if (check_stack_type(
+        context,
+        2,
+        CATIS_TYPE_INT | CATIS_TYPE_VECTOR,
+        CATIS_TYPE_INT | CATIS_TYPE_VECTOR
+    )) {
+        return 1;
+    }
+    if (
+        object_type(stack_peek(context, 0)) == CATIS_TYPE_VECTOR ||
+        object_type(stack_peek(context, 1)) == CATIS_TYPE_VECTOR
+    ) {
+        // element wise, an int goes with every element
+        switch (context->frame->procedure->name[0]) {
+            case '+': return vector_lanewise(context, LANES_ADD);
+            case '-': return vector_lanewise(context, LANES_SUBTRACT);
+            case '*': return vector_lanewise(context, LANES_MULTIPLY);
+            default:  return vector_lanewise(context, LANES_DIVIDE);
+        }
+    }
+    const char* function_name = context->frame->procedure->name;
+    if (function_name[0] == '/') {
+        const char* error = division_error(
+            stack_peek(context, 1),
+            stack_peek(context, 0)
+        );
+        if (error) {
+            set_error(context, NULL, error);
+            return 1;
+        }
+    }
+    catis_object* object_b = stack_pop(context);
+    catis_object* object_a = stack_pop(context);
+
+    int b = object_integer(object_b);
+    int a = object_integer(object_a);
+
+    int result;
+    if (function_name[0] == '/') {
+        result = a / b;
+    }
+    else {
+        result = integer_math(function_name[0], a, b);
+    }
+
+    stack_push(context, new_integer(result));
+    release(object_b);
+    release(object_a);
+    return 0;
+}
+
+int library_compare(catis_context* context) {
+    if (check_stack_length(context, 2)) { return 1; }
+    catis_object* b = stack_pop(context);
+    catis_object* a = stack_pop(context);
+
+    int comparison = compare(a, b);
+    if (comparison == COMPARE_TYPE_MISMATCH) {
+        stack_push(context, a);
+        stack_push(context, b);
+        set_error(context, NULL, "Type mismatch in comparison");
+        return 1;
+    }
+
+    int result;
+    const char* function_name = context->frame->procedure->name;
+    if (function_name[1] == '=') {
+        switch (function_name[0]) {
+            case '=': result = comparison == 0; break;
+            case '!': result = comparison != 0; break;
+            case '<': result = comparison <= 0; break;
+            case '>': result = comparison >= 0; break;
+        }
+    }
+    else {
+        switch (function_name[0]) {
+            case '<': result = comparison < 0; break;
+            case '>': result = comparison > 0; break;
+        }
+    }
+    stack_push(context, new_boolean(result));
+    release(a);
+    release(b);
+    return 0;
+}
+
+int library_logic(catis_context* context) {
+    if (check_stack_type(context, 2, CATIS_TYPE_BOOL, CATIS_TYPE_BOOL)) { return 1; }
+    catis_object* object_b = stack_pop(context);
+    catis_object* object_a = stack_pop(context);
+
+    int b = object_boolean(object_b);
+    int a = object_boolean(object_a);
+
+    int result;
+    const char* function_name = context->frame->procedure->name;
+    if (function_name[0] == '&' && function_name[1] == 0) {
+        result = a && b;
+    }
+    else if (function_name[0] == '|' && function_name[1] == 0) {
+        result = a || b;
+    }
+
+    stack_push(context, new_boolean(result));
+    release(object_b);
+    release(object_a);
+    return 0;
+}
+
+int library_sort(catis_context* context) {
+    if (check_stack_type(context, 1, CATIS_TYPE_LIST | CATIS_TYPE_VECTOR)) { return 1; }
+    catis_object* list = stack_pop(context);
+    list = get_unshared_object(list);
+    if (list->type == CATIS_TYPE_VECTOR) {
+        sort_integers(list->vector.element, list->vector.length);
+        stack_push(context, list);
+        return 0;
+    }
+
+    // lists of one kind skip the type dispatch of compare
+    size_t length = list->collection.length;
+    catis_object** element = list->collection.element;
+    if (length < 2) {
+        stack_push(context, list);
+        return 0;
+    }
+    int types = 0;
+    for (size_t i = 0; i < length; i++) {
+        types |= object_type(element[i]);
+    }
+    if (types == CATIS_TYPE_INT && length >= CATIS_RADIX_MINIMUM) {
+        // ints are immediates, sorting their values is sorting them
+        int* integers = catis_allocate(sizeof(int) * length);
+        for (size_t i = 0; i < length; i++) {
+            integers[i] = object_integer(element[i]);
+        }
+        sort_integers(integers, length);
+        for (size_t i = 0; i < length; i++) {
+            element[i] = new_integer(integers[i]);
+        }
+        catis_free(integers);
+    }
+    else if (types && !(types & ~(CATIS_TYPE_STRING | CATIS_TYPE_SYMBOL))) {
+        qsort(element, length, sizeof(catis_object*), quicksort_string_comparison);
+    }
+    else {
+        qsort(element, length, sizeof(catis_object*), quicksort_object_comparison);
+    }
+    stack_push(context, list);
+    return 0;
+}
+
+int library_define(catis_context* context) {
+    if (check_stack_type(context, 2, CATIS_TYPE_LIST, CATIS_TYPE_SYMBOL)) { return 1; }
+    catis_object* symbol = stack_pop(context);
+    catis_object* program = stack_pop(context);
+
+    // a body that can only fail is reported now rather than on its call
+    catis_code* code = compile(context, program);
+    size_t mistyped = code->mistyped;
+    int line = mistyped ? code->instruction[mistyped - 1].line : 0;
+    release_code(code);
+    if (mistyped) {
+        stack_push(context, program);
+        stack_push(context, symbol);
+        context->frame->line = line;
+        set_error(
+            context,
+            symbol->string_or_symbol.pointer,
+            "Type mismatch in definition"
+        );
+        return 1;
+    }
+
+    add_procedure(context, symbol->string_or_symbol.pointer, NULL, program);
+    if (context->vm) {
+        prepare_code(
+            context,
+            lookup_atom_procedure(context, symbol->string_or_symbol.atom)
+        );
+    }
+    release(symbol);
+    return 0;
+}
+
+int library_if(catis_context* context) {
+    int is_while = context->frame->procedure->name[0] == 'w';
+    int is_else  = context->frame->procedure->name[2] == '-';
+    int return_value = 1;
+    if (is_else) {
+        if (check_stack_type(
+            context,
+            3,
+            CATIS_TYPE_LIST,
+            CATIS_TYPE_LIST,
+            CATIS_TYPE_LIST
+        )) {
+            return 1;
+        }
+    }
+    else {
+        if (check_stack_type(context, 2, CATIS_TYPE_LIST, CATIS_TYPE_LIST)) { return 1; }
+    }
+
+    catis_object* else_branch;
+    catis_object* if_branch;
+    catis_object* condition;
+    else_branch = is_else ? stack_pop(context) : NULL;
+    if_branch   = stack_pop(context);
+    condition   = stack_pop(context);
+
+    while (1) {
+        if (eval(context, condition)) {
+            goto return_error;
+        }
+        if (check_stack_type(context, 1, CATIS_TYPE_BOOL)) { goto return_error; }
+        catis_object* conditional_result = stack_pop(context);
+        int result = object_boolean(conditional_result);
+        release(conditional_result);
+
+        if (result) {
+            if (eval(context, if_branch)) {
+                goto return_error;
+            }
+            if (is_while) {
+                continue;
+            }
+        }
+        else if (is_else) {
+            if (eval(context, else_branch)) {
+                goto return_error;
+            }
+        }
+        break;
+    }
+    return_value = 0;
+
+return_error:
+    release(condition);
+    release(if_branch);
+    release(else_branch);
+    return return_value;
+}
+
+int library_eval(catis_context* context) {
+    if (check_stack_type(context, 1, CATIS_TYPE_LIST)) { return 1; }
+    catis_object* list = stack_pop(context);
+    int return_value = eval(context, list);
+    release(list);
+    return return_value;
+}
+
+int library_up_eval(catis_context* context) {
+    if (check_stack_type(context, 1, CATIS_TYPE_LIST)) { return 1; }
+    catis_object* list = stack_pop(context);
+    stackframe* saved = NULL;
+    if (context->frame->previous) {
+        saved = context->frame;
+        context->frame = context->frame->previous;
+    }
+    int return_value = eval(context, list);
+    if (saved) {
+        context->frame = saved;
+    }
+    release(list);
+    return return_value;
+}
+
+int library_print(catis_context* context) {
+    if (check_stack_length(context, 1)) { return 1; }
+    catis_object* object = stack_pop(context);
+    print_object(&context->output, object, PRINT_RAW);
+    release(object);
+    return 0;
+}
+
+int library_println(catis_context* context) {
+    if (check_stack_length(context, 1)) { return 1; }
+    library_print(context);
+    output_char(&context->output, '\n');
+    output_line_end(&context->output);
+    return 0;
+}
+
+int library_flush(catis_context* context) {
+    output_flush(&context->output);
+    return 0;
+}
+
+int library_length(catis_context* context) {
+    if (check_stack_type(
+        context,
+        1,
+        CATIS_TYPE_LIST   |
+        CATIS_TYPE_TUPLE  |
+        CATIS_TYPE_STRING |
+        CATIS_TYPE_SYMBOL |
+        CATIS_TYPE_VECTOR |
+        CATIS_TYPE_DICT   |
+        CATIS_TYPE_RANGE
+    )) {
+        return 1;
+    }
+    catis_object* object = stack_pop(context);
+    int length;
+    switch (object->type) {
+        case CATIS_TYPE_RANGE:
+            length = range_length(object);
+            break;
+        case CATIS_TYPE_DICT:
+            length = object->dict.length;
+            break;
+        case CATIS_TYPE_LIST:
+        case CATIS_TYPE_TUPLE:
+            length = object->collection.length;
+            break;
+        case CATIS_TYPE_VECTOR:
+            length = object->vector.length;
+            break;
+        case CATIS_TYPE_STRING:
+        case CATIS_TYPE_SYMBOL:
+            length = object->string_or_symbol.length;
+            break;
+    }
+    release(object);
+    stack_push(context, new_integer(length));
+    return 0;
+}
+
+int library_list_append(catis_context* context) {
+    // (list element -- list')
+    if (check_stack_type(
+        context,
+        2,
+        CATIS_TYPE_LIST | CATIS_TYPE_VECTOR,
+        CATIS_TYPE_ANY
+    )) {
+        return 1;
+    }
+    if (object_type(stack_peek(context, 1)) == CATIS_TYPE_VECTOR) {
+        if (object_type(stack_peek(context, 0)) != CATIS_TYPE_INT) {
+            set_error(context, NULL, "Vectors can only contain integers");
+            return 1;
+        }
+        int integer = object_integer(stack_pop(context));
+        catis_object* vector = get_unshared_object(stack_pop(context));
+        reserve_integers(vector, vector->vector.length + 1);
+        vector->vector.element[vector->vector.length++] = integer;
+        stack_push(context, vector);
+        return 0;
+    }
+    catis_object* element = stack_pop(context);
+    catis_object* list = get_unshared_object(stack_pop(context));
+    reserve_elements(list, list->collection.length + 1);
+    list->collection.element[list->collection.length] = element;
+    list->collection.length++;
+    stack_push(context, list);
+    return 0;
+}
+
+int library_at(catis_context* context) {
+    // (list index -- element)
+    if (check_stack_type(
+        context,
+        2, 
+        CATIS_TYPE_LIST | CATIS_TYPE_TUPLE | CATIS_TYPE_STRING |
+        CATIS_TYPE_VECTOR | CATIS_TYPE_RANGE,
+        CATIS_TYPE_INT
+    )) {
+        return 1;
+    }
+    catis_object* index_object = stack_pop(context);
+    catis_object* object = stack_pop(context);
+
+    int index = object_integer(index_object);
+    release(index_object);
+
+    size_t length = sequence_length(object);
+    if (index < 0) {
+        index = length + index;
+    }
+    if (index < 0 || (size_t)index >= length) {
+        stack_push(context, new_boolean(0));
+    }
+    else {
+        stack_push(context, sequence_element(object, index));
+    }
+    release(object);
+    return 0;
+}
+
+/*
+ * Append to a string somebody else holds too, without copying it. The
+ * bytes of a buffer past what is used are free: when the string ends where
+ * its buffer's use does the source goes right after it, and the result is
+ * a longer slice of the same buffer while the others keep their length.
+ * A buffer with slices is never reallocated, NULL when it is out of room
+ * or already extended past this string. Strings only their holder sees
+ * are appended to in place anyway.
+ */
+catis_object* extend_string(catis_object* string, catis_object* source) {
+    if (
+        string->string_or_symbol.parent == NULL &&
+        count_of(&string->reference_count) == 1
+    ) {
+        return NULL;
+    }
+    catis_object* owner = string->string_or_symbol.parent ?
+        string->string_or_symbol.parent : string;
+    size_t start = string->string_or_symbol.pointer - owner->string_or_symbol.pointer;
+    size_t end = start + string->string_or_symbol.length;
+    size_t length = source->string_or_symbol.length;
+    if (end + length + 1 > owner->string_or_symbol.capacity) {
+        return NULL;
+    }
+    // claim the bytes, another thread may be extending the same buffer
+    if (multithreaded) {
+        if (!__atomic_compare_exchange_n(
+            &owner->string_or_symbol.used, &end, end + length,
+            0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED
+        )) {
+            return NULL;
+        }
+    }
+    else if (owner->string_or_symbol.used == end) {
+        owner->string_or_symbol.used = end + length;
+    }
+    else {
+        return NULL;
+    }
+    memcpy(
+        owner->string_or_symbol.pointer + end,
+        source->string_or_symbol.pointer,
+        length
+    );
+    return new_slice(string, 0, string->string_or_symbol.length + length);
+}
+
+int library_concatenate(catis_context* context) {
+    if (check_stack_type(context, 2, CATIS_TYPE_ANY & ~CATIS_TYPE_RANGE, CATIS_TYPE_ANY & ~CATIS_TYPE_RANGE)) {
+        return 1;
+    }
+    if (object_type(context->stack[context->stack_length - 1]) !=
+        object_type(context->stack[context->stack_length - 2])
+    ) {
+        set_error(
+            context,
+            NULL,
+            "concatenate expects two objects of the same type"
+        );
+        return 1;
+    }
+    if (check_stack_type(
+        context,
+        2,
+        CATIS_TYPE_LIST | CATIS_TYPE_TUPLE | CATIS_TYPE_VECTOR |
+        CATIS_TYPE_STRING | CATIS_TYPE_SYMBOL,
+        CATIS_TYPE_LIST | CATIS_TYPE_TUPLE | CATIS_TYPE_VECTOR |
+        CATIS_TYPE_STRING | CATIS_TYPE_SYMBOL
+    )) {
+        return 1;
+    }
+
+    catis_object* source = stack_pop(context);
+    catis_object* destination = stack_peek(context, 0);
+    if (destination->type == CATIS_TYPE_STRING) {
+        catis_object* extended = extend_string(destination, source);
+        if (extended) {
+            stack_set(context, 0, extended);
+            release(destination);
+            release(source);
+            return 0;
+        }
+    }
+    destination = get_unshared_object(destination);
+    stack_set(context, 0, destination);
+
+    if (source->type & (CATIS_TYPE_STRING | CATIS_TYPE_SYMBOL)) {
+        reserve_characters(
+            destination,
+            destination->string_or_symbol.length +
+            source->string_or_symbol.length
+        );
+        memcpy(
+            destination->string_or_symbol.pointer +
+            destination->string_or_symbol.length,
+            source->string_or_symbol.pointer,
+            source->string_or_symbol.length
+        );
+        destination->string_or_symbol.length +=
+            source->string_or_symbol.length;
+        destination->string_or_symbol.pointer[
+            destination->string_or_symbol.length
+        ] = 0;
+        if (destination->type == CATIS_TYPE_STRING) {
+            destination->string_or_symbol.used =
+                destination->string_or_symbol.length;
+        }
+        else {
+            destination->string_or_symbol.atom = intern(
+                destination->string_or_symbol.pointer,
+                destination->string_or_symbol.length
+            );
+            destination->string_or_symbol.cached_procedure = NULL;
+            destination->string_or_symbol.last_use_generation = 0;
+            destination->string_or_symbol.library = 0;
+        }
+    }
+    else if (source->type == CATIS_TYPE_VECTOR) {
+        reserve_integers(
+            destination,
+            destination->vector.length + source->vector.length
+        );
+        memcpy(
+            destination->vector.element + destination->vector.length,
+            source->vector.element,
+            source->vector.length * sizeof(int)
+        );
+        destination->vector.length += source->vector.length;
+    }
+    else {
+        for (size_t i = 0; i < source->collection.length; i++) {
+            retain(source->collection.element[i]);
+        }
+        reserve_elements(
+            destination,
+            destination->collection.length + source->collection.length
+        );
+        memcpy(
+            destination->collection.element +
+            destination->collection.length,
+            source->collection.element,
+            source->collection.length * sizeof(catis_object*)
+        );
+        destination->collection.length += source->collection.length;
+    }
+    release(source);
+    return 0;
+}
+
+int library_to_tuple(catis_context* context) {
+    if (check_stack_type(context, 1, CATIS_TYPE_LIST)) { return 1; }
+    catis_object* list = stack_pop(context);
+    list = get_unshared_object(list);
+    set_type(list, CATIS_TYPE_TUPLE);
+    stack_push(context, list);
+    return 0;
+}
+
+/* -- native list procedures -- */
+
+int library_map(catis_context* context) {
+    // (list f -- list')
+    if (check_stack_type(
+        context,
+        2,
+        CATIS_TYPE_LIST | CATIS_TYPE_TUPLE | CATIS_TYPE_STRING |
+        CATIS_TYPE_VECTOR | CATIS_TYPE_RANGE,
+        CATIS_TYPE_LIST
+    )) {
+        return 1;
+    }
+    catis_object* function = stack_pop(context);
+    catis_object* list = stack_pop(context);
+    size_t length = sequence_length(list);
+    catis_object* result = new_list(length);
+
+    int error = 0;
+    for (size_t i = 0; i < length; i++) {
+        stack_push(context, sequence_element(list, i));
+        error = eval(context, function) || check_stack_length(context, 1);
+        if (error) {
+            break;
+        }
+        result->collection.element[result->collection.length++] =
+            stack_pop(context);
+    }
+
+    release(function);
+    release(list);
+    if (error) {
+        release(result);
+        return error;
+    }
+    stack_push(context, result);
+    return 0;
+}
+
+int library_each(catis_context* context) {
+    // (list f -- ...)
+    if (check_stack_type(
+        context,
+        2,
+        CATIS_TYPE_LIST | CATIS_TYPE_TUPLE | CATIS_TYPE_STRING |
+        CATIS_TYPE_VECTOR | CATIS_TYPE_RANGE,
+        CATIS_TYPE_LIST
+    )) {
+        return 1;
+    }
+    catis_object* function = stack_pop(context);
+    catis_object* list = stack_pop(context);
+    size_t length = sequence_length(list);
+
+    int error = 0;
+    for (size_t i = 0; i < length && !error; i++) {
+        stack_push(context, sequence_element(list, i));
+        error = eval(context, function);
+    }
+
+    release(function);
+    release(list);
+    return error;
+}
+
+int library_range(catis_context* context) {
+    // (start end -- list) lazy, a list once something needs one
+    if (check_stack_type(context, 2, CATIS_TYPE_INT, CATIS_TYPE_INT)) { return 1; }
+    int end = object_integer(stack_pop(context));
+    int start = object_integer(stack_pop(context));
+    stack_push(context, new_range(start, end));
+    return 0;
+}
+
+int library_tail(catis_context* context) {
+    // (list -- list') all but the first element, a list but for vectors and ranges
+    if (check_stack_type(
+        context,
+        1,
+        CATIS_TYPE_LIST | CATIS_TYPE_TUPLE | CATIS_TYPE_STRING |
+        CATIS_TYPE_VECTOR | CATIS_TYPE_RANGE
+    )) {
+        return 1;
+    }
+    catis_object* list = stack_pop(context);
+    size_t length = sequence_length(list);
+
+    if (list->type == CATIS_TYPE_RANGE) {
+        list = get_unshared_object(list);
+        if (length > 0) {
+            list->range.start++;
+        }
+        stack_push(context, list);
+        return 0;
+    }
+
+    if (list->type == CATIS_TYPE_VECTOR) {
+        // stays packed
+        list = get_unshared_object(list);
+        if (length > 0) {
+            memmove(
+                list->vector.element,
+                list->vector.element + 1,
+                sizeof(int) * (length - 1)
+            );
+            list->vector.length--;
+        }
+        stack_push(context, list);
+        return 0;
+    }
+
+    if (
+        list->type != CATIS_TYPE_STRING &&
+        count_of(&list->reference_count) == 1
+    ) {
+        // nobody else sees it, drop the head in place
+        if (length > 0) {
+            release(list->collection.element[0]);
+            memmove(
+                list->collection.element,
+                list->collection.element + 1,
+                sizeof(catis_object*) * (length - 1)
+            );
+            list->collection.length--;
+        }
+        set_type(list, CATIS_TYPE_LIST);
+        stack_push(context, list);
+        return 0;
+    }
+
+    catis_object* result = new_list(length > 0 ? length - 1 : 0);
+    for (size_t i = 1; i < length; i++) {
+        result->collection.element[result->collection.length++] =
+            sequence_element(list, i);
+    }
+    release(list);
+    stack_push(context, result);
+    return 0;
+}
+
+int library_slice(catis_context* context) {
+    // (list start end -- list') negative from the end like @, strings share the characters
+    if (check_stack_type(
+        context,
+        3,
+        CATIS_TYPE_LIST | CATIS_TYPE_TUPLE | CATIS_TYPE_STRING |
+        CATIS_TYPE_VECTOR | CATIS_TYPE_RANGE,
+        CATIS_TYPE_INT,
+        CATIS_TYPE_INT
+    )) {
+        return 1;
+    }
+    int end = object_integer(stack_pop(context));
+    int start = object_integer(stack_pop(context));
+    catis_object* list = stack_pop(context);
+    int length = (int)sequence_length(list);
+
+    if (start < 0) start += length;
+    if (end < 0) end += length;
+    if (start < 0) start = 0;
+    if (start > length) start = length;
+    if (end > length) end = length;
+    if (end < start) end = start;
+
+    catis_object* result;
+    switch (list->type) {
+        case CATIS_TYPE_STRING:
+            if (end - start == 1) {
+                result = new_character(list->string_or_symbol.pointer[start]);
+            }
+            else {
+                result = new_slice(list, start, end - start);
+            }
+            break;
+        case CATIS_TYPE_RANGE:
+            result = new_range(list->range.start + start, list->range.start + end);
+            break;
+        case CATIS_TYPE_VECTOR:
+            result = new_vector(end - start);
+            if (end > start) {
+                memcpy(
+                    result->vector.element,
+                    list->vector.element + start,
+                    sizeof(int) * (end - start)
+                );
+            }
+            result->vector.length = end - start;
+            break;
+        default:
+            result = new_list(end - start);
+            for (int i = start; i < end; i++) {
+                result->collection.element[result->collection.length++] =
+                    sequence_element(list, i);
+            }
+            set_type(result, list->type);
+            break;
+    }
+    release(list);
+    stack_push(context, result);
+    return 0;
+}
+
+typedef struct catis_sort_record {
+    catis_object* key;
+    catis_object* element;
+    size_t index; // ties keep the order of the list
+} catis_sort_record;
+
+/*
+ * Keys of sort-by: sequences element by element, the shorter first when
+ * one starts the other, and objects of different types grouped by type.
+ */
+int compare_sort_keys(catis_object* a, catis_object* b) {
+    int sequence =
+        CATIS_TYPE_LIST | CATIS_TYPE_TUPLE | CATIS_TYPE_VECTOR | CATIS_TYPE_RANGE;
+    int a_type = object_type(a);
+    int b_type = object_type(b);
+    if ((a_type & sequence) && (b_type & sequence)) {
+        size_t a_length = sequence_length(a);
+        size_t b_length = sequence_length(b);
+        for (size_t i = 0; i < a_length && i < b_length; i++) {
+            catis_object* a_element = sequence_element(a, i);
+            catis_object* b_element = sequence_element(b, i);
+            int comparison = compare_sort_keys(a_element, b_element);
+            release(a_element);
+            release(b_element);
+            if (comparison) {
+                return comparison;
+            }
+        }
+        return (a_length > b_length) - (a_length < b_length);
+    }
+    int comparison = compare(a, b);
+    if (comparison == COMPARE_TYPE_MISMATCH) {
+        return (a_type > b_type) - (a_type < b_type);
+    }
+    return comparison;
+}
+
+int quicksort_record_comparison(const void* a, const void* b) {
+    const catis_sort_record* record_a = a;
+    const catis_sort_record* record_b = b;
+    int comparison = compare_sort_keys(record_a->key, record_b->key);
+    if (comparison) {
+        return comparison;
+    }
+    return (record_a->index > record_b->index) - (record_a->index < record_b->index);
+}
+
+int library_sort_by(catis_context* context) {
+    // (list f -- list') stable, f leaves the key of an element, once each
+    if (check_stack_type(
+        context,
+        2,
+        CATIS_TYPE_LIST | CATIS_TYPE_TUPLE | CATIS_TYPE_STRING |
+        CATIS_TYPE_VECTOR | CATIS_TYPE_RANGE,
+        CATIS_TYPE_LIST
+    )) {
+        return 1;
+    }
+    catis_object* function = stack_pop(context);
+    catis_object* list = stack_pop(context);
+    size_t length = sequence_length(list);
+    catis_sort_record* records = catis_allocate(sizeof(catis_sort_record) * (length + 1));
+
+    size_t decorated = 0;
+    int types = 0;
+    int error = 0;
+    size_t base = context->stack_length;
+    for (; decorated < length; decorated++) {
+        catis_object* element = sequence_element(list, decorated);
+        stack_push(context, element);
+        retain(element);
+        error = eval(context, function);
+        if (!error && context->stack_length != base + 1) {
+            set_error(context, NULL, "The function must leave one value");
+            error = 1;
+        }
+        if (error) {
+            release(element);
+            break;
+        }
+        catis_sort_record* record = records + decorated;
+        record->key = stack_pop(context);
+        record->element = element;
+        record->index = decorated;
+        types |= object_type(record->key);
+    }
+
+    catis_object* result = NULL;
+    if (!error) {
+        result = new_list(length);
+        result->collection.length = length;
+        if (types == CATIS_TYPE_INT && length >= CATIS_RADIX_MINIMUM) {
+            uint32_t* keys = catis_allocate(sizeof(uint32_t) * length);
+            for (size_t i = 0; i < length; i++) {
+                keys[i] = radix_key(object_integer(records[i].key));
+                result->collection.element[i] = records[i].element;
+            }
+            radix_sort(keys, result->collection.element, length);
+            catis_free(keys);
+        }
+        else {
+            qsort(records, length, sizeof(catis_sort_record), quicksort_record_comparison);
+            for (size_t i = 0; i < length; i++) {
+                result->collection.element[i] = records[i].element;
+                release(records[i].key);
+            }
+        }
+    }
+    else {
+        for (size_t i = 0; i < decorated; i++) {
+            release(records[i].key);
+            release(records[i].element);
+        }
+    }
+
+    catis_free(records);
+    release(function);
+    release(list);
+    if (error) {
+        return error;
+    }
+    stack_push(context, result);
+    return 0;
+}
+
+/* -- dictionary procedures -- */
+int check_key(catis_context* context, catis_object* key) {
+    if (!is_key(key)) {
+        set_error(
+            context,
+            NULL,
+            "Dictionary keys are ints, booleans, strings or symbols"
+        );
+        return 1;
+    }
+    return 0;
+}
+
+int library_get(catis_context* context) {
+    // get (dict key -- value), #f when missing, has (dict key -- bool)
+    if (check_stack_type(context, 2, CATIS_TYPE_DICT, CATIS_TYPE_ANY)) { return 1; }
+    if (check_key(context, stack_peek(context, 0))) { return 1; }
+    catis_object* key = stack_pop(context);
+    catis_object* dict = stack_pop(context);
+    catis_entry* entry = dict_lookup(dict, key);
+    if (context->frame->procedure->name[0] == 'h') {
+        stack_push(context, new_boolean(entry != NULL));
+    }
+    else if (entry) {
+        stack_push(context, entry->value);
+        retain(entry->value);
+    }
+    else {
+        stack_push(context, new_boolean(0));
+    }
+    release(key);
+    release(dict);
+    return 0;
+}
+
+int library_put(catis_context* context) {
+    // (dict key value -- dict')
+    if (check_stack_type(
+        context,
+        3,
+        CATIS_TYPE_DICT,
+        CATIS_TYPE_ANY,
+        CATIS_TYPE_ANY
+    )) {
+        return 1;
+    }
+    if (check_key(context, stack_peek(context, 1))) { return 1; }
+    catis_object* value = stack_pop(context);
+    catis_object* key = stack_pop(context);
+    catis_object* dict = get_unshared_object(stack_pop(context));
+    dict_put(dict, key, value);
+    stack_push(context, dict);
+    return 0;
+}
+
+int library_delete(catis_context* context) {
+    // (dict key -- dict') whether key is there or not
+    if (check_stack_type(context, 2, CATIS_TYPE_DICT, CATIS_TYPE_ANY)) { return 1; }
+    if (check_key(context, stack_peek(context, 0))) { return 1; }
+    catis_object* key = stack_pop(context);
+    catis_object* dict = stack_pop(context);
+    if (dict_lookup(dict, key)) {
+        dict = get_unshared_object(dict);
+        dict_delete(dict, key);
+    }
+    stack_push(context, dict);
+    release(key);
+    return 0;
+}
+
+int library_keys(catis_context* context) {
+    // keys and values (dict -- list), in no particular order but the same
+    if (check_stack_type(context, 1, CATIS_TYPE_DICT)) { return 1; }
+    catis_object* dict = stack_pop(context);
+    int keys = context->frame->procedure->name[0] == 'k';
+    catis_object* list = new_list(dict->dict.length);
+    for (size_t i = 0; i < dict->dict.capacity; i++) {
+        catis_entry* entry = dict->dict.entry + i;
+        if (entry->key) {
+            catis_object* element = keys ? entry->key : entry->value;
+            retain(element);
+            list->collection.element[list->collection.length++] = element;
+        }
+    }
+    release(dict);
+    stack_push(context, list);
+    return 0;
+}
+
+/* -- parallel list procedures -- */
+enum {
+    BATCH_MAP,
+    BATCH_EACH,
+    BATCH_REDUCE
+};
+
+/*
+ * One pmap, peach or preduce: the list is cut in chunks that the caller
+ * and the pool's workers claim one at a time. Freed by whoever lets go
+ * last, a worker may only get to its task once every chunk is done.
+ */
+typedef struct catis_batch {
+    int reference_count;
+    int kind;
+    int vm;
+    catis_object* list;
+    catis_object* function;
+    stackframe* frame; // the caller's, each chunk evaluates in a copy
+    catis_object* result; // an element per element, or per chunk to reduce
+    size_t length;
+    size_t chunk_size;
+    size_t chunk_count;
+    size_t next_chunk; // next one to claim
+    size_t done; // chunks finished
+    int error; // the first failure stops the others
+    char error_string[CATIS_ERROR_STRING_LENGTH];
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} catis_batch;
+
+void release_batch(catis_batch* batch) {
+    if (count_down(&batch->reference_count) == 0) {
+        pthread_mutex_destroy(&batch->lock);
+        pthread_cond_destroy(&batch->finished);
+        catis_free(batch);
+    }
+}
+
+void fail_batch(catis_batch* batch, catis_context* context) {
+    pthread_mutex_lock(&batch->lock);
+    if (!batch->error) {
+        memcpy(batch->error_string, context->error_string, CATIS_ERROR_STRING_LENGTH);
+        __atomic_store_n(&batch->error, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/* the function on every element of the chunk, above what is on the stack */
+void run_chunk(catis_context* context, catis_batch* batch, size_t chunk) {
+    size_t start = chunk * batch->chunk_size;
+    size_t end = start + batch->chunk_size;
+    if (end > batch->length) {
+        end = batch->length;
+    }
+    stackframe* frame = context->frame;
+    context->frame = copy_stackframe(batch->frame, frame);
+    int vm = context->vm;
+    context->vm = batch->vm;
+    size_t base = context->stack_length;
+
+    size_t i = start;
+    int error = 0;
+    if (batch->kind == BATCH_REDUCE) {
+        stack_push(context, sequence_element(batch->list, i++));
+        base++;
+    }
+    for (; i < end && !error; i++) {
+        if (__atomic_load_n(&batch->error, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        stack_push(context, sequence_element(batch->list, i));
+        error = eval(context, batch->function);
+        size_t left = batch->kind == BATCH_MAP ? base + 1 : base;
+        if (!error && batch->kind != BATCH_EACH && context->stack_length != left) {
+            set_error(context, NULL, "The function must leave one value");
+            error = 1;
+        }
+        if (error) {
+            fail_batch(batch, context);
+        }
+        else if (batch->kind == BATCH_MAP) {
+            batch->result->collection.element[i] = stack_pop(context);
+        }
+        else if (batch->kind == BATCH_REDUCE) {
+            // the element before is swallowed with the new one
+            continue;
+        }
+        while (context->stack_length > base) {
+            release(stack_pop(context));
+        }
+    }
+    if (batch->kind == BATCH_REDUCE) {
+        base--;
+        if (context->stack_length > base) {
+            batch->result->collection.element[chunk] = stack_pop(context);
+        }
+    }
+    while (context->stack_length > base) {
+        release(stack_pop(context));
+    }
+
+    release_stackframe(context->frame);
+    context->frame = frame;
+    context->vm = vm;
+    output_flush(&context->output);
+    if (__atomic_add_fetch(&batch->done, 1, __ATOMIC_ACQ_REL) == batch->chunk_count) {
+        pthread_mutex_lock(&batch->lock);
+        pthread_cond_broadcast(&batch->finished);
+        pthread_mutex_unlock(&batch->lock);
+    }
+}
+
+void run_chunks(catis_context* context, catis_batch* batch) {
+    while (1) {
+        size_t chunk = __atomic_fetch_add(&batch->next_chunk, 1, __ATOMIC_ACQ_REL);
+        if (chunk >= batch->chunk_count) {
+            return;
+        }
+        run_chunk(context, batch, chunk);
+    }
+}
+
+void run_batch_task(catis_context* context, catis_task* task) {
+    enter_shared(context->shared);
+    run_chunks(context, task->batch);
+    release_batch(task->batch);
+    catis_free(task);
+    leave_shared(context->shared);
+}
+
+int library_parallel(catis_context* context) {
+    // pmap (list f -- list'), peach (list f --), preduce (list f -- value)
+    if (check_stack_type(
+        context,
+        2,
+        CATIS_TYPE_LIST | CATIS_TYPE_TUPLE | CATIS_TYPE_STRING |
+        CATIS_TYPE_VECTOR | CATIS_TYPE_RANGE,
+        CATIS_TYPE_LIST
+    )) {
+        return 1;
+    }
+    const char* name = context->frame->procedure->name;
+    int kind = name[1] == 'm' ? BATCH_MAP : name[1] == 'e' ? BATCH_EACH : BATCH_REDUCE;
+    size_t length = sequence_length(stack_peek(context, 1));
+    if (kind == BATCH_REDUCE && length == 0) {
+        set_error(context, NULL, "Nothing to reduce");
+        return 1;
+    }
+    catis_object* function = stack_pop(context);
+    catis_object* list = stack_pop(context);
+
+    catis_pool* pool = context->shared->pool;
+    if (pool == NULL) {
+        pool = start_pool(context->shared);
+    }
+    catis_batch* batch = catis_allocate(sizeof(*batch));
+    batch->reference_count = 1;
+    batch->kind = kind;
+    batch->vm = context->vm;
+    batch->list = list;
+    batch->function = function;
+    batch->frame = context->frame;
+    batch->length = length;
+    // a few chunks per worker, so the busy ones get helped
+    batch->chunk_count = pool->worker_count * 4;
+    if (batch->chunk_count > length) {
+        batch->chunk_count = length;
+    }
+    batch->chunk_size = batch->chunk_count ?
+        (length + batch->chunk_count - 1) / batch->chunk_count : 0;
+    if (batch->chunk_size) {
+        batch->chunk_count = (length + batch->chunk_size - 1) / batch->chunk_size;
+    }
+    batch->next_chunk = 0;
+    batch->done = 0;
+    batch->error = 0;
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->finished, NULL);
+
+    batch->result = NULL;
+    size_t result_length = kind == BATCH_MAP ? length :
+        kind == BATCH_REDUCE ? batch->chunk_count : 0;
+    if (kind != BATCH_EACH) {
+        batch->result = new_list(result_length);
+        memset(batch->result->collection.element, 0, sizeof(catis_object*) * result_length);
+        batch->result->collection.length = result_length;
+    }
+
+    // the caller takes chunks too, so a worker waiting here is no loss
+    output_flush(&context->output);
+    size_t helpers = batch->chunk_count > 1 ? batch->chunk_count - 1 : 0;
+    if (helpers > pool->worker_count) {
+        helpers = pool->worker_count;
+    }
+    for (size_t i = 0; i < helpers; i++) {
+        catis_task* task = catis_allocate(sizeof(*task));
+        task->run = run_batch_task;
+        task->batch = batch;
+        count_up(&batch->reference_count);
+        submit_task(context, task);
+    }
+    run_chunks(context, batch);
+    // a chunk left may define, which waits for every reader to leave
+    int reading = reading_definitions;
+    leave_shared(context->shared);
+    pthread_mutex_lock(&batch->lock);
+    while (__atomic_load_n(&batch->done, __ATOMIC_ACQUIRE) < batch->chunk_count) {
+        pthread_cond_wait(&batch->finished, &batch->lock);
+    }
+    pthread_mutex_unlock(&batch->lock);
+    if (reading) {
+        enter_shared(context->shared);
+    }
+
+    catis_object* result = batch->result;
+    int error = batch->error;
+    if (error) {
+        memcpy(context->error_string, batch->error_string, CATIS_ERROR_STRING_LENGTH);
+    }
+    release_batch(batch);
+    release(list);
+    if (error) {
+        release(result);
+        release(function);
+        return 1;
+    }
+
+    if (kind == BATCH_REDUCE) {
+        // the chunks reduced in order, the function has to be associative
+        size_t base = context->stack_length;
+        stack_push(context, result->collection.element[0]);
+        retain(result->collection.element[0]);
+        for (size_t i = 1; i < result->collection.length && !error; i++) {
+            stack_push(context, result->collection.element[i]);
+            retain(result->collection.element[i]);
+            error = eval(context, function);
+            if (!error && context->stack_length != base + 1) {
+                set_error(context, NULL, "The function must leave one value");
+                error = 1;
+            }
+        }
+        release(result);
+        result = NULL;
+    }
+    release(function);
+    if (result) {
+        stack_push(context, result);
+    }
+    return error;
+}
+
+int library_not(catis_context* context) {
+    if (check_stack_type(context, 1, CATIS_TYPE_BOOL)) { return 1; }
+    catis_object* object = stack_pop(context);
+    stack_push(context, new_boolean(!object_boolean(object)));
+    return 0;
+}
+
+int library_dup(catis_context* context) {
+    if (check_stack_length(context, 1)) { return 1; }
+    catis_object* object = stack_peek(context, 0);
+    stack_push(context, object);
+    retain(object);
+    return 0;
+}
+
+int library_swap(catis_context* context) {
+    if (check_stack_length(context, 2)) { return 1; }
+    catis_object* object = stack_peek(context, 0);
+    stack_set(context, 0, stack_peek(context, 1));
+    stack_set(context, 1, object);
+    return 0;
+}
+
+int library_drop(catis_context* context) {
+    if (check_stack_length(context, 1)) { return 1; }
+    release(stack_pop(context));
+    return 0;
+}
+
+int library_show_stack(catis_context* context) {
+    stack_show(context);
+    output_line_end(&context->output);
+    return 0;
+};
+
+int library_definitions(catis_context* context) {
+    // the interpreter's own, then its library's
+    catis_shared* shared = context->shared;
+    const char* separator = "";
+    while (shared) {
+        for (catis_procedure* next = shared->procedure; next; next = next->next) {
+            output_string(&context->output, separator);
+            output_string(&context->output, next->name);
+            separator = "  ";
+        }
+        shared = shared->base;
+    }
+    output_char(&context->output, '\n');
+    output_line_end(&context->output);
+
+    return 0;
+}
+
+int library_unquote(catis_context* context) {
+    if (check_stack_type(context, 1, CATIS_TYPE_SYMBOL)) { return 1; }
+    catis_object* symbol = stack_pop(context);
+    catis_procedure* procedure =
+        lookup_atom_procedure(context, symbol->string_or_symbol.atom);
+    release(symbol);
+    catis_object* body =
+        procedure == NULL ? NULL :
+        procedure->c_procedure ? procedure->source :
+        procedure->procedure;
+    if (body == NULL) {
+        stack_push(context, new_boolean(0));
+        return 0;
+    }
+    stack_push(context, body);
+    retain(body);
+    return 0;
+}
+
+int library_join(catis_context* context) {
+    // (body inputs name --) name receives messages for the inputs
+    if (check_stack_type(
+        context,
+        3,
+        CATIS_TYPE_LIST,
+        CATIS_TYPE_TUPLE,
+        CATIS_TYPE_SYMBOL
+    )) {
+        return 1;
+    }
+    catis_object* names = stack_peek(context, 1);
+    if (names->collection.length == 0) {
+        set_error(context, NULL, "A join needs inputs");
+        return 1;
+    }
+    for (size_t i = 0; i < names->collection.length; i++) {
+        catis_object* input = names->collection.element[i];
+        for (size_t j = 0; j < i; j++) {
+            if (
+                input->string_or_symbol.atom ==
+                names->collection.element[j]->string_or_symbol.atom
+            ) {
+                // its messages would all wait for the same slot
+                set_error(
+                    context,
+                    input->string_or_symbol.pointer,
+                    "Input named twice in a join"
+                );
+                return 1;
+            }
+        }
+    }
+    catis_object* name = stack_pop(context);
+    catis_object* inputs = stack_pop(context);
+    catis_object* body = stack_pop(context);
+
+    size_t count = inputs->collection.length;
+    catis_join* join = catis_allocate(
+        sizeof(*join) + sizeof(catis_mailbox) * count
+    );
+    join->body = body;
+    join->matching = 0;
+    join->count = count;
+    for (size_t i = 0; i < count; i++) {
+        join->mailbox[i].name =
+            inputs->collection.element[i]->string_or_symbol.atom;
+        join->mailbox[i].incoming = NULL;
+        join->mailbox[i].first = NULL;
+        join->mailbox[i].last = NULL;
+    }
+    release(inputs);
+
+    lock_definitions(context->shared);
+    bind_procedure(
+        context,
+        name->string_or_symbol.pointer,
+        library_send,
+        NULL
+    )->join = join;
+    unlock_definitions(context->shared);
+    release(name);
+    return 0;
+}
+
+int library_send(catis_context* context) {
+    // (value input --) the join fires on a worker once all inputs arrived
+    if (check_stack_type(context, 2, CATIS_TYPE_ANY, CATIS_TYPE_SYMBOL)) { return 1; }
+    catis_procedure* procedure = context->frame->procedure;
+    catis_join* join = procedure->join;
+    catis_object* input = stack_peek(context, 0);
+    size_t i = 0;
+    while (
+        i < join->count &&
+        join->mailbox[i].name != input->string_or_symbol.atom
+    ) {
+        i++;
+    }
+    if (i == join->count) {
+        set_error(context, input->string_or_symbol.pointer, "Not an input of the join");
+        return 1;
+    }
+    release(stack_pop(context));
+
+    catis_message* message = catis_allocate(sizeof(*message));
+    message->value = stack_pop(context);
+    catis_mailbox* mailbox = join->mailbox + i;
+    message->next = __atomic_load_n(&mailbox->incoming, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(
+        &mailbox->incoming, &message->next, message, 1,
+        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED
+    )) {
+        // message->next was updated to the current top, try again
+    }
+
+    match_join(context, procedure);
+    return 0;
+}
+
+int library_define_memo(catis_context* context) {
+    // (body name --) like define, results cached by the arguments its capture takes
+    if (check_stack_type(context, 2, CATIS_TYPE_LIST, CATIS_TYPE_SYMBOL)) { return 1; }
+    catis_object* program = stack_peek(context, 1);
+    if (
+        program->collection.length == 0 ||
+        object_type(program->collection.element[0]) != CATIS_TYPE_CAPTURE
+    ) {
+        set_error(context, NULL, "A memoized procedure starts by capturing its arguments");
+        return 1;
+    }
+    catis_object* symbol = stack_pop(context);
+    program = stack_pop(context);
+
+    lock_definitions(context->shared);
+    catis_procedure* procedure = bind_procedure(
+        context,
+        symbol->string_or_symbol.pointer,
+        library_memo,
+        NULL
+    );
+    procedure->memo = new_memo(
+        procedure,
+        program,
+        program->collection.element[0]->collection.length
+    );
+    analyze_procedure(context, &procedure->memo->body, 1);
+    procedure->source = program;
+    retain(program);
+    unlock_definitions(context->shared);
+    release(symbol);
+    return 0;
+}
+
+int library_memo(catis_context* context) {
+    catis_memo* memo = context->frame->procedure->memo;
+    if (check_stack_length(context, memo->arity)) { return 1; }
+    size_t base = context->stack_length - memo->arity;
+    catis_object** argument = context->stack + base;
+
+    // FNV over the hashes of the arguments
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < memo->arity; i++) {
+        unsigned int element;
+        if (!hash_value(argument[i], &element)) {
+            return call_procedure(context, &memo->body);
+        }
+        hash = (hash ^ element) * 16777619u;
+    }
+
+    if (multithreaded) { pthread_mutex_lock(&memo->lock); }
+    int index = find_memo_entry(memo, hash, argument);
+    if (index != -1) {
+        catis_memo_entry* entry = memo->entry + index;
+        while (context->stack_length > base) {
+            release(stack_pop(context));
+        }
+        for (size_t i = 0; i < entry->result_count; i++) {
+            catis_object* result = entry->value[memo->arity + i];
+            retain(result);
+            stack_push(context, result);
+        }
+        if (multithreaded) { pthread_mutex_unlock(&memo->lock); }
+        stats.memo_hits++;
+        return 0;
+    }
+    if (multithreaded) { pthread_mutex_unlock(&memo->lock); }
+    stats.memo_misses++;
+
+    catis_object** value = catis_allocate(sizeof(catis_object*) * memo->arity);
+    for (size_t i = 0; i < memo->arity; i++) {
+        value[i] = argument[i];
+        retain(value[i]);
+    }
+    // the body may rebind the name, the memo lives until it returns
+    count_up(&memo->reference_count);
+    int error = call_procedure(context, &memo->body);
+    if (error || context->stack_length < base) {
+        // failed or took more than its arguments, nothing to remember
+        for (size_t i = 0; i < memo->arity; i++) {
+            release(value[i]);
+        }
+        catis_free(value);
+        release_memo(memo);
+        return error;
+    }
+
+    size_t result_count = context->stack_length - base;
+    value = catis_reallocate(
+        value,
+        sizeof(catis_object*) * (memo->arity + result_count)
+    );
+    for (size_t i = 0; i < result_count; i++) {
+        value[memo->arity + i] = context->stack[base + i];
+        retain(value[memo->arity + i]);
+    }
+    if (multithreaded) { pthread_mutex_lock(&memo->lock); }
+    if (find_memo_entry(memo, hash, value) == -1) {
+        add_memo_entry(memo, hash, value, result_count);
+        value = NULL;
+    }
+    if (multithreaded) { pthread_mutex_unlock(&memo->lock); }
+    if (value) {
+        // another thread got there first
+        for (size_t i = 0; i < memo->arity + result_count; i++) {
+            release(value[i]);
+        }
+        catis_free(value);
+    }
+    release_memo(memo);
+    return 0;
+}
+
+int library_vm(catis_context* context) {
+    context->vm = 1;
+    return 0;
+}
+
+void print_stats(catis_context* context, FILE* file) {
+    static const char* type_names[CATIS_TYPE_BITS] = {
+        "bool", "int", "list", "string", "symbol", "tuple", "capture", "vector",
+        "dict", "range"
+    };
+    catis_stats sum;
+    sum_stats(&sum);
+
+    fprintf(file, "live objects:\n");
+    for (int i = 0; i < CATIS_TYPE_BITS; i++) {
+        if (sum.live[i]) {
+            fprintf(file, "  %-8s %12ld\n", type_names[i], sum.live[i]);
+        }
+    }
+    fprintf(file, "allocations      %12zu\n", sum.allocations);
+    fprintf(file, "frees            %12zu\n", sum.frees);
+    fprintf(file, "bytes allocated  %12zu\n", sum.bytes_allocated);
+#ifndef CATIS_MALLOC
+    fprintf(file, "bytes in use     %12zu\n", sum.bytes_allocated - sum.bytes_freed);
+#endif
+    fprintf(file, "copies           %12zu\n", sum.copies);
+    fprintf(file, "bytes copied     %12zu\n", sum.bytes_copied);
+    fprintf(file, "unshare copied   %12zu\n", sum.unshared_copied);
+    fprintf(file, "unshare reused   %12zu\n", sum.unshared_reused);
+    fprintf(file, "stack high water %12zu\n", context->stack_high_water);
+    fprintf(file, "frames           %12zu\n", sum.frames);
+    fprintf(file, "memo hits        %12zu\n", sum.memo_hits);
+    fprintf(file, "memo misses      %12zu\n", sum.memo_misses);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(file, "peak rss kb      %12ld\n", usage.ru_maxrss);
+}
+
+int library_stats(catis_context* context) {
+    output_flush(&context->output);
+    flockfile(stdout);
+    print_stats(context, stdout);
+    funlockfile(stdout);
+    return 0;
+}
+
+int library_profile_start(catis_context* context) {
+    start_profile(context);
+    return 0;
+}
+
+int library_profile_stop(catis_context* context) {
+    stop_profile(context);
+    return 0;
+}
+
+int library_profile_report(catis_context* context) {
+    catis_profile* profile = context->profile ?
+        context->profile : context->last_profile;
+    if (profile == NULL) {
+        set_error(context, NULL, "Nothing profiled yet, see %profile-start");
+        return 1;
+    }
+    output_flush(&context->output);
+    flockfile(stdout);
+    print_profile(context, profile, stdout);
+    funlockfile(stdout);
+    return 0;
+}
+
+int library_profile_folded(catis_context* context) {
+    // (path --) folded stacks of the last profile, for flamegraph.pl
+    if (check_stack_type(context, 1, CATIS_TYPE_STRING)) { return 1; }
+    catis_profile* profile = context->profile ?
+        context->profile : context->last_profile;
+    if (profile == NULL) {
+        set_error(context, NULL, "Nothing profiled yet, see %profile-start");
+        return 1;
+    }
+    catis_object* path = stack_pop(context);
+    // a slice has no terminator of its own
+    char* filename = catis_allocate(path->string_or_symbol.length + 1);
+    memcpy(filename, path->string_or_symbol.pointer, path->string_or_symbol.length);
+    filename[path->string_or_symbol.length] = 0;
+    int error = write_folded_profile(profile, filename);
+    if (error) {
+        set_error(context, filename, "Can not write the profile");
+    }
+    catis_free(filename);
+    release(path);
+    return error;
+}
+
+void load_library(catis_context* context) {
+    add_procedure(context, "+", library_math, NULL);
+    add_procedure(context, "-", library_math, NULL);
+    add_procedure(context, "*", library_math, NULL);
+    add_procedure(context, "/", library_math, NULL);
+    add_procedure(context, "==", library_compare, NULL);
+    add_procedure(context, "!=", library_compare, NULL);
+    add_procedure(context, ">=", library_compare, NULL);
+    add_procedure(context, "<=", library_compare, NULL);
+    add_procedure(context, ">",  library_compare, NULL);
+    add_procedure(context, "<",  library_compare, NULL);
+    add_procedure(context, "&", library_logic, NULL);
+    add_procedure(context, "|", library_logic, NULL);
+    add_procedure(context, "sort", library_sort, NULL);
+    add_procedure(context, "sort-by", library_sort_by, NULL);
+    add_procedure(context, "define", library_define, NULL);
+    add_procedure(context, "if",      library_if, NULL);
+    add_procedure(context, "if-else", library_if, NULL);
+    add_procedure(context, "while",   library_if, NULL);
+    add_procedure(context, "eval", library_eval, NULL);
+    add_procedure(context, "up-eval", library_up_eval, NULL);
+    add_procedure(context, "prin", library_print, NULL);
+    add_procedure(context, "print", library_println, NULL);
+    add_procedure(context, "flush", library_flush, NULL);
+    add_procedure(context, "len", library_length, NULL);
+    add_procedure(context, "<-", library_list_append, NULL);
+    add_procedure(context, "@", library_at, NULL);
+    add_procedure(context, "slice", library_slice, NULL);
+    add_procedure(context, ".", library_show_stack, NULL);
+    add_procedure(context, "^", library_concatenate, NULL);
+    add_procedure(context, "to-tuple", library_to_tuple, NULL);
+    add_procedure(context, "unquote", library_unquote, NULL);
+    add_procedure(context, "%defs", library_definitions, NULL);
+    add_procedure(context, "%vm", library_vm, NULL);
+    add_procedure(context, "%stats", library_stats, NULL);
+    add_procedure(context, "%profile-start", library_profile_start, NULL);
+    add_procedure(context, "%profile-stop", library_profile_stop, NULL);
+    add_procedure(context, "%profile-report", library_profile_report, NULL);
+    add_procedure(context, "%profile-folded", library_profile_folded, NULL);
+    add_procedure(context, "join", library_join, NULL);
+    add_procedure(context, "define-memo", library_define_memo, NULL);
+    add_procedure(context, "pmap", library_parallel, NULL);
+    add_procedure(context, "peach", library_parallel, NULL);
+    add_procedure(context, "preduce", library_parallel, NULL);
+    add_procedure(context, "to-vector", library_to_vector, NULL);
+    add_procedure(context, "to-list", library_to_list, NULL);
+    add_procedure(context, "v==", library_vector_compare, NULL);
+    add_procedure(context, "v!=", library_vector_compare, NULL);
+    add_procedure(context, "v>=", library_vector_compare, NULL);
+    add_procedure(context, "v<=", library_vector_compare, NULL);
+    add_procedure(context, "v>",  library_vector_compare, NULL);
+    add_procedure(context, "v<",  library_vector_compare, NULL);
+    add_procedure(context, "vsum", library_vector_reduce, NULL);
+    add_procedure(context, "vmin", library_vector_reduce, NULL);
+    add_procedure(context, "vmax", library_vector_reduce, NULL);
+    add_procedure(context, "vshift", library_vector_shift, NULL);
+    add_procedure(context, "vpick", library_vector_pick, NULL);
+    add_procedure(context, "get", library_get, NULL);
+    add_procedure(context, "has", library_get, NULL);
+    add_procedure(context, "put", library_put, NULL);
+    add_procedure(context, "delete", library_delete, NULL);
+    add_procedure(context, "keys", library_keys, NULL);
+    add_procedure(context, "values", library_keys, NULL);
+
+    // natives, the catis definitions document them through unquote
+    add_native_procedure(context, "dup", library_dup, "[{x} $x $x]");
+    add_native_procedure(context, "swap", library_swap, "[{x y} $y $x]");
+    add_native_procedure(context, "drop", library_drop, "[{_}]");
+
+    add_native_procedure(
+        context, "map", library_map,
+        "[{l f}   $l len {s}   0 {i}   [] [$i $s <] [ $l $i @   $f up-eval   <-   $i 1 + {i} ] while]"
+    );
+    add_native_procedure(
+        context, "each", library_each,
+        "[{l f}   $l len {s}   0 {i}   [$i $s <] [ $l $i @   $f up-eval   $i 1 + {i} ] while]"
+    );
+    add_string_procedure(context, "head", "[0 @]");
+    add_native_procedure(
+        context, "tail", library_tail,
+        "[#t {d}   [] {n}   [ [$d] [#f {d}   drop] [$n swap <- {n}] if-else ] each $n]"
+    );
+    add_native_procedure(context, "~", library_not, "[{b} [$b] [#f {b}] [#t {b}] if-else $b]");
+    add_native_procedure(context, "range", library_range, "[{s e} [] {r} [$s $e <] [$r $s <- {r} $s 1 + {s}] while $r]");
+}
+
+/* -- images -- */
+/*
+ * The catis procedures of an interpreter, saved so that a prelude does
+ * not have to be parsed again. The objects are written as catis_object
+ * structs with file offsets for pointers: loading maps the file, adds the
+ * base address to them and interns the symbols. Image objects are pinned,
+ * never freed, and copied on write like any shared object. An image is
+ * only good for the build that wrote it.
+ */
+#define CATIS_IMAGE_MAGIC "catisimg"
+#define CATIS_IMAGE_VERSION 1
+#define CATIS_IMAGE_PINNED CATIS_PINNED
+
+typedef struct catis_image_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t object_size; // sizeof(catis_object) of the build
+    uint64_t size; // of the whole file
+    uint64_t object_offset; // the objects, one after the other
+    uint64_t object_count;
+    uint64_t procedure_offset; // the catis_image_procedure records
+    uint64_t procedure_count;
+} catis_image_header;
+
+typedef struct catis_image_procedure {
+    uint64_t name; // offset of the NUL terminated name
+    uint64_t body; // offset of the list object
+} catis_image_procedure;
+
+typedef struct catis_image_writer {
+    char* bytes;
+    size_t length;
+    size_t capacity;
+    catis_object** object; // in file order
+    size_t object_count;
+    size_t object_capacity;
+    // open addressed, object -> index in object + 1
+    catis_object** seen;
+    size_t* seen_index;
+    size_t seen_size;
+} catis_image_writer;
+
+/* room for size bytes at the end, 8 bytes aligned, returns its offset */
+size_t image_reserve(catis_image_writer* writer, size_t size) {
+    size_t offset = (writer->length + 7) & ~(size_t)7;
+    if (offset + size > writer->capacity) {
+        writer->capacity = grown_capacity(writer->capacity, offset + size);
+        writer->bytes = catis_reallocate(writer->bytes, writer->capacity);
+    }
+    memset(writer->bytes + writer->length, 0, offset + size - writer->length);
+    writer->length = offset + size;
+    return offset;
+}
+
+size_t image_append(catis_image_writer* writer, const void* data, size_t size) {
+    size_t offset = image_reserve(writer, size);
+    if (size) {
+        memcpy(writer->bytes + offset, data, size);
+    }
+    return offset;
+}
+
+static inline size_t image_slot(catis_image_writer* writer, catis_object* object) {
+    size_t mask = writer->seen_size - 1;
+    size_t index = ((uintptr_t)object >> 4) * 2654435761u & mask;
+    while (writer->seen[index] && writer->seen[index] != object) {
+        index = (index + 1) & mask;
+    }
+    return index;
+}
+
+/* number the object, once however many times it is shared */
+size_t image_object(catis_image_writer* writer, catis_object* object) {
+    size_t slot = image_slot(writer, object);
+    if (writer->seen[slot]) {
+        return writer->seen_index[slot] - 1;
+    }
+
+    if (writer->object_count == writer->object_capacity) {
+        writer->object_capacity =
+            grown_capacity(writer->object_capacity, writer->object_count + 1);
+        writer->object = catis_reallocate(
+            writer->object,
+            sizeof(catis_object*) * writer->object_capacity
+        );
+    }
+    writer->object[writer->object_count++] = object;
+    writer->seen[slot] = object;
+    writer->seen_index[slot] = writer->object_count;
+
+    if (writer->object_count * 2 > writer->seen_size) {
+        catis_object** seen = writer->seen;
+        size_t* seen_index = writer->seen_index;
+        size_t size = writer->seen_size;
+        writer->seen_size *= 2;
+        writer->seen = catis_allocate(sizeof(catis_object*) * writer->seen_size);
+        writer->seen_index = catis_allocate(sizeof(size_t) * writer->seen_size);
+        memset(writer->seen, 0, sizeof(catis_object*) * writer->seen_size);
+        for (size_t i = 0; i < size; i++) {
+            if (seen[i]) {
+                size_t moved = image_slot(writer, seen[i]);
+                writer->seen[moved] = seen[i];
+                writer->seen_index[moved] = seen_index[i];
+            }
+        }
+        catis_free(seen);
+        catis_free(seen_index);
+    }
+    return writer->object_count - 1;
+}
+
+int save_image(catis_context* context, const char* filename) {
+    catis_image_writer writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.seen_size = 256;
+    writer.seen = catis_allocate(sizeof(catis_object*) * writer.seen_size);
+    writer.seen_index = catis_allocate(sizeof(size_t) * writer.seen_size);
+    memset(writer.seen, 0, sizeof(catis_object*) * writer.seen_size);
+
+    // oldest first, so loading defines them in the same order
+    size_t procedure_count = 0;
+    for (catis_procedure* procedure = context->shared->procedure; procedure; procedure = procedure->next) {
+        procedure_count += procedure->procedure != NULL;
+    }
+    catis_procedure** procedures =
+        catis_allocate(sizeof(catis_procedure*) * (procedure_count + 1));
+    size_t i = procedure_count;
+    for (catis_procedure* procedure = context->shared->procedure; procedure; procedure = procedure->next) {
+        if (procedure->procedure) {
+            procedures[--i] = procedure;
+        }
+    }
+
+    // every object reachable from the bodies, breadth first
+    for (i = 0; i < procedure_count; i++) {
+        image_object(&writer, procedures[i]->procedure);
+    }
+    for (i = 0; i < writer.object_count; i++) {
+        catis_object* object = writer.object[i];
+        if (
+            object->type == CATIS_TYPE_LIST ||
+            object->type == CATIS_TYPE_TUPLE ||
+            object->type == CATIS_TYPE_CAPTURE
+        ) {
+            for (size_t j = 0; j < object->collection.length; j++) {
+                if (!is_immediate(object->collection.element[j])) {
+                    image_object(&writer, object->collection.element[j]);
+                }
+            }
+        }
+        else if (object->type == CATIS_TYPE_DICT) {
+            for (size_t j = 0; j < object->dict.capacity; j++) {
+                catis_entry* entry = object->dict.entry + j;
+                if (entry->key && !is_immediate(entry->key)) {
+                    image_object(&writer, entry->key);
+                }
+                if (entry->key && !is_immediate(entry->value)) {
+                    image_object(&writer, entry->value);
+                }
+            }
+        }
+    }
+
+    size_t header = image_reserve(&writer, sizeof(catis_image_header));
+    size_t objects = image_reserve(&writer, sizeof(catis_object) * writer.object_count);
+    for (i = 0; i < writer.object_count; i++) {
+        catis_object* object = writer.object[i];
+        catis_object copy = *object;
+        copy.reference_count = CATIS_IMAGE_PINNED;
+        if (object->type == CATIS_TYPE_STRING || object->type == CATIS_TYPE_SYMBOL) {
+            // reserved bytes are zeroed, that is the terminator of a slice
+            size_t characters = image_reserve(
+                &writer,
+                object->string_or_symbol.length + 1
+            );
+            memcpy(
+                writer.bytes + characters,
+                object->string_or_symbol.pointer,
+                object->string_or_symbol.length
+            );
+            copy.string_or_symbol.pointer = (char*)characters;
+            copy.string_or_symbol.capacity = object->string_or_symbol.length + 1;
+            copy.string_or_symbol.atom = NULL;
+            copy.string_or_symbol.cached_procedure = NULL;
+            copy.string_or_symbol.cached_generation = 0;
+            copy.string_or_symbol.last_use_generation = 0;
+            copy.string_or_symbol.library = 0;
+        }
+        else if (object->type == CATIS_TYPE_VECTOR) {
+            copy.vector.element = (int*)image_append(
+                &writer,
+                object->vector.element,
+                sizeof(int) * object->vector.length
+            );
+            copy.vector.capacity = object->vector.length;
+        }
+        else if (object->type == CATIS_TYPE_RANGE) {
+            // nothing to point at
+        }
+        else if (object->type == CATIS_TYPE_DICT) {
+            // same slots, the hashes do not depend on addresses
+            size_t entries = image_reserve(
+                &writer,
+                sizeof(catis_entry) * object->dict.capacity
+            );
+            for (size_t j = 0; j < object->dict.capacity; j++) {
+                catis_entry entry = object->dict.entry[j];
+                if (entry.key && !is_immediate(entry.key)) {
+                    entry.key = (catis_object*)(objects +
+                        sizeof(catis_object) * image_object(&writer, entry.key));
+                }
+                if (entry.key && !is_immediate(entry.value)) {
+                    entry.value = (catis_object*)(objects +
+                        sizeof(catis_object) * image_object(&writer, entry.value));
+                }
+                memcpy(writer.bytes + entries + sizeof(entry) * j, &entry, sizeof(entry));
+            }
+            copy.dict.entry = (catis_entry*)entries;
+        }
+        else {
+            size_t length = object->collection.length;
+            size_t elements = image_reserve(&writer, sizeof(uintptr_t) * length);
+            for (size_t j = 0; j < length; j++) {
+                catis_object* element = object->collection.element[j];
+                uintptr_t reference = (uintptr_t)element;
+                if (!is_immediate(element)) {
+                    reference = objects +
+                        sizeof(catis_object) * image_object(&writer, element);
+                }
+                memcpy(writer.bytes + elements + sizeof(uintptr_t) * j, &reference, sizeof(reference));
+            }
+            copy.collection.element = (catis_object**)elements;
+            copy.collection.capacity = length;
+        }
+        memcpy(writer.bytes + objects + sizeof(catis_object) * i, &copy, sizeof(copy));
+    }
+
+    size_t records = image_reserve(&writer, sizeof(catis_image_procedure) * procedure_count);
+    for (i = 0; i < procedure_count; i++) {
+        catis_image_procedure record;
+        record.name = image_append(
+            &writer,
+            procedures[i]->name,
+            strlen(procedures[i]->name) + 1
+        );
+        record.body = objects +
+            sizeof(catis_object) * image_object(&writer, procedures[i]->procedure);
+        memcpy(writer.bytes + records + sizeof(record) * i, &record, sizeof(record));
+    }
+
+    catis_image_header* head = (catis_image_header*)(writer.bytes + header);
+    memcpy(head->magic, CATIS_IMAGE_MAGIC, sizeof(head->magic));
+    head->version = CATIS_IMAGE_VERSION;
+    head->object_size = sizeof(catis_object);
+    head->size = writer.length;
+    head->object_offset = objects;
+    head->object_count = writer.object_count;
+    head->procedure_offset = records;
+    head->procedure_count = procedure_count;
+
+    FILE* file = fopen(filename, "wb");
+    int error = file == NULL ||
+        fwrite(writer.bytes, 1, writer.length, file) != writer.length;
+    if (file && fclose(file)) {
+        error = 1;
+    }
+    catis_free(procedures);
+    catis_free(writer.bytes);
+    catis_free(writer.object);
+    catis_free(writer.seen);
+    catis_free(writer.seen_index);
+    return error;
+}
+
+/* count records of unit bytes at offset, all of them inside the image */
+static inline int image_holds(size_t size, uint64_t offset, uint64_t count, size_t unit) {
+    return offset % 8 == 0 && offset <= size && count <= (size - offset) / unit;
+}
+
+/* an immediate, or the offset of one of the objects of the image */
+static inline int image_reference(catis_image_header* header, catis_object* reference) {
+    uintptr_t tag = (uintptr_t)reference & CATIS_TAG_MASK;
+    if (tag) {
+        return tag == CATIS_TAG_INT || tag == CATIS_TAG_BOOL;
+    }
+    uint64_t offset = (uintptr_t)reference;
+    return offset >= header->object_offset &&
+        (offset - header->object_offset) / sizeof(catis_object) < header->object_count &&
+        (offset - header->object_offset) % sizeof(catis_object) == 0;
+}
+
+/* the type of the object an image reference is to, checked before */
+static inline int image_type(char* base, catis_object* reference) {
+    if (is_immediate(reference)) {
+        return object_type(reference);
+    }
+    return ((catis_object*)(base + (uintptr_t)reference))->type;
+}
+
+/* the file stays mapped for good, its objects are in use */
+int load_image(catis_context* context, const char* filename) {
+    int descriptor = open(filename, O_RDONLY);
+    if (descriptor < 0) {
+        perror("Opening image");
+        return 1;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) || (size_t)status.st_size < sizeof(catis_image_header)) {
+        fprintf(stderr, "Not a catis image: %s\n", filename);
+        close(descriptor);
+        return 1;
+    }
+    size_t size = status.st_size;
+    // every page gets fixed up, fault them in at once
+    char* base = mmap(
+        NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_POPULATE, descriptor, 0
+    );
+    close(descriptor);
+    if (base == MAP_FAILED) {
+        perror("Mapping image");
+        return 1;
+    }
+
+    catis_image_header* header = (catis_image_header*)base;
+    if (
+        memcmp(header->magic, CATIS_IMAGE_MAGIC, sizeof(header->magic)) ||
+        header->version != CATIS_IMAGE_VERSION ||
+        header->object_size != sizeof(catis_object) ||
+        header->size != size
+    ) {
+        fprintf(stderr, "Not an image of this catis: %s\n", filename);
+        munmap(base, size);
+        return 1;
+    }
+
+    // every offset is checked against the file before it is followed
+    if (
+        !image_holds(size, header->object_offset, header->object_count, sizeof(catis_object)) ||
+        !image_holds(
+            size, header->procedure_offset,
+            header->procedure_count, sizeof(catis_image_procedure)
+        )
+    ) {
+        goto corrupt;
+    }
+    catis_object* objects = (catis_object*)(base + header->object_offset);
+    for (size_t i = 0; i < header->object_count; i++) {
+        catis_object* object = objects + i;
+        // whatever the file says, they are never freed
+        object->reference_count = CATIS_IMAGE_PINNED;
+        if (object->type == CATIS_TYPE_STRING || object->type == CATIS_TYPE_SYMBOL) {
+            uintptr_t characters = (uintptr_t)object->string_or_symbol.pointer;
+            size_t length = object->string_or_symbol.length;
+            if (
+                !image_holds(size, characters, length, 1) ||
+                characters + length == size ||
+                base[characters + length] != 0
+            ) {
+                goto corrupt;
+            }
+            object->string_or_symbol.pointer += (uintptr_t)base;
+            if (object->type == CATIS_TYPE_SYMBOL) {
+                object->string_or_symbol.atom = intern(
+                    object->string_or_symbol.pointer,
+                    object->string_or_symbol.length
+                );
+            }
+            continue;
+        }
+        if (object->type == CATIS_TYPE_RANGE) {
+            continue;
+        }
+        if (object->type == CATIS_TYPE_VECTOR) {
+            uintptr_t elements = (uintptr_t)object->vector.element;
+            if (!image_holds(size, elements, object->vector.length, sizeof(int))) {
+                goto corrupt;
+            }
+            object->vector.element = (int*)(base + elements);
+            continue;
+        }
+        if (object->type == CATIS_TYPE_DICT) {
+            uintptr_t entries = (uintptr_t)object->dict.entry;
+            size_t capacity = object->dict.capacity;
+            if (
+                !image_holds(size, entries, capacity, sizeof(catis_entry)) ||
+                (capacity & (capacity - 1)) ||
+                object->dict.length > capacity
+            ) {
+                goto corrupt;
+            }
+            object->dict.entry = (catis_entry*)(base + entries);
+            for (size_t j = 0; j < capacity; j++) {
+                catis_entry* entry = object->dict.entry + j;
+                if (
+                    entry->key && (
+                        !image_reference(header, entry->key) ||
+                        !image_reference(header, entry->value) ||
+                        !(image_type(base, entry->key) & (
+                            CATIS_TYPE_INT | CATIS_TYPE_BOOL |
+                            CATIS_TYPE_STRING | CATIS_TYPE_SYMBOL
+                        ))
+                    )
+                ) {
+                    goto corrupt;
+                }
+                if (entry->key && !is_immediate(entry->key)) {
+                    entry->key = (catis_object*)(base + (uintptr_t)entry->key);
+                }
+                if (entry->key && !is_immediate(entry->value)) {
+                    entry->value = (catis_object*)(base + (uintptr_t)entry->value);
+                }
+            }
+            continue;
+        }
+        uintptr_t elements = (uintptr_t)object->collection.element;
+        if (
+            (
+                object->type != CATIS_TYPE_LIST &&
+                object->type != CATIS_TYPE_TUPLE &&
+                object->type != CATIS_TYPE_CAPTURE
+            ) ||
+            !image_holds(size, elements, object->collection.length, sizeof(uintptr_t))
+        ) {
+            goto corrupt;
+        }
+        object->collection.element = (catis_object**)(base + elements);
+        for (size_t j = 0; j < object->collection.length; j++) {
+            catis_object* element = object->collection.element[j];
+            if (!image_reference(header, element)) {
+                goto corrupt;
+            }
+            if (!is_immediate(element)) {
+                object->collection.element[j] =
+                    (catis_object*)(base + (uintptr_t)element);
+            }
+        }
+    }
+
+    // analysed on their first call, most of a prelude is never called
+    catis_image_procedure* records =
+        (catis_image_procedure*)(base + header->procedure_offset);
+    for (size_t i = 0; i < header->procedure_count; i++) {
+        catis_object* body = (catis_object*)(uintptr_t)records[i].body;
+        if (
+            records[i].name >= size ||
+            memchr(base + records[i].name, 0, size - records[i].name) == NULL ||
+            is_immediate(body) ||
+            !image_reference(header, body) ||
+            image_type(base, body) != CATIS_TYPE_LIST
+        ) {
+            goto corrupt;
+        }
+    }
+    lock_definitions(context->shared);
+    for (size_t i = 0; i < header->procedure_count; i++) {
+        bind_procedure(
+            context,
+            base + records[i].name,
+            NULL,
+            (catis_object*)(base + records[i].body)
+        );
+    }
+    unlock_definitions(context->shared);
+    return 0;
+
+corrupt:
+    fprintf(stderr, "Corrupt catis image: %s\n", filename);
+    munmap(base, size);
+    return 1;
+}
+
+/* -- repl -- */
+void repl(catis_context* context) {
+    char buffer[1024];
+    catis_output* output = &context->output;
+    while(1) {
+        output_string(output, "catis> ");
+        output_flush(output);
+
+        buffer[0] = '[';
+
+        if (fgets(buffer + 1, sizeof(buffer) - 2, stdin) == NULL) {
+            break;
+        }
+        size_t length = strlen(buffer);
+        if (length && buffer[length - 1] == '\n') {
+            buffer[--length] = 0;
+        }
+        if (length == 0) {
+            continue;
+        }
+
+        buffer[length] = ']';
+        buffer[length + 1] = 0;
+
+        catis_object* program = parse_object(context, buffer, NULL, NULL);
+        if (!program) {
+            output_string(output, "Parsing program: ");
+            output_string(output, context->error_string);
+            output_char(output, '\n');
+            continue;
+        }
+        if (eval_toplevel(context, program)) {
+            output_string(output, context->error_string);
+            output_char(output, '\n');
+        }
+        else {
+            stack_show(context);
+        }
+        release(program);
+        shrink_stack(context);
+    }
+    output_flush(output);
+}
+
+/*
+ * The whole file, NUL terminated. Mapped when it can be: a zeroed page is
+ * mapped first so that the byte past the end is there even when the size
+ * is a multiple of the page size. Pipes and the like are read instead.
+ */
+typedef struct catis_source {
+    char* text;
+    size_t length;
+    size_t mapped; // 0 if read into a catis_allocate buffer
+} catis_source;
+
+int open_source(const char* filename, catis_source* source) {
+    int descriptor = open(filename, O_RDONLY);
+    if (descriptor < 0) {
+        return 1;
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) == 0 && S_ISREG(status.st_mode)) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        source->length = status.st_size;
+        source->mapped = (source->length / page + 1) * page;
+        char* text = mmap(
+            NULL, source->mapped, PROT_READ,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+        );
+        if (
+            text != MAP_FAILED &&
+            (source->length == 0 || mmap(
+                text, source->length, PROT_READ,
+                MAP_PRIVATE | MAP_FIXED, descriptor, 0
+            ) != MAP_FAILED)
+        ) {
+            madvise(text, source->mapped, MADV_SEQUENTIAL);
+            source->text = text;
+            close(descriptor);
+            return 0;
+        }
+        if (text != MAP_FAILED) {
+            munmap(text, source->mapped);
+        }
+    }
+
+    size_t capacity = 64 * 1024;
+    source->text = catis_allocate(capacity);
+    source->length = 0;
+    source->mapped = 0;
+    ssize_t amount;
+    while (
+        (amount = read(
+            descriptor,
+            source->text + source->length,
+            capacity - source->length - 1
+        )) > 0
+    ) {
+        source->length += amount;
+        if (source->length + 1 == capacity) {
+            capacity = grown_capacity(capacity, capacity + 1);
+            source->text = catis_reallocate(source->text, capacity);
+        }
+    }
+    source->text[source->length] = 0;
+    close(descriptor);
+    if (amount < 0) {
+        catis_free(source->text);
+        return 1;
+    }
+    return 0;
+}
+
+void close_source(catis_source* source) {
+    if (source->mapped) {
+        munmap(source->text, source->mapped);
+    }
+    else {
+        catis_free(source->text);
+    }
+}
+
+/* pages already parsed are given back, big data files are read once */
+void discard_source(catis_source* source, const char* read) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t consumed = (read - source->text) / page * page;
+    if (source->mapped && consumed) {
+        madvise(source->text, consumed, MADV_DONTNEED);
+    }
+}
+
+/* form by form up to the first error, each released unless kept by a define */
+int eval_forms(catis_context* context, catis_source* source) {
+    int line = 1;
+    int return_value = 0;
+    const char* next = source->text;
+    const char* discarded = next;
+    catis_object* program = new_list(1);
+    while (1) {
+        next = consume_space_and_comment(next, &line);
+        if (next[0] == 0) {
+            break;
+        }
+        catis_object* form = parse_object(context, next, &next, &line);
+        if (!form) {
+            output_string(&context->output, "Parsing program: ");
+            output_string(&context->output, context->error_string);
+            output_char(&context->output, '\n');
+            return_value = 1;
+            break;
+        }
+
+        // the one element program is reused, unless a define kept it
+        if (count_of(&program->reference_count) > 1) {
+            release(program);
+            program = new_list(1);
+        }
+        program->collection.element[0] = form;
+        program->collection.length = 1;
+        return_value = eval_program(context, program);
+        program->collection.length = 0;
+        release(form);
+        if (return_value) {
+            output_error(context);
+            break;
+        }
+        if (context->fired) {
+            // like the repl, the bodies it fired run before the next form
+            context->fired = 0;
+            leave_shared(context->shared);
+            wait_for_tasks(context->shared);
+        }
+
+        if (next - discarded > 16 * 1024 * 1024) {
+            discard_source(source, next);
+            discarded = next;
+        }
+    }
+    release(program);
+    output_flush(&context->output);
+    leave_shared(context->shared);
+    wait_for_tasks(context->shared);
+    return return_value;
+}
+
+/* the arguments pushed, then the source, the rest of the options and the repl */
+int run_source(
+    catis_context* context,
+    catis_source* source,
+    char** argv,
+    int argc,
+    catis_options* options
+) {
+    for (int i = 0; i < argc; i++) {
+        catis_object* object = parse_object(NULL, argv[i], NULL, 0);
+        if (!object) {
+            printf("Parsing program: %s\n", context->error_string);
+            release(object);
+            return 1;
+        }
+        stack_push(context, object);
+    }
+
+    if (options->profile) {
+        start_profile(context);
+    }
+    int return_value = eval_forms(context, source);
+
+    if (options->profile) {
+        stop_profile(context);
+        print_profile(context, context->last_profile, stderr);
+        if (write_folded_profile(context->last_profile, options->profile)) {
+            perror("Writing profile");
+        }
+    }
+    if (options->save_image && save_image(context, options->save_image)) {
+        perror("Saving image");
+        return_value = 1;
+    }
+    shrink_stack(context);
+    repl(context);
+    if (options->stats) {
+        print_stats(context, stderr);
+    }
+    return return_value;
+}
+
+int eval_source(
+    catis_source* source,
+    char** argv,
+    int argc,
+    catis_options* options
+) {
+    catis_context* context = new_interpreter();
+    reserve_stack(context, options->stack_size);
+    if (options->load_image && load_image(context, options->load_image)) {
+        return 1;
+    }
+    if (options->load_compiled) {
+        options->load_compiled(context);
+    }
+    return run_source(context, source, argv, argc, options);
+}
+
+int eval_file(
+    const char* filename,
+    char** argv,
+    int argc,
+    catis_options* options
+) {
+    catis_source source;
+    if (open_source(filename, &source)) {
+        perror("Opening file");
+        return 1;
+    }
+    int return_value = eval_source(&source, argv, argc, options);
+    close_source(&source);
+    return return_value;
+}
+
+/* -- server -- */
+/*
+ * catis --serve loads the library, an image and prelude files once, then
+ * forks for every client: the child starts from that warm interpreter,
+ * copy on write, and runs the client's file as eval_file would. The client
+ * sends its standard input, output and error along with the request, so
+ * the child reads and writes them directly and only the exit status comes
+ * back on the socket.
+ *
+ * A request is a length, then NUL terminated strings: the directory of
+ * the client, the file and its arguments.
+ */
+#define CATIS_REQUEST_SIZE (64 * 1024)
+
+int unix_socket_address(const char* path, struct sockaddr_un* address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+/* in the forked child, the exit status of the run */
+int serve_request(catis_context* context, int connection, catis_options* options) {
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    uint32_t size;
+    struct iovec vector = { &size, sizeof(size) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(connection, &message, MSG_WAITALL) != sizeof(size)) {
+        return 1;
+    }
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if (
+        header == NULL ||
+        header->cmsg_type != SCM_RIGHTS ||
+        header->cmsg_len != CMSG_LEN(3 * sizeof(int)) ||
+        size == 0 || size > CATIS_REQUEST_SIZE
+    ) {
+        return 1;
+    }
+    int descriptor[3];
+    memcpy(descriptor, CMSG_DATA(header), sizeof(descriptor));
+    for (int i = 0; i < 3; i++) {
+        dup2(descriptor[i], i);
+        close(descriptor[i]);
+    }
+
+    char* request = catis_allocate(size);
+    if (recv(connection, request, size, MSG_WAITALL) != (ssize_t)size || request[size - 1]) {
+        return 1;
+    }
+    int count = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        count += request[i] == 0;
+    }
+    if (count < 2) {
+        return 1;
+    }
+    char** argv = catis_allocate(sizeof(char*) * count);
+    char* string = request;
+    for (int i = 0; i < count; i++) {
+        argv[i] = string;
+        string += strlen(string) + 1;
+    }
+    if (chdir(argv[0])) {
+        perror("Changing directory");
+        return 1;
+    }
+
+    catis_source source;
+    if (open_source(argv[1], &source)) {
+        perror("Opening file");
+        return 1;
+    }
+    int return_value = run_source(context, &source, argv + 2, count - 2, options);
+    close_source(&source);
+    return return_value;
+}
+
+int serve(const char* path, char** prelude, int count, catis_options* options) {
+    catis_context* context = new_interpreter();
+    reserve_stack(context, options->stack_size);
+    if (options->load_image && load_image(context, options->load_image)) {
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        catis_source source;
+        if (open_source(prelude[i], &source)) {
+            perror("Opening file");
+            return 1;
+        }
+        int error = eval_forms(context, &source);
+        close_source(&source);
+        if (error) {
+            return 1;
         }
-    } else {
-        procedure = new_procedure(context, name);
     }
-    procedure->procedure = list;
-    procedure->c_procedure = c_procedure;
+    shrink_stack(context);
+    // every run would write it over
+    options->save_image = NULL;
+
+    struct sockaddr_un address;
+    if (unix_socket_address(path, &address)) {
+        return 1;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (
+        listener < 0 ||
+        bind(listener, (struct sockaddr*)&address, sizeof(address)) ||
+        listen(listener, 128)
+    ) {
+        perror("Serving");
+        return 1;
+    }
+    // the children are never waited for
+    signal(SIGCHLD, SIG_IGN);
+    fflush(stdout);
+
+    while (1) {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("Accepting");
+            return 1;
+        }
+        pid_t child = fork();
+        if (child == 0) {
+            close(listener);
+            signal(SIGCHLD, SIG_DFL);
+            // the workers of the pool stayed in the parent
+            context->shared->pool = NULL;
+            char status = serve_request(context, connection, options) != 0;
+            output_flush(&context->output);
+            fflush(stdout);
+            fflush(stderr);
+            if (write(connection, &status, 1) != 1) {
+                _exit(1);
+            }
+            _exit(status);
+        }
+        if (child < 0) {
+            perror("Forking");
+        }
+        close(connection);
+    }
 }
 
-int add_string_procedure(
+int connect_server(const char* path, char** argv, int argc) {
+    struct sockaddr_un address;
+    if (unix_socket_address(path, &address)) {
+        return 1;
+    }
+    char directory[PATH_MAX];
+    if (getcwd(directory, sizeof(directory)) == NULL) {
+        perror("Getting the directory");
+        return 1;
+    }
+    size_t size = strlen(directory) + 1;
+    for (int i = 0; i < argc; i++) {
+        size += strlen(argv[i]) + 1;
+    }
+    if (size > CATIS_REQUEST_SIZE) {
+        fprintf(stderr, "Request too long\n");
+        return 1;
+    }
+    char* request = catis_allocate(sizeof(uint32_t) + size);
+    uint32_t length = size;
+    memcpy(request, &length, sizeof(length));
+    char* string = request + sizeof(length);
+    strcpy(string, directory);
+    string += strlen(directory) + 1;
+    for (int i = 0; i < argc; i++) {
+        strcpy(string, argv[i]);
+        string += strlen(argv[i]) + 1;
+    }
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (
+        connection < 0 ||
+        connect(connection, (struct sockaddr*)&address, sizeof(address))
+    ) {
+        perror("Connecting");
+        return 1;
+    }
+
+    // standard input, output and error go with the length
+    int descriptor[3] = { 0, 1, 2 };
+    char control[CMSG_SPACE(sizeof(descriptor))];
+    memset(control, 0, sizeof(control));
+    struct iovec vector = { request, sizeof(length) };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(descriptor));
+    memcpy(CMSG_DATA(header), descriptor, sizeof(descriptor));
+    if (
+        sendmsg(connection, &message, 0) != sizeof(length) ||
+        send(connection, request + sizeof(length), size, 0) != (ssize_t)size
+    ) {
+        perror("Sending the request");
+        return 1;
+    }
+    catis_free(request);
+
+    char status;
+    if (recv(connection, &status, 1, MSG_WAITALL) != 1) {
+        fprintf(stderr, "The server gave no exit status\n");
+        return 1;
+    }
+    close(connection);
+    return status;
+}
+
+/* -- ahead of time compilation -- */
+/*
+ * catis -c writes the procedures a file defines out as C: the bytecode of
+ * each body becomes straight line C calling the library directly, locals
+ * are C variables and the jumps of if, if-else and while are gotos. The
+ * output includes this file, built with -Isrc it is the file as a program,
+ * see the Tupfile. The top level and what was not compiled still run in
+ * the interpreter, from the source kept in the output.
+ *
+ * A compiled body runs in its caller's frame, like any C procedure, so
+ * only bodies that do not need one of their own are compiled: no capture
+ * or $ load in a list handed to someone else, nothing reaching the caller's
+ * frame, and a name defined once. Calls between compiled procedures are
+ * frozen, rebinding one of them later does not change the others.
+ */
+
+/* the C names of the library, to call it directly from compiled code */
+typedef struct catis_native_name {
+    int (*c_procedure)(catis_context*);
+    const char* name;
+} catis_native_name;
+
+#define NATIVE_NAME(function) { function, #function }
+const catis_native_name native_names[] = {
+    NATIVE_NAME(library_math),
+    NATIVE_NAME(library_compare),
+    NATIVE_NAME(library_logic),
+    NATIVE_NAME(library_sort),
+    NATIVE_NAME(library_sort_by),
+    NATIVE_NAME(library_define),
+    NATIVE_NAME(library_if),
+    NATIVE_NAME(library_eval),
+    NATIVE_NAME(library_print),
+    NATIVE_NAME(library_println),
+    NATIVE_NAME(library_flush),
+    NATIVE_NAME(library_length),
+    NATIVE_NAME(library_list_append),
+    NATIVE_NAME(library_at),
+    NATIVE_NAME(library_show_stack),
+    NATIVE_NAME(library_concatenate),
+    NATIVE_NAME(library_to_tuple),
+    NATIVE_NAME(library_join),
+    NATIVE_NAME(library_send),
+    NATIVE_NAME(library_define_memo),
+    NATIVE_NAME(library_parallel),
+    NATIVE_NAME(library_to_vector),
+    NATIVE_NAME(library_to_list),
+    NATIVE_NAME(library_vector_compare),
+    NATIVE_NAME(library_vector_reduce),
+    NATIVE_NAME(library_vector_shift),
+    NATIVE_NAME(library_vector_pick),
+    NATIVE_NAME(library_get),
+    NATIVE_NAME(library_put),
+    NATIVE_NAME(library_delete),
+    NATIVE_NAME(library_keys),
+    NATIVE_NAME(library_dup),
+    NATIVE_NAME(library_swap),
+    NATIVE_NAME(library_drop),
+    NATIVE_NAME(library_map),
+    NATIVE_NAME(library_each),
+    NATIVE_NAME(library_tail),
+    NATIVE_NAME(library_slice),
+    NATIVE_NAME(library_not),
+    NATIVE_NAME(library_range),
+};
+
+const char* native_name(int (*c_procedure)(catis_context*)) {
+    for (size_t i = 0; i < sizeof(native_names) / sizeof(*native_names); i++) {
+        if (native_names[i].c_procedure == c_procedure) {
+            return native_names[i].name;
+        }
+    }
+    return NULL;
+}
+
+/* what compiled code calls, the way the vm does it */
+static inline int compiled_call(
     catis_context* context,
-    const char* name,
-    const char* program
+    catis_procedure* procedure,
+    int (*c_procedure)(catis_context*),
+    int line
 ) {
-    catis_object* list = parse_object(NULL, program, NULL, NULL);
-    if (program == NULL || list == NULL) {
-        printf("%s -- %s\n", name, program);
+    catis_procedure* previous = context->frame->procedure;
+    context->frame->line = line;
+    context->c_caller = previous;
+    context->frame->procedure = procedure;
+    profile_call(context, procedure);
+    int error = c_procedure(context);
+    profile_return(context);
+    context->frame->procedure = previous;
+    return error;
+}
+
+/* a compiled procedure starts, recording who called it for error traces */
+static inline size_t compiled_enter(catis_context* context) {
+    size_t depth = context->control_length;
+    catis_control* control = push_control(context, CONTROL_COMPILED);
+    control->compiled.host = context->frame;
+    control->compiled.caller_procedure = context->c_caller;
+    control->compiled.caller_line = context->frame->line;
+    return depth;
+}
+
+/* the body of a procedure inlined at line starts, the frame's is the caller */
+static inline void compiled_inline(catis_context* context, int line) {
+    catis_control* control = push_control(context, CONTROL_COMPILED);
+    control->compiled.host = context->frame;
+    control->compiled.caller_procedure = context->frame->procedure;
+    control->compiled.caller_line = line;
+}
+
+/* back to depth, the frame as it was there: a tail call enters the same */
+static inline void compiled_leave(catis_context* context, size_t depth) {
+    while (context->control_length > depth) {
+        catis_control* control = top_control(context);
+        assert(control->kind == CONTROL_COMPILED);
+        context->c_caller = control->compiled.caller_procedure;
+        context->frame->line = control->compiled.caller_line;
+        context->control_length--;
+    }
+}
+
+/* whatever symbol names when called, through its call site cache */
+int compiled_call_symbol(catis_context* context, catis_object* symbol, int line) {
+    context->frame->line = line;
+    catis_procedure* procedure = resolve_procedure(context, symbol);
+    if (procedure == NULL) {
+        set_error(
+            context,
+            symbol->string_or_symbol.pointer,
+            "Symbol not bound to procedure"
+        );
         return 1;
     }
-    add_procedure(context, name, NULL, list);
+    return call_procedure(context, procedure);
+}
+
+/* pop the two ints on top for + - * and comparisons, if that is what they are */
+static inline int pop_integers(catis_context* context, int* a, int* b) {
+    size_t length = context->stack_length;
+    if (
+        length < 2 ||
+        ((uintptr_t)context->stack[length - 1] &
+        (uintptr_t)context->stack[length - 2] &
+        CATIS_TAG_MASK) != CATIS_TAG_INT
+    ) {
+        return 0;
+    }
+    *b = object_integer(context->stack[length - 1]);
+    *a = object_integer(context->stack[length - 2]);
+    context->stack_length -= 2;
+    return 1;
+}
+
+/* the boolean tested by procedure, if, if-else or while, -1 if none */
+static inline int compiled_condition(
+    catis_context* context,
+    catis_procedure* procedure,
+    int line
+) {
+    catis_object* condition = stack_pop(context);
+    if (condition && object_type(condition) == CATIS_TYPE_BOOL) {
+        return object_boolean(condition);
+    }
+    catis_procedure* previous = context->frame->procedure;
+    context->frame->line = line;
+    context->frame->procedure = procedure;
+    if (condition) {
+        stack_push(context, condition);
+    }
+    set_error(context, NULL, condition ? "Type mismatch" : "Out of stack");
+    context->frame->procedure = previous;
+    return -1;
+}
+
+void compiled_unbound(catis_context* context, const char* load, int line) {
+    context->frame->line = line;
+    set_error(context, load, "Unbound local variable");
+}
+
+/* names are the captured locals in order, the stack holds fewer */
+void compiled_short_capture(catis_context* context, const char* names, int line) {
+    char name[2] = { names[context->stack_length], 0 };
+    context->frame->line = line;
+    set_error(context, name, "Out of stack while capturing local");
+}
+
+/* object as catis source, parsed back when the compiled program loads */
+void write_literal(FILE* file, catis_object* object) {
+    switch (object_type(object)) {
+        case CATIS_TYPE_BOOL:
+            fputs(object_boolean(object) ? "#t" : "#f", file);
+            break;
+        case CATIS_TYPE_INT:
+            fprintf(file, "%d", object_integer(object));
+            break;
+        case CATIS_TYPE_SYMBOL:
+            fprintf(
+                file,
+                "%s%s",
+                object->string_or_symbol.quoted ? "'" : "",
+                object->string_or_symbol.pointer
+            );
+            break;
+        case CATIS_TYPE_STRING:
+            fputc('"', file);
+            for (size_t i = 0; i < object->string_or_symbol.length; i++) {
+                int character = object->string_or_symbol.pointer[i];
+                switch (character) {
+                    case '\n': fputs("\\n", file); break;
+                    case '\r': fputs("\\r", file); break;
+                    case '\t': fputs("\\t", file); break;
+                    case '"':  fputs("\\\"", file); break;
+                    case '\\': fputs("\\\\", file); break;
+                    default:   fputc(character, file); break;
+                }
+            }
+            fputc('"', file);
+            break;
+        case CATIS_TYPE_LIST:
+        case CATIS_TYPE_TUPLE:
+        case CATIS_TYPE_CAPTURE:
+            fputc(
+                object->type == CATIS_TYPE_LIST ? '[' :
+                object->type == CATIS_TYPE_TUPLE ? '(' : '{',
+                file
+            );
+            for (size_t i = 0; i < object->collection.length; i++) {
+                if (i) {
+                    fputc(' ', file);
+                }
+                write_literal(file, object->collection.element[i]);
+            }
+            fputc(
+                object->type == CATIS_TYPE_LIST ? ']' :
+                object->type == CATIS_TYPE_TUPLE ? ')' : '}',
+                file
+            );
+            break;
+        case CATIS_TYPE_VECTOR:
+            fputs("#[", file);
+            for (size_t i = 0; i < object->vector.length; i++) {
+                fprintf(file, i ? " %d" : "%d", object->vector.element[i]);
+            }
+            fputc(']', file);
+            break;
+        case CATIS_TYPE_DICT:
+            fputs("#{", file);
+            for (size_t i = 0, written = 0; i < object->dict.capacity; i++) {
+                catis_entry* entry = object->dict.entry + i;
+                if (entry->key == NULL) {
+                    continue;
+                }
+                if (written++) {
+                    fputc(' ', file);
+                }
+                write_literal(file, entry->key);
+                fputc(' ', file);
+                write_literal(file, entry->value);
+            }
+            fputc('}', file);
+            break;
+    }
+}
+
+/* bytes as a C string literal, a line of source per line of C */
+void write_c_string(FILE* file, const char* bytes, size_t length) {
+    fputc('"', file);
+    for (size_t i = 0; i < length; i++) {
+        unsigned char character = bytes[i];
+        switch (character) {
+            case '\n':
+                fputs(i + 1 < length ? "\\n\"\n    \"" : "\\n", file);
+                break;
+            case '\t': fputs("\\t", file); break;
+            case '"':  fputs("\\\"", file); break;
+            case '\\': fputs("\\\\", file); break;
+            case '?':  fputs("\\?", file); break; // no trigraphs
+            default:
+                if (character < ' ' || character >= 127) {
+                    fprintf(file, "\\%03o", character);
+                }
+                else {
+                    fputc(character, file);
+                }
+                break;
+        }
+    }
+    fputc('"', file);
+}
+
+/* does list, left for someone else to evaluate, touch locals */
+int reads_locals(catis_object* list) {
+    for (size_t i = 0; i < list->collection.length; i++) {
+        catis_object* object = list->collection.element[i];
+        switch (object_type(object)) {
+            case CATIS_TYPE_CAPTURE:
+                return 1;
+            case CATIS_TYPE_SYMBOL:
+                if (object->string_or_symbol.pointer[0] == '$') {
+                    return 1;
+                }
+                break;
+            case CATIS_TYPE_LIST:
+                if (reads_locals(object)) {
+                    return 1;
+                }
+                break;
+        }
+    }
     return 0;
 }
 
-/* -- the library -- */
-int library_math(catis_context* context) {
-    if (check_stack_type(context, 2, CATIS_TYPE_INT, CATIS_TYPE_INT)) { return 1; }
-    catis_object* object_b = stack_pop(context);
-    catis_object* object_a = stack_pop(context);
+/* a procedure of the file being compiled */
+typedef struct catis_definition {
+    catis_procedure* procedure;
+    size_t form; // the body, followed by the quoted name and define
+    int count; // definitions of the name in the file
+    catis_code* code; // NULL if left to the interpreter
+} catis_definition;
+
+/* what a compiled body refers to, loaded once by load_compiled */
+typedef struct catis_references {
+    catis_procedure** native; // called C procedures
+    size_t native_count;
+    catis_atom** symbol; // called catis procedures left to the interpreter
+    size_t symbol_count;
+    catis_object** constant; // pushed objects, neither ints nor booleans
+    size_t constant_count;
+} catis_references;
+
+size_t reference_pointer(void*** table, size_t* count, void* pointer) {
+    for (size_t i = 0; i < *count; i++) {
+        if ((*table)[i] == pointer) {
+            return i;
+        }
+    }
+    *table = catis_reallocate(*table, sizeof(void*) * (*count + 1));
+    (*table)[*count] = pointer;
+    return (*count)++;
+}
+
+size_t reference_native(catis_references* references, catis_procedure* procedure) {
+    return reference_pointer(
+        (void***)&references->native,
+        &references->native_count,
+        procedure
+    );
+}
 
-    int b = object_b->integer;
-    int a = object_a->integer;
+/* the symbols are made by name, one call site cache per name */
+size_t reference_symbol(catis_references* references, catis_atom* atom) {
+    return reference_pointer(
+        (void***)&references->symbol,
+        &references->symbol_count,
+        atom
+    );
+}
 
-    int result;
-    const char* function_name = context->frame->procedure->name;
-    if (function_name[0] == '+' && function_name[1] == 0) {
-        result = a + b;
+size_t reference_constant(catis_references* references, catis_object* object) {
+    return reference_pointer(
+        (void***)&references->constant,
+        &references->constant_count,
+        object
+    );
+}
+
+catis_definition* compiled_definition(
+    catis_definition* definition,
+    size_t count,
+    catis_procedure* procedure
+) {
+    for (size_t i = 0; i < count; i++) {
+        if (definition[i].procedure == procedure && definition[i].code) {
+            return definition + i;
+        }
     }
-    else if (function_name[0] == '-' && function_name[1] == 0) {
-        result = a - b;
+    return NULL;
+}
+
+/* the integer operator C has for a library procedure, NULL if none */
+const char* integer_operator(catis_procedure* procedure) {
+    if (
+        procedure->c_procedure == library_math &&
+        procedure->name[0] != '/'
+    ) {
+        return procedure->name;
     }
-    else if (function_name[0] == '*' && function_name[1] == 0) {
-        result = a * b;
+    return procedure->c_procedure == library_compare ? procedure->name : NULL;
+}
+
+/* the C for what procedure makes of ints a and b, + - * wrapping around */
+void integer_expression(char* expression, size_t size, catis_procedure* procedure) {
+    if (procedure->c_procedure == library_math) {
+        snprintf(expression, size, "new_integer(integer_math('%c', a, b))", procedure->name[0]);
     }
-    else if (function_name[0] == '/' && function_name[1] == 0) {
-        result = a / b;
+    else {
+        snprintf(expression, size, "new_boolean(a %s b)", procedure->name);
     }
+}
 
-    stack_push(context, new_integer(result));
-    release(object_b);
-    release(object_a);
-    return 0;
+void write_release_locals(FILE* file, const unsigned char* used) {
+    for (int name = 0; name < CATIS_MAX_LOCALVARS; name++) {
+        if (used[name]) {
+            fprintf(file, "    release(local_%d);\n", name);
+        }
+    }
 }
 
-int library_compare(catis_context* context) {
-    if (check_stack_length(context, 2)) { return 1; }
-    catis_object* b = stack_pop(context);
-    catis_object* a = stack_pop(context);
+void write_clear_locals(FILE* file, const unsigned char* used) {
+    for (int name = 0; name < CATIS_MAX_LOCALVARS; name++) {
+        if (used[name]) {
+            fprintf(file, "    release(local_%d);\n    local_%d = NULL;\n", name, name);
+        }
+    }
+}
+
+void write_load(FILE* file, const char* load, int line, int move) {
+    int name = (unsigned char)load[1];
+    fprintf(file, "    if (local_%d == NULL) {\n        compiled_unbound(context, ", name);
+    write_c_string(file, load, strlen(load));
+    fprintf(
+        file,
+        ", %d);\n"
+        "        goto error;\n"
+        "    }\n"
+        "    stack_push(context, local_%d);\n",
+        line, name
+    );
+    fprintf(file, move ? "    local_%d = NULL;\n" : "    retain(local_%d);\n", name);
+}
+
+void write_store(FILE* file, const char* names, size_t length, int line) {
+    fprintf(
+        file,
+        "    if (context->stack_length < %zu) {\n"
+        "        compiled_short_capture(context, ",
+        length
+    );
+    write_c_string(file, names, length);
+    fprintf(
+        file,
+        ", %d);\n"
+        "        goto error;\n"
+        "    }\n"
+        "    context->stack_length -= %zu;\n",
+        line, length
+    );
+    for (size_t j = 0; j < length; j++) {
+        int name = (unsigned char)names[j];
+        fprintf(
+            file,
+            "    release(local_%d);\n"
+            "    local_%d = context->stack[context->stack_length + %zu];\n",
+            name, name, j
+        );
+    }
+}
+
+void write_call_c(
+    FILE* file,
+    catis_references* references,
+    catis_procedure* procedure,
+    int line
+) {
+    size_t k = reference_native(references, procedure);
+    const char* name = native_name(procedure->c_procedure);
+    const char* operator = integer_operator(procedure);
+    char call[64];
+    if (name) {
+        snprintf(call, sizeof(call), "%s", name);
+    }
+    else {
+        snprintf(call, sizeof(call), "native[%zu]->c_procedure", k);
+    }
+    if (operator) {
+        char expression[64];
+        integer_expression(expression, sizeof(expression), procedure);
+        fprintf(
+            file,
+            "    if (pop_integers(context, &a, &b)) {\n"
+            "        stack_push(context, %s);\n"
+            "    }\n"
+            "    else ",
+            expression
+        );
+    }
+    else {
+        fprintf(file, "    ");
+    }
+    fprintf(
+        file,
+        "if (compiled_call(context, native[%zu], %s, %d)) {\n"
+        "        goto error;\n"
+        "    }\n",
+        k, call, line
+    );
+}
+
+/* the C function of definition[index], from its bytecode */
+void write_compiled_procedure(
+    FILE* file,
+    catis_definition* definition,
+    size_t count,
+    size_t index,
+    catis_references* references
+) {
+    catis_code* code = definition[index].code;
+    unsigned char used[CATIS_MAX_LOCALVARS];
+    unsigned char target[code->length + 1];
+    memset(used, 0, sizeof(used));
+    memset(target, 0, code->length + 1);
+    int integers = 0, condition = 0, restart = 0, error = 0;
+    for (size_t i = 0; i < code->length; i++) {
+        catis_instruction* instruction = code->instruction + i;
+        switch (instruction->opcode) {
+            case OP_LOAD_LOCAL:
+            case OP_MOVE_LOCAL:
+                used[instruction->operand] = 1;
+                error = 1;
+                break;
+            case OP_STORE_LOCALS:
+                for (size_t j = 0; j < instruction->object->collection.length; j++) {
+                    used[(unsigned char)instruction->object->collection.element[j]
+                        ->string_or_symbol.pointer[0]] = 1;
+                }
+                error = 1;
+                break;
+            case OP_COMPARE_LOCALS:
+                used[instruction->operand >> 8 & 255] = 1;
+                // fall through
+            case OP_INCREMENT_LOCAL:
+                used[instruction->operand & 255] = 1;
+                // fall through
+            case OP_CALL_C:
+            case OP_DUP:
+            case OP_SWAP:
+            case OP_DROP:
+            case OP_NOT:
+            case OP_MATH_INT:
+            case OP_COMPARE_INT:
+                integers |= integer_operator(instruction->procedure) != NULL;
+                error = 1;
+                break;
+            case OP_CALL_PROC:
+                if (
+                    instruction->operand &&
+                    instruction->procedure == definition[index].procedure
+                ) {
+                    restart = 1;
+                }
+                // compiled tail calls return what the callee does
+                error |= !instruction->operand || !compiled_definition(
+                    definition,
+                    count,
+                    instruction->procedure
+                );
+                break;
+            case OP_CALL_SYMBOL:
+                error = 1;
+                break;
+            case OP_JUMP:
+                target[instruction->operand] = 1;
+                break;
+            case OP_JUMP_UNLESS:
+                target[instruction->operand] = 1;
+                condition = error = 1;
+                break;
+        }
+    }
+
+    fprintf(file, "/* %s */\n", definition[index].procedure->name);
+    fprintf(file, "int compiled_%zu(catis_context* context) {\n", index);
+    for (int name = 0; name < CATIS_MAX_LOCALVARS; name++) {
+        if (used[name]) {
+            fprintf(file, "    catis_object* local_%d = NULL; /* %c */\n", name, name);
+        }
+    }
+    if (integers) {
+        fprintf(file, "    int a, b;\n");
+    }
+    if (condition) {
+        fprintf(file, "    int condition;\n");
+    }
+    fprintf(file, "    size_t entered = compiled_enter(context);\n");
+    if (restart) {
+        fprintf(file, "start:\n");
+    }
+
+    // where the inlined bodies being written end, innermost last
+    size_t inlined[code->length + 1];
+    size_t inlined_length = 0;
+    for (size_t i = 0; i < code->length; i++) {
+        catis_instruction* instruction = code->instruction + i;
+        if (target[i]) {
+            fprintf(file, "label_%zu:\n", i);
+        }
+        // after the label, jumps out of the body leave it too
+        while (inlined_length && inlined[inlined_length - 1] == i) {
+            inlined_length--;
+            fprintf(file, "    compiled_leave(context, entered + %zu);\n", inlined_length + 1);
+        }
+        switch (instruction->opcode) {
+            case OP_PUSH_CONST:
+            case OP_PUSH_FOLDED: {
+                // folded constants are frozen like the calls
+                catis_object* object = instruction->object;
+                if (object_type(object) == CATIS_TYPE_INT) {
+                    fprintf(
+                        file,
+                        "    stack_push(context, new_integer(%d));\n",
+                        object_integer(object)
+                    );
+                }
+                else if (object_type(object) == CATIS_TYPE_BOOL) {
+                    fprintf(
+                        file,
+                        "    stack_push(context, new_boolean(%d));\n",
+                        object_boolean(object)
+                    );
+                }
+                else {
+                    size_t k = reference_constant(references, object);
+                    fprintf(
+                        file,
+                        "    stack_push(context, constant[%zu]);\n"
+                        "    retain(constant[%zu]);\n",
+                        k, k
+                    );
+                }
+                break;
+            }
+
+            case OP_LOAD_LOCAL:
+            case OP_MOVE_LOCAL:
+                write_load(
+                    file,
+                    instruction->object->string_or_symbol.pointer,
+                    instruction->line,
+                    instruction->opcode == OP_MOVE_LOCAL
+                );
+                break;
+
+            case OP_STORE_LOCALS: {
+                catis_object* capture = instruction->object;
+                size_t length = capture->collection.length;
+                char names[length + 1];
+                for (size_t j = 0; j < length; j++) {
+                    names[j] = capture->collection.element[j]
+                        ->string_or_symbol.pointer[0];
+                }
+                write_store(file, names, length, instruction->line);
+                break;
+            }
+
+            case OP_COMPARE_LOCALS: {
+                char second[3] = { '$', instruction->operand >> 8 & 255, 0 };
+                write_load(
+                    file,
+                    instruction->object->string_or_symbol.pointer,
+                    instruction->line,
+                    0
+                );
+                write_load(file, second, instruction->line, 0);
+                write_call_c(file, references, instruction->procedure, instruction->line);
+                break;
+            }
 
-    int comparison = compare(a, b);
-    if (comparison == COMPARE_TYPE_MISMATCH) {
-        stack_push(context, a);
-        stack_push(context, b);
-        set_error(context, NULL, "Type mismatch in comparison");
-        return 1;
-    }
+            case OP_INCREMENT_LOCAL: {
+                char name = instruction->operand & 255;
+                int delta = (int)(instruction->operand >> 32);
+                if (instruction->procedure->name[0] == '-') {
+                    delta = integer_math('-', 0, delta);
+                }
+                write_load(
+                    file,
+                    instruction->object->string_or_symbol.pointer,
+                    instruction->line,
+                    1
+                );
+                fprintf(file, "    stack_push(context, new_integer(%d));\n", delta);
+                write_call_c(file, references, instruction->procedure, instruction->line);
+                write_store(file, &name, 1, instruction->line);
+                break;
+            }
 
-    int result;
-    const char* function_name = context->frame->procedure->name;
-    if (function_name[1] == '=') {
-        switch (function_name[0]) {
-            case '=': result = comparison == 0; break;
-            case '!': result = comparison != 0; break;
-            case '<': result = comparison <= 0; break;
-            case '>': result = comparison >= 0; break;
-        }
-    }
-    else {
-        switch (function_name[0]) {
-            case '<': result = comparison < 0; break;
-            case '>': result = comparison > 0; break;
-        }
-    }
-    stack_push(context, new_boolean(result));
-    release(a);
-    release(b);
-    return 0;
-}
+            case OP_CALL_C:
+            case OP_DUP:
+            case OP_SWAP:
+            case OP_DROP:
+            case OP_NOT:
+                write_call_c(file, references, instruction->procedure, instruction->line);
+                break;
 
-int library_logic(catis_context* context) {
-    if (check_stack_type(context, 2, CATIS_TYPE_BOOL, CATIS_TYPE_BOOL)) { return 1; }
-    catis_object* object_b = stack_pop(context);
-    catis_object* object_a = stack_pop(context);
+            case OP_MATH_INT:
+            case OP_COMPARE_INT: {
+                // proved ints, no checks
+                char expression[64];
+                integer_expression(expression, sizeof(expression), instruction->procedure);
+                fprintf(
+                    file,
+                    "    b = object_integer(context->stack[--context->stack_length]);\n"
+                    "    a = object_integer(context->stack[--context->stack_length]);\n"
+                    "    stack_push(context, %s);\n",
+                    expression
+                );
+                break;
+            }
 
-    int b = object_b->boolean;
-    int a = object_a->boolean;
+            case OP_INLINE:
+                // its body follows, calls are frozen anyway
+                fprintf(file, "    compiled_inline(context, %d);\n", instruction->line);
+                inlined[inlined_length++] = instruction->operand;
+                break;
 
-    int result;
-    const char* function_name = context->frame->procedure->name;
-    if (function_name[0] == '&' && function_name[1] == 0) {
-        result = a && b;
-    }
-    else if (function_name[0] == '|' && function_name[1] == 0) {
-        result = a || b;
-    }
+            case OP_CALL_PROC: {
+                catis_definition* callee = compiled_definition(
+                    definition,
+                    count,
+                    instruction->procedure
+                );
+                if (callee == NULL) {
+                    // a catis procedure left to the interpreter
+                    size_t k = reference_symbol(
+                        references,
+                        instruction->procedure->atom
+                    );
+                    fprintf(
+                        file,
+                        "    if (compiled_call_symbol(context, symbol[%zu], %d)) {\n"
+                        "        goto error;\n"
+                        "    }\n",
+                        k, instruction->line
+                    );
+                    break;
+                }
+                if (instruction->operand && callee == definition + index) {
+                    // self tail call, a loop
+                    write_clear_locals(file, used);
+                    fprintf(file, "    compiled_leave(context, entered + 1);\n    goto start;\n");
+                }
+                else if (instruction->operand) {
+                    // the callee takes over the caller's entry
+                    write_release_locals(file, used);
+                    fprintf(
+                        file,
+                        "    compiled_leave(context, entered);\n"
+                        "    context->frame->procedure = compiled[%zu];\n"
+                        "    return compiled_%zu(context);\n",
+                        (size_t)(callee - definition),
+                        (size_t)(callee - definition)
+                    );
+                }
+                else {
+                    fprintf(
+                        file,
+                        "    if (compiled_call(context, compiled[%zu], compiled_%zu, %d)) {\n"
+                        "        goto error;\n"
+                        "    }\n",
+                        (size_t)(callee - definition),
+                        (size_t)(callee - definition),
+                        instruction->line
+                    );
+                }
+                break;
+            }
 
-    stack_push(context, new_boolean(result));
-    release(object_b);
-    release(object_a);
-    return 0;
-}
+            case OP_CALL_SYMBOL: {
+                size_t k = reference_symbol(
+                    references,
+                    instruction->object->string_or_symbol.atom
+                );
+                fprintf(
+                    file,
+                    "    if (compiled_call_symbol(context, symbol[%zu], %d)) {\n"
+                    "        goto error;\n"
+                    "    }\n",
+                    k, instruction->line
+                );
+                break;
+            }
 
-int library_sort(catis_context* context) {
-    if (check_stack_type(context, 1, CATIS_TYPE_LIST)) { return 1; }
-    catis_object* list = stack_pop(context);
-    list = get_unshared_object(list);
-    qsort(
-        list->collection.element,
-        list->collection.length,
-        sizeof(catis_object*),
-        quicksort_object_comparison
-    );
-    stack_push(context, list);
-    return 0;
-}
+            case OP_JUMP:
+                fprintf(file, "    goto label_%zu;\n", instruction->operand);
+                break;
 
-int library_define(catis_context* context) {
-    if (check_stack_type(context, 2, CATIS_TYPE_LIST, CATIS_TYPE_SYMBOL)) { return 1; }
-    catis_object* symbol = stack_pop(context);
-    catis_object* program = stack_pop(context);
-    add_procedure(context, symbol->string_or_symbol.pointer, NULL, program);
-    release(symbol);
-    return 0;
-}
+            case OP_JUMP_UNLESS:
+                fprintf(
+                    file,
+                    "    condition = compiled_condition(context, native[%zu], %d);\n"
+                    "    if (condition < 0) {\n"
+                    "        goto error;\n"
+                    "    }\n"
+                    "    if (!condition) {\n"
+                    "        goto label_%zu;\n"
+                    "    }\n",
+                    reference_native(references, instruction->procedure),
+                    instruction->line,
+                    instruction->operand
+                );
+                break;
 
-int library_if(catis_context* context) {
-    int is_while = context->frame->procedure->name[0] == 'w';
-    int is_else  = context->frame->procedure->name[3] == 'e';
-    int return_value = 1;
-    if (is_else) {
-        if (check_stack_type(
-            context,
-            3,
-            CATIS_TYPE_LIST,
-            CATIS_TYPE_LIST,
-            CATIS_TYPE_LIST
-        )) {
-            return 1;
+            case OP_RETURN:
+                write_release_locals(file, used);
+                fprintf(file, "    compiled_leave(context, entered);\n    return 0;\n");
+                break;
         }
     }
-    else {
-        if (check_stack_type(context, 2, CATIS_TYPE_LIST, CATIS_TYPE_LIST)) { return 1; }
+    if (error) {
+        fprintf(file, "error:\n");
+        write_release_locals(file, used);
+        fprintf(file, "    compiled_leave(context, entered);\n    return 1;\n");
     }
+    fprintf(file, "}\n\n");
+}
 
-    catis_object* else_branch;
-    catis_object* if_branch;
-    catis_object* condition;
-    else_branch = is_else ? stack_pop(context) : NULL;
-    if_branch   = stack_pop(context);
-    condition   = stack_pop(context);
+/*
+ * Parse the file form by form, find its `[body] 'name define` forms and
+ * compile those it can to file. The copy of the source in the output has
+ * them blanked out, keeping the lines, since the program starts with them.
+ */
+int compile_file(const char* filename, FILE* file) {
+    catis_source source;
+    if (open_source(filename, &source)) {
+        perror("Opening file");
+        return 1;
+    }
+    catis_context* context = new_interpreter();
 
+    catis_object** form = NULL;
+    size_t* start = NULL; // where each form is in the source, to its end
+    size_t form_count = 0;
+    int line = 1;
+    const char* next = source.text;
     while (1) {
-        if (eval(context, condition)) {
-            goto return_error;
+        next = consume_space_and_comment(next, &line);
+        if (next[0] == 0) {
+            break;
         }
-        if (check_stack_type(context, 1, CATIS_TYPE_BOOL)) { goto return_error; }
-        catis_object* conditional_result = stack_pop(context);
-        int result = conditional_result->boolean;
-        release(conditional_result);
+        const char* begin = next;
+        catis_object* object = parse_object(context, next, &next, &line);
+        if (object == NULL) {
+            fprintf(stderr, "Parsing program: %s\n", context->error_string);
+            close_source(&source);
+            return 1;
+        }
+        form = catis_reallocate(form, sizeof(*form) * (form_count + 1));
+        start = catis_reallocate(start, sizeof(*start) * (form_count + 2));
+        form[form_count] = object;
+        start[form_count++] = begin - source.text;
+        start[form_count] = next - source.text;
+    }
 
-        if (result) {
-            if (eval(context, if_branch)) {
-                goto return_error;
-            }
-            if (is_while) {
-                continue;
-            }
+    // every definition first, calls between them are bound at compile time
+    catis_definition* definition = NULL;
+    size_t count = 0;
+    for (size_t i = 0; i + 2 < form_count; i++) {
+        catis_object* name = form[i + 1];
+        catis_object* define = form[i + 2];
+        if (
+            object_type(form[i]) != CATIS_TYPE_LIST ||
+            object_type(name) != CATIS_TYPE_SYMBOL ||
+            !name->string_or_symbol.quoted ||
+            object_type(define) != CATIS_TYPE_SYMBOL ||
+            define->string_or_symbol.quoted ||
+            strcmp(define->string_or_symbol.pointer, "define")
+        ) {
+            continue;
         }
-        else if (is_else) {
-            if (eval(context, else_branch)) {
-                goto return_error;
+        catis_definition* same = NULL;
+        for (size_t j = 0; j < count; j++) {
+            if (definition[j].procedure->atom == name->string_or_symbol.atom) {
+                same = definition + j;
             }
         }
-        break;
+        if (same) {
+            same->count++;
+            continue;
+        }
+        if (lookup_atom_procedure(context, name->string_or_symbol.atom)) {
+            // rebinds the library, only from there on
+            continue;
+        }
+        retain(form[i]);
+        add_procedure(context, name->string_or_symbol.pointer, NULL, form[i]);
+        definition = catis_reallocate(definition, sizeof(*definition) * (count + 1));
+        definition[count].procedure = lookup_atom_procedure(
+            context,
+            name->string_or_symbol.atom
+        );
+        definition[count].form = i;
+        definition[count].count = 1;
+        definition[count].code = NULL;
+        count++;
+        i += 2;
     }
-    return_value = 0;
-
-return_error:
-    release(condition);
-    release(if_branch);
-    release(else_branch);
-    return return_value;
-}
-
-int library_eval(catis_context* context) {
-    if (check_stack_type(context, 1, CATIS_TYPE_LIST)) { return 1; }
-    catis_object* list = stack_pop(context);
-    int return_value = eval(context, list);
-    release(list);
-    return return_value;
-}
 
-int library_up_eval(catis_context* context) {
-    if (check_stack_type(context, 1, CATIS_TYPE_LIST)) { return 1; }
-    catis_object* list = stack_pop(context);
-    stackframe* saved = NULL;
-    if (context->frame->previous) {
-        saved = context->frame;
-        context->frame = context->frame->previous;
+    for (size_t i = 0; i < count; i++) {
+        analyze_procedure(context, definition[i].procedure, 0);
     }
-    int return_value = eval(context, list);
-    if (saved) {
-        context->frame = saved;
+    for (size_t i = 0; i < count; i++) {
+        catis_procedure* procedure = definition[i].procedure;
+        if (definition[i].count > 1 || procedure->uses_caller_frame) {
+            continue;
+        }
+        catis_code* code = compile(context, procedure->procedure);
+        int frameless = 1;
+        for (size_t j = 0; j < code->length; j++) {
+            catis_object* object = code->instruction[j].object;
+            if (
+                code->instruction[j].opcode == OP_PUSH_CONST &&
+                object_type(object) == CATIS_TYPE_LIST &&
+                reads_locals(object)
+            ) {
+                frameless = 0;
+            }
+        }
+        // a body sure to fail stays with define, which reports it
+        if (frameless && !code->mistyped) {
+            definition[i].code = code;
+        }
+        else {
+            release_code(code);
+        }
     }
-    release(list);
-    return return_value;
-}
-
-int library_print(catis_context* context) {
-    if (check_stack_length(context, 1)) { return 1; }
-    catis_object* object = stack_pop(context);
-    print_object(object, PRINT_RAW);
-    release(object);
-    return 0;
-}
 
-int library_println(catis_context* context) {
-    if (check_stack_length(context, 1)) { return 1; }
-    library_print(context);
-    printf("\n");
-    return 0;
-}
+    fprintf(file, "/* compiled from %s by catis -c */\n", filename);
+    fprintf(file, "#define CATIS_COMPILED\n#include \"main.c\"\n\n");
+    for (size_t i = 0; i < count; i++) {
+        if (definition[i].code == NULL) {
+            fprintf(
+                file,
+                "// %s is left to the interpreter\n",
+                definition[i].procedure->name
+            );
+        }
+    }
 
-int library_length(catis_context* context) {
-    if (check_stack_type(
-        context,
-        1,
-        CATIS_TYPE_LIST   |
-        CATIS_TYPE_TUPLE  |
-        CATIS_TYPE_STRING |
-        CATIS_TYPE_SYMBOL
-    )) {
-        return 1;
+    // the bodies go to a buffer, the tables they fill in come first
+    char* bodies;
+    size_t bodies_length;
+    FILE* body = open_memstream(&bodies, &bodies_length);
+    catis_references references;
+    memset(&references, 0, sizeof(references));
+    for (size_t i = 0; i < count; i++) {
+        if (definition[i].code) {
+            write_compiled_procedure(body, definition, count, i, &references);
+        }
     }
-    catis_object* object = stack_pop(context);
-    int length;
-    switch (object->type) {
-        case CATIS_TYPE_LIST:
-        case CATIS_TYPE_TUPLE:
-            length = object->collection.length;
-            break;
-        case CATIS_TYPE_STRING:
-        case CATIS_TYPE_SYMBOL:
-            length = object->string_or_symbol.length;
-            break;
+    fclose(body);
+
+    fprintf(
+        file,
+        "\ncatis_procedure* native[%zu];\n"
+        "catis_procedure* compiled[%zu];\n"
+        "catis_object* symbol[%zu];\n"
+        "catis_object* constant[%zu];\n\n",
+        references.native_count + 1,
+        count + 1,
+        references.symbol_count + 1,
+        references.constant_count + 1
+    );
+    for (size_t i = 0; i < count; i++) {
+        if (definition[i].code) {
+            fprintf(file, "int compiled_%zu(catis_context* context);\n", i);
+        }
     }
-    release(object);
-    stack_push(context, new_integer(length));
-    return 0;
-}
+    fprintf(file, "\n");
+    fwrite(bodies, 1, bodies_length, file);
+    free(bodies);
+
+    fprintf(file, "void load_compiled(catis_context* context) {\n");
+    for (size_t i = 0; i < references.native_count; i++) {
+        fprintf(file, "    native[%zu] = lookup_procedure(context, ", i);
+        write_c_string(file, references.native[i]->name, strlen(references.native[i]->name));
+        fprintf(file, ");\n");
+    }
+    for (size_t i = 0; i < references.symbol_count; i++) {
+        catis_atom* atom = references.symbol[i];
+        fprintf(file, "    symbol[%zu] = parse_object(NULL, ", i);
+        write_c_string(file, atom->name, atom->length);
+        fprintf(file, ", NULL, NULL);\n");
+    }
+    for (size_t i = 0; i < references.constant_count; i++) {
+        char* text;
+        size_t length;
+        FILE* literal = open_memstream(&text, &length);
+        write_literal(literal, references.constant[i]);
+        fclose(literal);
+        fprintf(file, "    constant[%zu] = parse_object(NULL, ", i);
+        write_c_string(file, text, length);
+        fprintf(file, ", NULL, NULL);\n");
+        free(text);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (definition[i].code == NULL) {
+            continue;
+        }
+        size_t body = definition[i].form;
+        fprintf(file, "    add_native_procedure(\n        context, ");
+        write_c_string(
+            file,
+            definition[i].procedure->name,
+            strlen(definition[i].procedure->name)
+        );
+        fprintf(file, ", compiled_%zu,\n        ", i);
+        write_c_string(
+            file,
+            source.text + start[body],
+            start[body + 1] - start[body]
+        );
+        fprintf(file, "\n    );\n    compiled[%zu] = lookup_procedure(context, ", i);
+        write_c_string(
+            file,
+            definition[i].procedure->name,
+            strlen(definition[i].procedure->name)
+        );
+        fprintf(file, ");\n");
+    }
+    fprintf(file, "}\n\n");
 
-int library_list_append(catis_context* context) {
-    // (list element -- list')
-    if (check_stack_type(context, 2, CATIS_TYPE_LIST, CATIS_TYPE_ANY)) { return 1; }
-    catis_object* element = stack_pop(context);
-    catis_object* list = get_unshared_object(stack_pop(context));
-    list->collection.element = catis_reallocate(
-        list->collection.element,
-        sizeof(catis_object*) * (list->collection.length + 1)
-    );
-    list->collection.element[list->collection.length] = element;
-    list->collection.length++;
-    stack_push(context, list);
+    // the source without the compiled definitions, lines kept
+    char* text = catis_allocate(source.length + 1);
+    memcpy(text, source.text, source.length + 1);
+    for (size_t i = 0; i < count; i++) {
+        if (definition[i].code == NULL) {
+            continue;
+        }
+        size_t form_end = definition[i].form + 3;
+        for (size_t j = start[definition[i].form]; j < start[form_end]; j++) {
+            if (text[j] != '\n') {
+                text[j] = ' ';
+            }
+        }
+    }
+    fprintf(file, "const char compiled_source[] =\n    ");
+    write_c_string(file, text, source.length);
+    fprintf(file, ";\n");
+
+    catis_free(text);
+    close_source(&source);
     return 0;
 }
 
-int library_at(catis_context* context) {
-    // (list index -- element)
-    if (check_stack_type(
-        context,
-        2, 
-        CATIS_TYPE_LIST | CATIS_TYPE_TUPLE | CATIS_TYPE_STRING,
-        CATIS_TYPE_INT
-    )) {
-        return 1;
+/* -- embedding -- */
+/*
+ * The API of catis.h. A library is a shared holding the built-ins and
+ * whatever its owner adds, frozen when the first interpreter is made from
+ * it: every body is analysed and compiled once for all and its symbols
+ * flagged to resolve in the library alone, so that nothing rebinding a name
+ * in an interpreter invalidates it and interpreters on any thread only read
+ * it. Each interpreter then gets a shared of its own on top, with its own
+ * definitions, locks and pool.
+ */
+pthread_once_t characters_once = PTHREAD_ONCE_INIT;
+
+/* the symbols of list and of the lists in it, with its last uses */
+void seal_list(catis_object* list) {
+    for (size_t i = 0; i < list->collection.length; i++) {
+        catis_object* object = list->collection.element[i];
+        if (is_immediate(object)) {
+            continue;
+        }
+        if (object->type == CATIS_TYPE_LIST) {
+            seal_list(object);
+        }
+        else if (object->type == CATIS_TYPE_SYMBOL) {
+            object->string_or_symbol.library = 1;
+            if (object->string_or_symbol.last_use_generation == current_generation()) {
+                object->string_or_symbol.last_use_generation =
+                    CATIS_SEALED_GENERATION;
+            }
+        }
     }
-    catis_object* index_object = stack_pop(context);
-    catis_object* object = stack_pop(context);
+}
 
-    int index = index_object->integer;
-    release(index_object);
+void seal_procedure(catis_context* context, catis_procedure* procedure) {
+    if (procedure->procedure) {
+        seal_list(procedure->procedure);
+        procedure->analysis_generation = CATIS_SEALED_GENERATION;
+    }
+    if (procedure->source) {
+        seal_list(procedure->source);
+    }
+    if (procedure->join) {
+        seal_list(procedure->join->body);
+    }
+    if (procedure->memo) {
+        seal_procedure(context, &procedure->memo->body);
+    }
+}
 
-    size_t length =
-        object->type == CATIS_TYPE_STRING ?
-        object->string_or_symbol.length :
-        object->collection.length;
-    if (index < 0) {
-        index = length + index;
+/* with its analysis lock held, no interpreter made from it yet */
+void freeze_library(catis_library* library) {
+    catis_context* context = new_context(library);
+    // analysed all at the current generation before any gets sealed, so
+    // that the last uses found are those of the same generation
+    for (catis_procedure* p = library->procedure; p; p = p->next) {
+        if (p->procedure) {
+            analyze_procedure(context, p, 0);
+        }
+        if (p->memo) {
+            analyze_procedure(context, &p->memo->body, 0);
+        }
     }
-    if (index < 0 || (size_t)index >= length) {
-        stack_push(context, new_boolean(0));
+    for (catis_procedure* p = library->procedure; p; p = p->next) {
+        seal_procedure(context, p);
     }
-    else {
-        if (object->type == CATIS_TYPE_STRING) {
-            stack_push(
-                context,
-                new_string(object->string_or_symbol.pointer + index, 1)
-            );
+    for (catis_procedure* p = library->procedure; p; p = p->next) {
+        if (p->procedure) {
+            prepare_code_unlocked(context, p);
         }
-        else {
-            stack_push(context, object->collection.element[index]);
-            retain(object->collection.element[index]);
+        if (p->memo) {
+            prepare_code_unlocked(context, &p->memo->body);
         }
     }
-    release(object);
-    return 0;
+    free_context(context);
+    library->frozen = 1;
 }
 
-int library_concatenate(catis_context* context) {
-    if (check_stack_length(context, 2)) { return 1; }
-    if (context->stack[context->stack_length - 1]->type !=
-        context->stack[context->stack_length - 2]->type
-    ) {
-        set_error(
-            context,
-            NULL,
-            "concatenate expects two objects of the same type"
-        );
+/* like a line of the repl */
+int eval_string(catis_context* context, const char* program) {
+    size_t length = strlen(program);
+    char* text = catis_allocate(length + 4);
+    text[0] = '[';
+    memcpy(text + 1, program, length);
+    // a comment on the last line does not swallow the end of the list
+    memcpy(text + 1 + length, "\n]", 3);
+    catis_object* list = parse_object(context, text, NULL, NULL);
+    catis_free(text);
+    if (list == NULL) {
         return 1;
     }
-    if (check_stack_type(
-        context,
-        2,
-        CATIS_TYPE_LIST | CATIS_TYPE_TUPLE |
-        CATIS_TYPE_STRING | CATIS_TYPE_SYMBOL,
-        CATIS_TYPE_LIST | CATIS_TYPE_TUPLE |
-        CATIS_TYPE_STRING | CATIS_TYPE_SYMBOL
-    )) {
+    int error = eval_toplevel(context, list);
+    release(list);
+    return error;
+}
+
+catis_library* catis_library_new(void) {
+    // interpreters may run on several threads from now on
+    multithreaded = 1;
+    pthread_once(&characters_once, init_characters);
+    catis_shared* library = new_shared(NULL);
+    catis_context* context = new_context(library);
+    load_library(context);
+    free_context(context);
+    return library;
+}
+
+int catis_library_eval(catis_library* library, const char* program) {
+    if (library->frozen) {
+        fprintf(stderr, "catis: the library is used by interpreters already\n");
+        return 1;
+    }
+    catis_context* context = new_context(library);
+    int error = eval_string(context, program);
+    if (error) {
+        fprintf(stderr, "catis: %s\n", context->error_string);
+    }
+    free_context(context);
+    stop_pool(library);
+    return error;
+}
+
+int catis_library_register(
+    catis_library* library,
+    const char* name,
+    catis_c_procedure procedure
+) {
+    if (library->frozen) {
         return 1;
     }
+    catis_context* context = new_context(library);
+    add_procedure(context, name, procedure, NULL);
+    free_context(context);
+    return 0;
+}
 
-    catis_object* source = stack_pop(context);
-    catis_object* destination = stack_peek(context, 0);
-    destination = get_unshared_object(destination);
-    stack_set(context, 0, destination);
+void catis_library_release(catis_library* library) {
+    if (count_down(&library->reference_count) > 0) {
+        return;
+    }
+    stop_pool(library);
+    free_shared(library);
+}
 
-    if (source->type & (CATIS_TYPE_STRING | CATIS_TYPE_SYMBOL)) {
-        destination->string_or_symbol.pointer = catis_reallocate(
-            destination->string_or_symbol.pointer,
-            destination->string_or_symbol.length +
-            source->string_or_symbol.length +
-            1
-        );
-        memcpy(
-            destination->string_or_symbol.pointer +
-            destination->string_or_symbol.length,
-            source->string_or_symbol.pointer,
-            source->string_or_symbol.length + 1
-        );
-        destination->string_or_symbol.length +=
-            source->string_or_symbol.length;
+catis_context* catis_new(catis_library* library) {
+    pthread_mutex_lock(&library->analysis);
+    if (!library->frozen) {
+        freeze_library(library);
+    }
+    pthread_mutex_unlock(&library->analysis);
+    count_up(&library->reference_count);
+    catis_context* context = new_context(new_shared(library));
+    context->error_string[0] = 0;
+    return context;
+}
+
+void catis_destroy(catis_context* context) {
+    catis_shared* shared = context->shared;
+    stop_pool(shared);
+    free_context(context);
+    catis_library* library = shared->base;
+    free_shared(shared);
+    catis_library_release(library);
+}
+
+int catis_eval(catis_context* context, const char* program) {
+    return eval_string(context, program);
+}
+
+int catis_call(catis_context* context, const char* name) {
+    enter_shared(context->shared);
+    catis_procedure* procedure = lookup_procedure(context, name);
+    int error = 1;
+    if (procedure == NULL) {
+        set_error(context, name, "Symbol not bound to procedure");
     }
     else {
-        for (size_t i = 0; i < source->collection.length; i++) {
-            retain(source->collection.element[i]);
-        }
-        destination->collection.element = catis_reallocate(
-            destination->collection.element,
-            (destination->collection.length +
-            source->collection.length) * sizeof(catis_object*)
-        );
-        memcpy(
-            destination->collection.element +
-            destination->collection.length,
-            source->collection.element,
-            source->collection.length * sizeof(catis_object*)
-        );
-        destination->collection.length += source->collection.length;
+        error = call_procedure(context, procedure);
     }
-    release(source);
-    return 0;
+    output_flush(&context->output);
+    leave_shared(context->shared);
+    wait_for_tasks(context->shared);
+    return error;
 }
 
-int library_to_tuple(catis_context* context) {
-    if (check_stack_type(context, 1, CATIS_TYPE_LIST)) { return 1; }
-    catis_object* list = stack_pop(context);
-    list = get_unshared_object(list);
-    list->type = CATIS_TYPE_TUPLE;
-    stack_push(context, list);
-    return 0;
+void catis_register(
+    catis_context* context,
+    const char* name,
+    catis_c_procedure procedure
+) {
+    add_procedure(context, name, procedure, NULL);
 }
 
-int library_show_stack(catis_context* context) {
-    stack_show(context);
-    return 0;
-};
+const char* catis_error(catis_context* context) {
+    return context->error_string;
+}
 
-int library_definitions(catis_context* context) {
-    catis_procedure* next = context->procedure;
+int catis_fail(catis_context* context, const char* message) {
+    set_error(context, NULL, message);
+    return 1;
+}
 
-    while (next != NULL) {
-        printf("%s", next->name);
-        next = next->next;
-        if (next != NULL) {
-            printf("  ");
-        }
-    }
-    printf("\n");
+void catis_push(catis_context* context, catis_object* value) {
+    stack_push(context, value);
+}
 
-    return 0;
+catis_object* catis_pop(catis_context* context) {
+    return context->stack_length ? stack_pop(context) : NULL;
 }
 
-int library_unquote(catis_context* context) {
-    if (check_stack_type(context, 1, CATIS_TYPE_SYMBOL)) { return 1; }
-    catis_object* symbol = stack_pop(context);
-    catis_procedure* procedure = lookup_procedure(context, symbol->string_or_symbol.pointer);
-    if (procedure == NULL || procedure->c_procedure) {
-        stack_push(context, new_boolean(0));
-        return 0;
-    }
-    stack_push(context, procedure->procedure);
-    return 0;
+size_t catis_depth(catis_context* context) {
+    return context->stack_length;
 }
 
-void load_library(catis_context* context) {
-    add_procedure(context, "+", library_math, NULL);
-    add_procedure(context, "-", library_math, NULL);
-    add_procedure(context, "*", library_math, NULL);
-    add_procedure(context, "/", library_math, NULL);
-    add_procedure(context, "==", library_compare, NULL);
-    add_procedure(context, "!=", library_compare, NULL);
-    add_procedure(context, ">=", library_compare, NULL);
-    add_procedure(context, "<=", library_compare, NULL);
-    add_procedure(context, ">",  library_compare, NULL);
-    add_procedure(context, "<",  library_compare, NULL);
-    add_procedure(context, "&", library_logic, NULL);
-    add_procedure(context, "|", library_logic, NULL);
-    add_procedure(context, "sort", library_sort, NULL);
-    add_procedure(context, "define", library_define, NULL);
-    add_procedure(context, "if",      library_if, NULL);
-    add_procedure(context, "if-else", library_if, NULL);
-    add_procedure(context, "while",   library_if, NULL);
-    add_procedure(context, "eval", library_eval, NULL);
-    add_procedure(context, "up-eval", library_up_eval, NULL);
-    add_procedure(context, "prin", library_print, NULL);
-    add_procedure(context, "print", library_println, NULL);
-    add_procedure(context, "len", library_length, NULL);
-    add_procedure(context, "<-", library_list_append, NULL);
-    add_procedure(context, "@", library_at, NULL);
-    add_procedure(context, ".", library_show_stack, NULL);
-    add_procedure(context, "^", library_concatenate, NULL);
-    add_procedure(context, "to-tuple", library_to_tuple, NULL);
-    add_procedure(context, "unquote", library_unquote, NULL);
-    add_procedure(context, "%defs", library_definitions, NULL);
+catis_object* catis_int(int value) {
+    return new_integer(value);
+}
 
-    add_string_procedure(context, "dup", "[{x} $x $x]");
-    add_string_procedure(context, "swap", "[{x y} $y $x]");
-    add_string_procedure(context, "drop", "[{_}]");
+catis_object* catis_bool(int value) {
+    return new_boolean(value);
+}
 
-    add_string_procedure(
-        context, "map",
-        "[{l f}   $l len {s}   0 {i}   [] [$i $s <] [ $l $i @   $f up-eval   <-   $i 1 + {i} ] while]"
-    );
-    add_string_procedure(
-        context, "each",
-        "[{l f}   $l len {s}   0 {i}   [$i $s <] [ $l $i @   $f up-eval   $i 1 + {i} ] while]"
-    );
-    add_string_procedure(context, "head", "[0 @]");
-    add_string_procedure(
-        context, "tail",
-        "[#t {d}   [] {n}   [ [$d] [#f {d}   drop] [$n swap <- {n}] if-else ] each $n]"
-    );
-    add_string_procedure(context, "~", "[{b} [$b] [#f {b}] [#t {b}] if-else $b]");
-    add_string_procedure(context, "range", "[{s e} [] {r} [$s $e <] [$r $s <- {r} $s 1 + {s}] while $r]");
+catis_object* catis_string(const char* string, size_t length) {
+    return new_string(string, length);
 }
 
-/* -- repl -- */
-void repl(catis_context* context) {
-    char buffer[1024];
-    while(1) {
-        printf("catis> ");
-        fflush(stdout);
+catis_object* catis_parse(const char* source) {
+    return parse_object(NULL, source, NULL, NULL);
+}
 
-        buffer[0] = '[';
+int catis_type(catis_object* value) {
+    return object_type(value);
+}
 
-        if (fgets(buffer + 1, sizeof(buffer) - 2, stdin) == NULL) {
-            break;
+int catis_int_value(catis_object* value) {
+    return object_integer(value);
+}
+
+int catis_bool_value(catis_object* value) {
+    return object_boolean(value);
+}
+
+const char* catis_string_value(catis_object* value, size_t* length) {
+    if (!(object_type(value) & (CATIS_TYPE_STRING | CATIS_TYPE_SYMBOL))) {
+        return NULL;
+    }
+    *length = value->string_or_symbol.length;
+    return value->string_or_symbol.pointer;
+}
+
+void catis_retain(catis_object* value) {
+    retain(value);
+}
+
+void catis_release(catis_object* value) {
+    release(value);
+}
+
+/* -- main -- */
+// built with -DCATIS_LIBRARY, this file is the library of catis.h
+#ifndef CATIS_LIBRARY
+#ifdef CATIS_COMPILED
+// written by catis -c after including this file
+void load_compiled(catis_context* context);
+extern const char compiled_source[];
+
+/* calls between compiled procedures nest in C, the program gets room */
+#define CATIS_COMPILED_STACK_SIZE ((size_t)1 << 30)
+typedef struct catis_compiled_run {
+    char** argv;
+    int argc;
+    catis_options* options;
+    int return_value;
+} catis_compiled_run;
+
+void* run_compiled(void* argument) {
+    catis_compiled_run* run = argument;
+    catis_source source;
+    source.text = (char*)compiled_source;
+    source.length = strlen(compiled_source);
+    source.mapped = 0;
+    run->options->load_compiled = load_compiled;
+    run->return_value = eval_source(&source, run->argv, run->argc, run->options);
+    return NULL;
+}
+#endif
+
+void usage(void) {
+    fprintf(
+        stderr,
+        "usage: catis [options] [file [arguments...]]\n"
+        "       catis -c file > file.c\n"
+        "       catis --serve <socket> [prelude files...]\n"
+        "       catis --connect <socket> file [arguments...]\n"
+        "  -c           write the procedures of file out as C, see the Tupfile\n"
+        "  --stack <n>  preallocate room for n objects on the stack\n"
+        "  --profile <file>  profile the file, report on stderr and\n"
+        "                    write its folded stacks to file\n"
+        "  --stats      print the memory statistics on stderr at exit\n"
+        "  --save-image <file>  save the procedures defined to file\n"
+        "  --load-image <file>  start with the procedures saved in file\n"
+        "  --serve <socket>     run the files clients send, each in a fork\n"
+        "                       of an interpreter that loaded the preludes\n"
+        "  --connect <socket>   run file on the server listening there\n"
+    );
+}
+
+int main(int argc, char** argv) {
+    catis_options options;
+    options.stack_size = 0;
+    options.profile = NULL;
+    options.stats = 0;
+    options.save_image = NULL;
+    options.load_image = NULL;
+    options.compile = 0;
+    options.serve = NULL;
+    options.connect = NULL;
+    options.load_compiled = NULL;
+
+    int i = 1;
+    for (
+        ;
+        i < argc && argv[i][0] == '-' &&
+        (argv[i][1] == '-' || !strcmp(argv[i], "-c"));
+        i++
+    ) {
+        if (!strcmp(argv[i], "-c")) {
+            options.compile = 1;
         }
-        size_t length = strlen(buffer);
-        if (length && buffer[length - 1] == '\n') {
-            buffer[--length] = 0;
+        else if (!strcmp(argv[i], "--stack") && i + 1 < argc) {
+            options.stack_size = strtoul(argv[++i], NULL, 10);
         }
-        if (length == 0) {
-            continue;
+        else if (!strcmp(argv[i], "--profile") && i + 1 < argc) {
+            options.profile = argv[++i];
         }
-
-        buffer[length] = ']';
-        buffer[length + 1] = 0;
-
-        catis_object* program = parse_object(context, buffer, NULL, NULL);
-        if (!program) {
-            printf("Parsing program: %s\n", context->error_string);
-            continue;
+        else if (!strcmp(argv[i], "--stats")) {
+            options.stats = 1;
+        }
+        else if (!strcmp(argv[i], "--save-image") && i + 1 < argc) {
+            options.save_image = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--load-image") && i + 1 < argc) {
+            options.load_image = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--serve") && i + 1 < argc) {
+            options.serve = argv[++i];
         }
-        if (eval(context, program)) {
-            printf("%s\n", context->error_string);
+        else if (!strcmp(argv[i], "--connect") && i + 1 < argc) {
+            options.connect = argv[++i];
         }
         else {
-            stack_show(context);
+            usage();
+            return 1;
         }
-        release(program);
     }
-}
 
-int eval_file(const char* filename, char** argv, int argc) {
-    FILE* file_pointer = fopen(filename, "r");
-    if (!file_pointer) {
-        perror("Opening file");
-        return 1;
+#ifdef CATIS_COMPILED
+    // the file is built in, every argument is for it
+    catis_compiled_run run = { argv + i, argc - i, &options, 0 };
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, CATIS_COMPILED_STACK_SIZE);
+    pthread_t thread;
+    if (pthread_create(&thread, &attributes, run_compiled, &run)) {
+        run_compiled(&run);
+    }
+    else {
+        // line samples are taken on the thread running the program
+        sigset_t profile;
+        sigemptyset(&profile);
+        sigaddset(&profile, SIGPROF);
+        pthread_sigmask(SIG_BLOCK, &profile, NULL);
+        pthread_join(thread, NULL);
     }
+    pthread_attr_destroy(&attributes);
+    return run.return_value ? 1 : 0;
+#endif
 
-    int increment_amount = 1024;
-    char* buffer = catis_allocate(increment_amount);
-    size_t buffer_length = 1, nread;
-    size_t space_left = increment_amount - buffer_length;
-    buffer[0] = '[';
-    while (
-        nread = fread(buffer + buffer_length, 1, space_left, file_pointer)
-    ) {
-        buffer_length += nread;
-        space_left -= nread;
-        if (space_left == 0) {
-            buffer =
-                catis_reallocate(buffer, buffer_length + increment_amount);
-            space_left += increment_amount;
+    if (options.compile) {
+        if (i + 1 != argc) {
+            usage();
+            return 1;
         }
+        return compile_file(argv[i], stdout);
     }
-    if (space_left < 2) {
-        buffer = catis_reallocate(buffer, buffer_length + 2);
-    }
-    buffer[buffer_length++] = ']';
-    buffer[buffer_length++] = 0;
-    fclose(file_pointer);
 
-    catis_context* context = new_interpreter();
-    int line = 1;
-    catis_object* program = parse_object(context, buffer, NULL, &line);
-    free(buffer);
-    if (!program) {
-        printf("Parsing program: %s\n", context->error_string);
-        return 1;
+    if (options.serve) {
+        return serve(options.serve, argv + i, argc - i, &options);
     }
-
-    for (int i = 0; i < argc; i++) {
-        catis_object* object = parse_object(NULL, argv[i], NULL, 0);
-        if (!object) {
-            printf("Parsing program: %s\n", context->error_string);
-            release(object);
+    if (options.connect) {
+        if (i == argc) {
+            usage();
             return 1;
         }
-        stack_push(context, object);
-    }
-
-    int return_value = eval(context, program);
-    if (return_value) {
-        printf("Runtime error: %s\n", context->error_string);
+        return connect_server(options.connect, argv + i, argc - i);
     }
-    repl(context);
-    release(program);
-    return return_value;
-}
 
-/* -- main -- */
-int main(int argc, char** argv) {
-    if (argc == 1) {
+    if (i == argc) {
         catis_context* context = new_interpreter();
+        reserve_stack(context, options.stack_size);
+        if (options.load_image && load_image(context, options.load_image)) {
+            return 1;
+        }
         repl(context);
+        if (options.save_image && save_image(context, options.save_image)) {
+            perror("Saving image");
+            return 1;
+        }
+        if (options.stats) {
+            print_stats(context, stderr);
+        }
     }
-    else if (argc >= 2) {
-        if (eval_file(argv[1], argv + 2, argc - 2)) {
+    else {
+        if (eval_file(argv[i], argv + i + 1, argc - i - 1, &options)) {
             return 1;
         }
     }
     return 0;
 } 
+#endif
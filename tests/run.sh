@@ -0,0 +1,28 @@
+#!/bin/sh
+# Run the tests: each tests/<name>.cat runs with no input, what it prints,
+# errors included, has to be tests/<name>.out. A run taking more than 10
+# seconds fails, for the ones that used to hang.
+#
+# usage: tests/run.sh [catis]
+#   catis  the binary to test (default build/catis)
+
+tests=$(dirname "$0")
+catis=${1:-$tests/../build/catis}
+
+output=$(mktemp)
+trap 'rm -f "$output"' EXIT
+
+failed=0
+for script in "$tests"/*.cat; do
+    name=$(basename "$script" .cat)
+    timeout 10 "$catis" "$script" < /dev/null > "$output" 2>&1
+    if cmp -s "$output" "$tests/$name.out"; then
+        echo "ok      $name"
+    else
+        echo "FAILED  $name"
+        diff "$tests/$name.out" "$output" | head -20
+        failed=$((failed + 1))
+    fi
+done
+
+[ "$failed" -eq 0 ]